@@ -1,300 +1,3139 @@
 #include "cinet.h"
+#include <gio/gio.h>
 #include <string.h>
-#include <json-glib/json-glib.h>
-#include <json-glib/json-gobject.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <glib/gprintf.h>
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CINET_HAVE_SSE42 1
+#include <nmmintrin.h>
+#else
+#define CINET_HAVE_SSE42 0
+#endif
+
+typedef struct _CINetJsonReader CINetJsonReader;
+typedef gboolean (*CINetJsonMemberFunc)(gpointer, CINetMsgField, CINetJsonReader *);
+
+typedef struct _CINetBinReader CINetBinReader;
+typedef gboolean (*CINetBinFieldFunc)(gpointer, guint, CINetBinReader *);
+
+typedef struct _CINetWriter CINetWriter;
+
+typedef struct _CINetArena CINetArena;
+
+/* Kinds of members in the schema of a message. */
+typedef enum {
+    CINET_KIND_INT,                   /* gint */
+    CINET_KIND_UINT,                  /* guint32 */
+    CINET_KIND_STRING,                /* gchar * */
+    CINET_KIND_MSGID,                 /* gchar[16] */
+    CINET_KIND_CALL_INFO,             /* Embedded CICallInfo */
+    CINET_KIND_CALLER_INFO,           /* Embedded CICallerInfo */
+    CINET_KIND_CALL_LIST,             /* GList of CICallInfo */
+    CINET_KIND_CALLER_LIST            /* GList of CICallerInfo */
+} CINetFieldKind;
+
+/* How a member is sent in JSON if it is 0 or NULL. */
+typedef enum {
+    CINET_OPTION_NONE = 0,            /* Sent, NULL as null. */
+    CINET_OPTION_OMIT,                /* Not sent. */
+    CINET_OPTION_EMPTY                /* Sent, NULL as "". */
+} CINetFieldOption;
+
+typedef struct {
+    const gchar *name;                /* Name in JSON. */
+    CINetMsgField field;
+    guint16 offset;                   /* Offset in the structure. */
+    guint8 kind;                      /* [type: CINetFieldKind] */
+    guint8 option;                    /* [type: CINetFieldOption] */
+    guint32 flag;                     /* Bit in @CINetMsgCallFields. */
+} CINetSchemaField;
+
+typedef struct {
+    const CINetSchemaField *fields;
+    guint n_fields;
+    gsize size;                       /* Size of the structure. */
+    gssize fields_offset;             /* Offset of the @CINetMsgCallFields or -1. */
+} CINetSchema;
+
+#define CINET_SCHEMA_FIELD(type, member, name, field, kind, option, flag) \
+    { name, field, G_STRUCT_OFFSET(type, member), CINET_KIND_##kind, CINET_OPTION_##option, flag },
+
+#define CINET_FIELD_P(data, f)         G_STRUCT_MEMBER_P((data), (f)->offset)
+#define CINET_FIELD_INT(data, f)       G_STRUCT_MEMBER(gint, (data), (f)->offset)
+#define CINET_FIELD_UINT(data, f)      G_STRUCT_MEMBER(guint32, (data), (f)->offset)
+#define CINET_FIELD_STRING(data, f)    G_STRUCT_MEMBER(gchar*, (data), (f)->offset)
+#define CINET_FIELD_LIST(data, f)      G_STRUCT_MEMBER(GList*, (data), (f)->offset)
+
+#define CINET_KIND_IS_INFO(kind) ((kind) == CINET_KIND_CALL_INFO || (kind) == CINET_KIND_CALLER_INFO)
+#define CINET_KIND_IS_LIST(kind) ((kind) == CINET_KIND_CALL_LIST || (kind) == CINET_KIND_CALLER_LIST)
+
+static const CINetSchemaField cinet_call_info_fields[] = { CI_CALL_INFO_SCHEMA(CINET_SCHEMA_FIELD) };
+static const CINetSchemaField cinet_caller_info_fields[] = { CI_CALLER_INFO_SCHEMA(CINET_SCHEMA_FIELD) };
+
+static const CINetSchema cinet_call_info_schema = {
+    cinet_call_info_fields, G_N_ELEMENTS(cinet_call_info_fields), sizeof(CICallInfo),
+    G_STRUCT_OFFSET(CICallInfo, fields)
+};
+
+static const CINetSchema cinet_caller_info_schema = {
+    cinet_caller_info_fields, G_N_ELEMENTS(cinet_caller_info_fields), sizeof(CICallerInfo),
+    -1
+};
+
+#define CINET_MSG_SCHEMA(name, type, schema) \
+    static const CINetSchemaField name##_fields[] = { schema(CINET_SCHEMA_FIELD) }; \
+    static const CINetSchema name = { name##_fields, G_N_ELEMENTS(name##_fields), sizeof(type), -1 }
+
+CINET_MSG_SCHEMA(cinet_msg_version_schema, CINetMsgVersion, CI_NET_MSG_VERSION_SCHEMA);
+CINET_MSG_SCHEMA(cinet_msg_event_ring_schema, CINetMsgEventRing, CI_NET_MSG_EVENT_RING_SCHEMA);
+CINET_MSG_SCHEMA(cinet_msg_event_call_schema, CINetMsgEventCall, CI_NET_MSG_EVENT_CALL_SCHEMA);
+CINET_MSG_SCHEMA(cinet_msg_db_num_calls_schema, CINetMsgDbNumCalls, CI_NET_MSG_DB_NUM_CALLS_SCHEMA);
+CINET_MSG_SCHEMA(cinet_msg_db_call_list_schema, CINetMsgDbCallList, CI_NET_MSG_DB_CALL_LIST_SCHEMA);
+CINET_MSG_SCHEMA(cinet_msg_db_get_caller_schema, CINetMsgDbGetCaller, CI_NET_MSG_DB_GET_CALLER_SCHEMA);
+CINET_MSG_SCHEMA(cinet_msg_db_add_caller_schema, CINetMsgDbAddCaller, CI_NET_MSG_DB_ADD_CALLER_SCHEMA);
+CINET_MSG_SCHEMA(cinet_msg_db_del_caller_schema, CINetMsgDbDelCaller, CI_NET_MSG_DB_DEL_CALLER_SCHEMA);
+CINET_MSG_SCHEMA(cinet_msg_db_get_caller_list_schema, CINetMsgDbGetCallerList, CI_NET_MSG_DB_GET_CALLER_LIST_SCHEMA);
+
 struct CINetMsgClass {
     CINetMsgType msgtype;
     gsize size;
-    JsonNode *(*msg_build)(CINetMsg *);
-    CINetMsg *(*msg_read)(JsonNode *);
-    void (*msg_free)(CINetMsg *);
-    void (*msg_set_value)(CINetMsg *, const gchar *, const gpointer);
+    const CINetSchema *schema;        /* Members after the guid, NULL if there are none. */
+};
+
+static void cinet_schema_build(const CINetSchema *schema, gconstpointer data, CINetWriter *out);
+static gboolean cinet_schema_read(CINetMsg *msg, const CINetSchema *schema, gpointer data,
+                                  CINetMsgField field, CINetJsonReader *reader);
+static guint cinet_schema_build_binary(const CINetSchema *schema, gconstpointer data, CINetWriter *out,
+                                       guint field);
+static gboolean cinet_schema_read_binary(CINetMsg *msg, const CINetSchema *schema, gpointer data,
+                                         guint field, guint base, CINetBinReader *reader);
+static void cinet_schema_set_field(CINetMsg *msg, const CINetSchema *schema, gpointer data,
+                                   CINetMsgField field, const gpointer value);
+static void cinet_schema_free(CINetMsg *msg, const CINetSchema *schema, gpointer data);
+static gboolean cinet_schema_borrow_string(const CINetSchema *schema, gpointer data,
+                                           CINetMsgField field, const gchar *value);
+static void cinet_schema_forget_strings(const CINetSchema *schema, gpointer data);
+
+static struct CINetMsgClass msgclasses[] = {
+    { CI_NET_MSG_VERSION, sizeof(CINetMsgVersion), &cinet_msg_version_schema },
+    { CI_NET_MSG_EVENT_RING, sizeof(CINetMsgEventRing), &cinet_msg_event_ring_schema },
+    { CI_NET_MSG_EVENT_CALL, sizeof(CINetMsgEventCall), &cinet_msg_event_call_schema },
+    { CI_NET_MSG_EVENT_CONNECT, sizeof(CINetMsg), NULL },
+    { CI_NET_MSG_EVENT_DISCONNECT, sizeof(CINetMsg), NULL },
+    { CI_NET_MSG_LEAVE, sizeof(CINetMsgLeave), NULL },
+    { CI_NET_MSG_SHUTDOWN, sizeof(CINetMsgShutdown), NULL },
+    { CI_NET_MSG_DB_NUM_CALLS, sizeof(CINetMsgDbNumCalls), &cinet_msg_db_num_calls_schema },
+    { CI_NET_MSG_DB_CALL_LIST, sizeof(CINetMsgDbCallList), &cinet_msg_db_call_list_schema },
+    { CI_NET_MSG_DB_GET_CALLER, sizeof(CINetMsgDbGetCaller), &cinet_msg_db_get_caller_schema },
+    { CI_NET_MSG_DB_ADD_CALLER, sizeof(CINetMsgDbAddCaller), &cinet_msg_db_add_caller_schema },
+    { CI_NET_MSG_DB_DEL_CALLER, sizeof(CINetMsgDbDelCaller), &cinet_msg_db_del_caller_schema },
+    { CI_NET_MSG_DB_GET_CALLER_LIST, sizeof(CINetMsgDbGetCallerList), &cinet_msg_db_get_caller_list_schema },
+};
+
+static struct CINetMsgClass *cinet_msg_get_class(CINetMsg *msg)
+{
+    if (!msg || msg->msgtype >= CI_NET_MSG_COUNT)
+        return NULL;
+    return &msgclasses[msg->msgtype];
+}
+
+static struct CINetMsgClass *cinet_msg_type_get_class(CINetMsgType msgtype)
+{
+    if (msgtype >= CI_NET_MSG_COUNT)
+        return NULL;
+    return &msgclasses[msgtype];
+}
+
+/* Arena for messages decoded with @CINET_READ_ARENA. The message, its strings
+ * and list entries are carved from a few large chunks which are released
+ * together. The first chunk also holds the arena itself. */
+typedef struct _CINetArenaChunk {
+    struct _CINetArenaChunk *next;
+    gchar *data;
+    gsize size;
+} CINetArenaChunk;
+
+struct _CINetArena {
+    CINetArenaChunk *chunks;
+    gchar *pos;
+    gchar *end;
+    gsize next_size;
+    CINetArenaChunk view;             /* Buffer of a view. Not owned by the arena. */
+};
+
+#define CINET_ARENA_ALIGN(n) (((n) + 7) & ~(gsize)7)
+
+static CINetArenaChunk *cinet_arena_chunk_new(gsize size, gsize extra)
+{
+    CINetArenaChunk *chunk = g_malloc(CINET_ARENA_ALIGN(sizeof(CINetArenaChunk)) + extra + size);
+
+    chunk->next = NULL;
+    chunk->data = (gchar*)chunk + CINET_ARENA_ALIGN(sizeof(CINetArenaChunk)) + extra;
+    chunk->size = size;
+
+    return chunk;
+}
+
+static CINetArena *cinet_arena_new(gsize size)
+{
+    CINetArenaChunk *chunk;
+    CINetArena *arena;
+
+    size = CINET_ARENA_ALIGN(MAX(size, 256));
+    chunk = cinet_arena_chunk_new(size, CINET_ARENA_ALIGN(sizeof(CINetArena)));
+    arena = (CINetArena*)((gchar*)chunk + CINET_ARENA_ALIGN(sizeof(CINetArenaChunk)));
+
+    arena->chunks = chunk;
+    arena->pos = chunk->data;
+    arena->end = chunk->data + size;
+    arena->next_size = size * 2;
+    arena->view.next = NULL;
+    arena->view.data = NULL;
+    arena->view.size = 0;
+
+    return arena;
+}
+
+/* Strings of a view are terminated in place in @data. */
+static void cinet_arena_set_view(CINetArena *arena, gchar *data, gsize size)
+{
+    arena->view.data = data;
+    arena->view.size = size;
+}
+
+static void cinet_arena_free(CINetArena *arena)
+{
+    CINetArenaChunk *chunk, *next;
+
+    if (arena == NULL)
+        return;
+
+    /* The first chunk holds the arena, so it is freed last. */
+    for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        g_free(chunk);
+    }
+}
+
+static gpointer cinet_arena_alloc_aligned(CINetArena *arena, gsize size, gboolean align)
+{
+    CINetArenaChunk *chunk;
+    gchar *pos;
+
+    pos = align ? (gchar*)CINET_ARENA_ALIGN((gsize)arena->pos) : arena->pos;
+    if (size > (gsize)(arena->end - pos) || pos > arena->end) {
+        arena->next_size = MAX(arena->next_size, CINET_ARENA_ALIGN(size));
+        chunk = cinet_arena_chunk_new(arena->next_size, 0);
+        /* Keep the first chunk at the end of the list, it holds the arena. */
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->end = chunk->data + chunk->size;
+        arena->next_size *= 2;
+        pos = chunk->data;
+    }
+    arena->pos = pos + size;
+
+    return pos;
+}
+
+static inline gpointer cinet_arena_alloc0(CINetArena *arena, gsize size)
+{
+    return memset(cinet_arena_alloc_aligned(arena, size, TRUE), 0, size);
+}
+
+static gchar *cinet_arena_strdup(CINetArena *arena, const gchar *str)
+{
+    gsize len;
+
+    if (arena == NULL)
+        return g_strdup(str);
+    if (str == NULL)
+        return NULL;
+    /* Strings in the buffer of a view are terminated in place. */
+    if (str >= arena->view.data && str < arena->view.data + arena->view.size)
+        return (gchar*)str;
+
+    len = strlen(str) + 1;
+    return memcpy(cinet_arena_alloc_aligned(arena, len, FALSE), str, len);
+}
+
+static gboolean cinet_arena_contains(CINetArena *arena, gconstpointer ptr)
+{
+    CINetArenaChunk *chunk;
+
+    if (arena == NULL || ptr == NULL)
+        return FALSE;
+    if ((const gchar*)ptr >= arena->view.data && (const gchar*)ptr < arena->view.data + arena->view.size)
+        return TRUE;
+    for (chunk = arena->chunks; chunk != NULL; chunk = chunk->next) {
+        if ((const gchar*)ptr >= chunk->data && (const gchar*)ptr < chunk->data + chunk->size)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Hidden data in front of every message allocated by the library. The
+ * message points back to it, see @cinet_msg_get_private(). */
+typedef struct {
+    CINetArena *arena;                /* Arena holding the message or NULL. */
+    gint refcount;
+} CINetMsgPrivate;
+
+/* Get the hidden data of @msg. Messages the library did not allocate, e.g. on
+ * the stack, have none and are treated as unshared heap messages without an
+ * arena. Only the address is compared, so uninitialized members do no harm.
+ *
+ * @return: The hidden data or NULL.
+ */
+static inline CINetMsgPrivate *cinet_msg_get_private(CINetMsg *msg)
+{
+    if (msg == NULL || msg->priv != (gpointer)((CINetMsgPrivate*)msg - 1))
+        return NULL;
+    return msg->priv;
+}
+
+static inline CINetArena *cinet_msg_get_arena(CINetMsg *msg)
+{
+    CINetMsgPrivate *priv = cinet_msg_get_private(msg);
+
+    return priv ? priv->arena : NULL;
+}
+
+/* Shared messages must not be changed. */
+static inline gboolean cinet_msg_is_shared(CINetMsg *msg)
+{
+    CINetMsgPrivate *priv = cinet_msg_get_private(msg);
+
+    return priv && g_atomic_int_get(&priv->refcount) > 1;
+}
+
+/* Free a string owned by @msg. Strings in the arena of the message are left
+ * alone. Without a message the string belongs to a standalone @CICallInfo or
+ * @CICallerInfo and is freed. */
+static void cinet_msg_free_string(CINetMsg *msg, gchar *str)
+{
+    if (!cinet_arena_contains(cinet_msg_get_arena(msg), str))
+        g_free(str);
+}
+
+/* Free a message that failed to decode. The arena of the message, if any, is
+ * left to the caller. */
+static void cinet_msg_discard(CINetMsg *msg)
+{
+    struct CINetMsgClass *cls = cinet_msg_get_class(msg);
+
+    if (msg && cinet_msg_get_arena(msg)) {
+        if (cls && cls->schema)
+            cinet_schema_free(msg, cls->schema, msg);
+    }
+    else
+        cinet_msg_free(msg);
+}
+
+/* Prepend to a list, using the arena for the node if given. */
+static GList *cinet_list_prepend(GList *list, gpointer data, CINetArena *arena)
+{
+    GList *node;
+
+    if (arena == NULL)
+        return g_list_prepend(list, data);
+
+    node = cinet_arena_alloc_aligned(arena, sizeof(GList), TRUE);
+    node->data = data;
+    node->next = list;
+    node->prev = NULL;
+    if (list)
+        list->prev = node;
+
+    return node;
+}
+
+/* Optional pool of message objects. Freed messages are kept in small per
+ * thread caches. If a cache is full, half of it is moved to a global list per
+ * type, limited to @max objects. Pooled objects are linked through their
+ * first bytes. */
+#define CINET_MSG_POOL_CACHE_SIZE 32
+
+typedef struct {
+    gpointer items[CI_NET_MSG_COUNT][CINET_MSG_POOL_CACHE_SIZE];
+    guint count[CI_NET_MSG_COUNT];
+} CINetMsgPoolCache;
+
+static void cinet_msg_pool_cache_free(gpointer data);
+
+static struct {
+    GMutex lock;
+    gpointer free_list[CI_NET_MSG_COUNT];
+    guint count[CI_NET_MSG_COUNT];
+    gint max;
+} msgpool;
+
+static GPrivate msgpool_cache = G_PRIVATE_INIT(cinet_msg_pool_cache_free);
+
+/* Move up to @n objects from @cache to the global list. Objects exceeding the
+ * limit are freed. */
+static void cinet_msg_pool_flush(CINetMsgPoolCache *cache, CINetMsgType msgtype, guint n)
+{
+    guint max = (guint)g_atomic_int_get(&msgpool.max);
+    gpointer item;
+
+    g_mutex_lock(&msgpool.lock);
+    while (n-- > 0 && cache->count[msgtype] > 0) {
+        item = cache->items[msgtype][--cache->count[msgtype]];
+        if (msgpool.count[msgtype] < max) {
+            *(gpointer*)item = msgpool.free_list[msgtype];
+            msgpool.free_list[msgtype] = item;
+            ++msgpool.count[msgtype];
+        }
+        else
+            g_free(item);
+    }
+    g_mutex_unlock(&msgpool.lock);
+}
+
+static void cinet_msg_pool_cache_free(gpointer data)
+{
+    CINetMsgPoolCache *cache = data;
+    guint t;
+
+    for (t = 0; t < CI_NET_MSG_COUNT; ++t)
+        cinet_msg_pool_flush(cache, t, cache->count[t]);
+    g_free(cache);
+}
+
+static CINetMsgPoolCache *cinet_msg_pool_get_cache(void)
+{
+    CINetMsgPoolCache *cache = g_private_get(&msgpool_cache);
+
+    if (G_UNLIKELY(cache == NULL)) {
+        cache = g_malloc0(sizeof(CINetMsgPoolCache));
+        g_private_set(&msgpool_cache, cache);
+    }
+
+    return cache;
+}
+
+static gpointer cinet_msg_pool_get(CINetMsgType msgtype)
+{
+    CINetMsgPoolCache *cache = cinet_msg_pool_get_cache();
+    gpointer item;
+
+    if (cache->count[msgtype] == 0) {
+        g_mutex_lock(&msgpool.lock);
+        while (cache->count[msgtype] < CINET_MSG_POOL_CACHE_SIZE / 2 && msgpool.free_list[msgtype]) {
+            item = msgpool.free_list[msgtype];
+            msgpool.free_list[msgtype] = *(gpointer*)item;
+            --msgpool.count[msgtype];
+            cache->items[msgtype][cache->count[msgtype]++] = item;
+        }
+        g_mutex_unlock(&msgpool.lock);
+
+        if (cache->count[msgtype] == 0)
+            return NULL;
+    }
+
+    return cache->items[msgtype][--cache->count[msgtype]];
+}
+
+static void cinet_msg_pool_put(CINetMsgType msgtype, gpointer item)
+{
+    CINetMsgPoolCache *cache = cinet_msg_pool_get_cache();
+
+    if (cache->count[msgtype] == CINET_MSG_POOL_CACHE_SIZE)
+        cinet_msg_pool_flush(cache, msgtype, CINET_MSG_POOL_CACHE_SIZE / 2);
+    cache->items[msgtype][cache->count[msgtype]++] = item;
+}
+
+void cinet_msg_pool_set_max(guint max)
+{
+    CINetMsgPoolCache *cache;
+    gpointer item;
+    guint t;
+
+    g_atomic_int_set(&msgpool.max, (gint)MIN(max, G_MAXINT));
+
+    /* With the limit at 0 flushing frees the objects. */
+    if (max == 0 && (cache = g_private_get(&msgpool_cache)) != NULL) {
+        for (t = 0; t < CI_NET_MSG_COUNT; ++t)
+            cinet_msg_pool_flush(cache, t, cache->count[t]);
+    }
+
+    g_mutex_lock(&msgpool.lock);
+    for (t = 0; t < CI_NET_MSG_COUNT; ++t) {
+        while (msgpool.count[t] > max) {
+            item = msgpool.free_list[t];
+            msgpool.free_list[t] = *(gpointer*)item;
+            --msgpool.count[t];
+            g_free(item);
+        }
+    }
+    g_mutex_unlock(&msgpool.lock);
+}
+
+/* Allocate a message, from @arena if given. */
+static CINetMsg *cinet_msg_alloc_full(CINetMsgType msgtype, CINetArena *arena)
+{
+    struct CINetMsgClass *cls = cinet_msg_type_get_class(msgtype);
+    CINetMsgPrivate *priv = NULL;
+    CINetMsg *msg;
+
+    if (!cls || cls->size == 0)
+        return NULL;
+
+    if (arena)
+        priv = cinet_arena_alloc0(arena, sizeof(CINetMsgPrivate) + cls->size);
+    else if (g_atomic_int_get(&msgpool.max) > 0 && (priv = cinet_msg_pool_get(msgtype)) != NULL)
+        memset(priv, 0, sizeof(CINetMsgPrivate) + cls->size);
+    else
+        priv = g_malloc0(sizeof(CINetMsgPrivate) + cls->size);
+
+    priv->arena = arena;
+    priv->refcount = 1;
+    msg = (CINetMsg*)(priv + 1);
+    msg->msgtype = msgtype;
+    msg->priv = priv;
+
+    return msg;
+}
+
+CINetMsg *cinet_msg_alloc(CINetMsgType msgtype)
+{
+    return cinet_msg_alloc_full(msgtype, NULL);
+}
+
+CINetMsg *cinet_msg_ref(CINetMsg *msg)
+{
+    CINetMsgPrivate *priv = cinet_msg_get_private(msg);
+
+    g_return_val_if_fail(msg == NULL || priv != NULL, msg);
+
+    if (priv)
+        g_atomic_int_inc(&priv->refcount);
+    return msg;
+}
+
+void cinet_msg_unref(CINetMsg *msg)
+{
+    struct CINetMsgClass *cls = cinet_msg_get_class(msg);
+    CINetMsgPrivate *priv = cinet_msg_get_private(msg);
+
+    if (msg == NULL || (priv && !g_atomic_int_dec_and_test(&priv->refcount)))
+        return;
+
+    if (cls && cls->schema)
+        cinet_schema_free(msg, cls->schema, msg);
+
+    if (priv == NULL) {
+        g_free(msg);
+        return;
+    }
+
+    /* Do not let a later message at this address pass for a library one. */
+    msg->priv = NULL;
+    if (priv->arena)
+        cinet_arena_free(priv->arena);
+    else if (cls && g_atomic_int_get(&msgpool.max) > 0)
+        cinet_msg_pool_put(msg->msgtype, priv);
+    else
+        g_free(priv);
+}
+
+void cinet_msg_free(CINetMsg *msg)
+{
+    cinet_msg_unref(msg);
+}
+
+static inline void cinet_set_ulong(gpointer dst, gint off, guint32 val)
+{
+    ((guchar*)dst)[off  ] = val & 0xff;
+    ((guchar*)dst)[off+1] = (val >>  8) & 0xff;
+    ((guchar*)dst)[off+2] = (val >> 16) & 0xff;
+    ((guchar*)dst)[off+3] = (val >> 24) & 0xff;
+}
+
+#define cinet_get_ulong(buf, off) ((((guchar*)(buf))[(off)] & 0xff) |\
+                                   ((((guchar*)(buf))[(off)+1] & 0xff) << 8) |\
+                                   ((((guchar*)(buf))[(off)+2] & 0xff) << 16) |\
+                                   ((guint32)(((guchar*)(buf))[(off)+3] & 0xff) << 24))
+
+#define CINET_HEADER_SET_LEN(h, len)   cinet_set_ulong((h), 6, (len))
+#define CINET_HEADER_SET_TYPE(h, type) cinet_set_ulong((h), 10, (type))
+
+#define CINET_HEADER_GET_LEN(h)        cinet_get_ulong((h), 6)
+#define CINET_HEADER_GET_TYPE(h)       cinet_get_ulong((h), 10)
+
+#define CINET_MAGIC_STRING "ci-msg"
+#define CINET_CHECK_MAGIC_STRING(data) (!strncmp((gchar*)(data), CINET_MAGIC_STRING, 6))
+
+/* Output for the message builders. Data is either appended to a GString,
+ * written to a fixed buffer or only counted. Positions are relative to the
+ * start of the output. */
+struct _CINetWriter {
+    GString *str;                     /* Growable output or NULL. */
+    gchar *buf;                       /* Fixed output if @str is NULL. If this is NULL, too, only count. */
+    gsize size;                       /* Size of @buf. */
+    gsize base;                       /* Length of @str before writing. */
+    gsize len;                        /* Bytes written, or needed if @buf is too small. */
+    gchar last;                       /* Last character written. */
+    guint32 flags;                    /* Encoding of the message. [type: CINetMsgFlags] */
+};
+
+static void cinet_writer_init(CINetWriter *out, GString *str, gchar *buf, gsize size)
+{
+    out->str = str;
+    out->buf = str ? NULL : buf;
+    out->size = size;
+    out->base = str ? str->len : 0;
+    out->len = 0;
+    out->last = 0;
+    out->flags = 0;
+}
+
+static void cinet_writer_append_len(CINetWriter *out, const gchar *data, gsize len)
+{
+    if (len == 0)
+        return;
+    if (out->str)
+        g_string_append_len(out->str, data, len);
+    else if (out->buf && out->len + len <= out->size)
+        memcpy(&out->buf[out->len], data, len);
+    out->len += len;
+    out->last = data[len-1];
+}
+
+static inline void cinet_writer_append_c(CINetWriter *out, gchar c)
+{
+    if (out->str)
+        g_string_append_c(out->str, c);
+    else if (out->buf && out->len < out->size)
+        out->buf[out->len] = c;
+    ++out->len;
+    out->last = c;
+}
+
+static inline void cinet_writer_append(CINetWriter *out, const gchar *str)
+{
+    cinet_writer_append_len(out, str, strlen(str));
+}
+
+/* Insert data at @pos, which must be before the end of the output. */
+static void cinet_writer_insert_len(CINetWriter *out, gsize pos, const gchar *data, gsize len)
+{
+    if (out->str)
+        g_string_insert_len(out->str, out->base + pos, data, len);
+    else if (out->buf && out->len + len <= out->size) {
+        memmove(&out->buf[pos+len], &out->buf[pos], out->len - pos);
+        memcpy(&out->buf[pos], data, len);
+    }
+    out->len += len;
+}
+
+/* Get the data written at @pos to change it afterwards. Returns NULL if
+ * nothing is actually written. */
+static gchar *cinet_writer_get_data(CINetWriter *out, gsize pos)
+{
+    if (out->str)
+        return &out->str->str[out->base + pos];
+    if (out->buf && out->len <= out->size)
+        return &out->buf[pos];
+    return NULL;
+}
+
+/* Minimal JSON output. This produces the same bytes as json-glib’s
+ * JsonGenerator without building a JsonNode tree first. */
+static void cinet_json_add_unicode_escape(CINetWriter *out, gchar c)
+{
+    static const gchar hex[] = "0123456789abcdef";
+    gchar buf[6] = { '\\', 'u', '0', '0', hex[(c >> 4) & 0xf], hex[c & 0xf] };
+
+    cinet_writer_append_len(out, buf, 6);
+}
+
+static void cinet_json_add_string_len(CINetWriter *out, const gchar *str, gsize len)
+{
+    const gchar *p, *run;
+    const gchar *end = str + len;
+
+    cinet_writer_append_c(out, '"');
+    for (p = run = str; p < end; ++p) {
+        if ((*p > 0 && *p < 0x1f) || *p == 0x7f || *p == '"' || *p == '\\') {
+            cinet_writer_append_len(out, run, p - run);
+            run = p + 1;
+            switch (*p) {
+                case '"':  cinet_writer_append_len(out, "\\\"", 2); break;
+                case '\\': cinet_writer_append_len(out, "\\\\", 2); break;
+                case '\b': cinet_writer_append_len(out, "\\b", 2); break;
+                case '\f': cinet_writer_append_len(out, "\\f", 2); break;
+                case '\n': cinet_writer_append_len(out, "\\n", 2); break;
+                case '\r': cinet_writer_append_len(out, "\\r", 2); break;
+                case '\t': cinet_writer_append_len(out, "\\t", 2); break;
+                default:   cinet_json_add_unicode_escape(out, *p); break;
+            }
+        }
+    }
+    cinet_writer_append_len(out, run, p - run);
+    cinet_writer_append_c(out, '"');
+}
+
+static void cinet_json_add_int(CINetWriter *out, gint64 value)
+{
+    gchar buf[24];
+    gchar *p = &buf[sizeof(buf)];
+    guint64 v = value < 0 ? -(guint64)value : (guint64)value;
+
+    do {
+        *--p = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    if (value < 0)
+        *--p = '-';
+
+    cinet_writer_append_len(out, p, &buf[sizeof(buf)] - p);
+}
+
+/* Start a new member of the current object. A separator is only needed if
+ * this is not the first member. */
+static void cinet_json_add_member_name(CINetWriter *out, const gchar *name)
+{
+    if (out->last != '{')
+        cinet_writer_append_c(out, ',');
+    cinet_writer_append_c(out, '"');
+    cinet_writer_append(out, name);
+    cinet_writer_append_len(out, "\":", 2);
+}
+
+static void cinet_json_add_int_member(CINetWriter *out, const gchar *name, gint64 value)
+{
+    cinet_json_add_member_name(out, name);
+    cinet_json_add_int(out, value);
+}
+
+static void cinet_json_add_string_member(CINetWriter *out, const gchar *name, const gchar *value)
+{
+    cinet_json_add_member_name(out, name);
+    if (value)
+        cinet_json_add_string_len(out, value, strlen(value));
+    else
+        cinet_writer_append_len(out, "null", 4);
+}
+
+/* Resolve a member name without comparing it against every name. Names are
+ * told apart by their length and first character, and only the candidate is
+ * compared. */
+#define CINET_FIELD_MATCH(str, id) do {\
+    if (!memcmp(key, str, len))\
+        return id;\
+} while (0)
+
+static CINetMsgField cinet_msg_field_lookup_len(const gchar *key, gsize len)
+{
+    switch (len) {
+        case 2:
+            CINET_FIELD_MATCH("id", CI_NET_FIELD_ID);
+            break;
+        case 3:
+            CINET_FIELD_MATCH("msn", CI_NET_FIELD_MSN);
+            break;
+        case 4:
+            switch (key[0]) {
+                case 'a': CINET_FIELD_MATCH("area", CI_NET_FIELD_AREA); break;
+                case 'c': CINET_FIELD_MATCH("call", CI_NET_FIELD_CALL); break;
+                case 'd': CINET_FIELD_MATCH("date", CI_NET_FIELD_DATE); break;
+                case 'g': CINET_FIELD_MATCH("guid", CI_NET_FIELD_GUID); break;
+                case 'n': CINET_FIELD_MATCH("name", CI_NET_FIELD_NAME); break;
+                case 'p': CINET_FIELD_MATCH("part", CI_NET_FIELD_PART); break;
+                case 't': CINET_FIELD_MATCH("time", CI_NET_FIELD_TIME); break;
+                case 'u': CINET_FIELD_MATCH("user", CI_NET_FIELD_USER); break;
+            }
+            break;
+        case 5:
+            switch (key[0]) {
+                case 'a': CINET_FIELD_MATCH("alias", CI_NET_FIELD_ALIAS); break;
+                case 'c':
+                    CINET_FIELD_MATCH("count", CI_NET_FIELD_COUNT);
+                    CINET_FIELD_MATCH("calls", CI_NET_FIELD_CALLS);
+                    break;
+                case 'm':
+                    CINET_FIELD_MATCH("msgid", CI_NET_FIELD_MSGID);
+                    CINET_FIELD_MATCH("major", CI_NET_FIELD_MAJOR);
+                    CINET_FIELD_MATCH("minor", CI_NET_FIELD_MINOR);
+                    break;
+                case 'p': CINET_FIELD_MATCH("patch", CI_NET_FIELD_PATCH); break;
+                case 's': CINET_FIELD_MATCH("stage", CI_NET_FIELD_STAGE); break;
+            }
+            break;
+        case 6:
+            switch (key[0]) {
+                case 'c': CINET_FIELD_MATCH("caller", CI_NET_FIELD_CALLER); break;
+                case 'f': CINET_FIELD_MATCH("filter", CI_NET_FIELD_FILTER); break;
+                case 'n': CINET_FIELD_MATCH("number", CI_NET_FIELD_NUMBER); break;
+                case 'o': CINET_FIELD_MATCH("offset", CI_NET_FIELD_OFFSET); break;
+            }
+            break;
+        case 7:
+            CINET_FIELD_MATCH("callers", CI_NET_FIELD_CALLERS);
+            break;
+        case 8:
+            switch (key[0]) {
+                case 'a': CINET_FIELD_MATCH("areacode", CI_NET_FIELD_AREACODE); break;
+                case 'f': CINET_FIELD_MATCH("features", CI_NET_FIELD_FEATURES); break;
+            }
+            break;
+        case 14:
+            switch (key[0]) {
+                case 'c': CINET_FIELD_MATCH("completenumber", CI_NET_FIELD_COMPLETENUMBER); break;
+                case 'h': CINET_FIELD_MATCH("human_readable", CI_NET_FIELD_HUMAN_READABLE); break;
+            }
+            break;
+    }
+
+    return CI_NET_FIELD_UNKNOWN;
+}
+
+#undef CINET_FIELD_MATCH
+
+CINetMsgField cinet_msg_field_lookup(const gchar *key)
+{
+    if (key == NULL)
+        return CI_NET_FIELD_UNKNOWN;
+    return cinet_msg_field_lookup_len(key, strlen(key));
+}
+
+/* Minimal pull parser for JSON input. Values are read directly into the
+ * message structures without building a JsonNode tree. */
+struct _CINetJsonReader {
+    const gchar *pos;
+    const gchar *end;
+    CINetMsgField field;              /* The current member. */
+    GString *str;                     /* Unescaped value of the last string read. */
+    CINetArena *arena;                /* Arena for the message data or NULL. */
+    gboolean view;                    /* Unescape strings in place. */
+    gint depth;
+    gboolean error;
 };
 
-JsonNode *cinet_msg_default_build(CINetMsg *msg);
+#define CINET_JSON_MAX_DEPTH 64
+
+static void cinet_json_reader_init(CINetJsonReader *reader, const gchar *data, gsize len)
+{
+    memset(reader, 0, sizeof(CINetJsonReader));
+    reader->pos = data;
+    reader->end = data + len;
+}
+
+static void cinet_json_reader_clear(CINetJsonReader *reader)
+{
+    if (reader->str)
+        g_string_free(reader->str, TRUE);
+    reader->str = NULL;
+}
+
+static inline void cinet_json_skip_ws(CINetJsonReader *reader)
+{
+    while (reader->pos < reader->end &&
+           (*reader->pos == ' ' || *reader->pos == '\t' ||
+            *reader->pos == '\n' || *reader->pos == '\r'))
+        ++reader->pos;
+}
+
+/* Returns the next non-whitespace character without consuming it or 0 at the
+ * end of the input. */
+static inline gchar cinet_json_peek(CINetJsonReader *reader)
+{
+    cinet_json_skip_ws(reader);
+    return reader->pos < reader->end ? *reader->pos : 0;
+}
+
+static gboolean cinet_json_expect(CINetJsonReader *reader, gchar c)
+{
+    if (reader->error || cinet_json_peek(reader) != c) {
+        reader->error = TRUE;
+        return FALSE;
+    }
+    ++reader->pos;
+    return TRUE;
+}
+
+/* Only whitespace may follow the root value. */
+static gboolean cinet_json_reader_finish(CINetJsonReader *reader)
+{
+    cinet_json_skip_ws(reader);
+    return !reader->error && reader->pos == reader->end;
+}
+
+static gint cinet_json_hex_value(gchar c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static gboolean cinet_json_read_unichar(CINetJsonReader *reader, gunichar *c)
+{
+    gint i, v;
+
+    if (reader->end - reader->pos < 4)
+        return FALSE;
+    *c = 0;
+    for (i = 0; i < 4; ++i) {
+        if ((v = cinet_json_hex_value(reader->pos[i])) < 0)
+            return FALSE;
+        *c = (*c << 4) | v;
+    }
+    reader->pos += 4;
+    return TRUE;
+}
+
+/* Read a string token and append its unescaped content to @out. If @out is NULL
+ * the string is only skipped. */
+static gboolean cinet_json_scan_string(CINetJsonReader *reader, GString *out)
+{
+    const gchar *run;
+    gunichar c, low;
+    gchar esc;
+
+    if (!cinet_json_expect(reader, '"'))
+        return FALSE;
+
+    for (run = reader->pos; reader->pos < reader->end; ) {
+        if (*reader->pos == '"') {
+            if (out)
+                g_string_append_len(out, run, reader->pos - run);
+            ++reader->pos;
+            return TRUE;
+        }
+        if (*reader->pos != '\\') {
+            ++reader->pos;
+            continue;
+        }
+
+        if (out)
+            g_string_append_len(out, run, reader->pos - run);
+        if (++reader->pos >= reader->end)
+            break;
+        esc = *reader->pos++;
+        switch (esc) {
+            case '"':
+            case '\\':
+            case '/': c = esc; break;
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u':
+                if (!cinet_json_read_unichar(reader, &c))
+                    goto error;
+                /* Surrogate pair */
+                if (c >= 0xd800 && c < 0xdc00 && reader->end - reader->pos >= 6 &&
+                        reader->pos[0] == '\\' && reader->pos[1] == 'u') {
+                    reader->pos += 2;
+                    if (!cinet_json_read_unichar(reader, &low))
+                        goto error;
+                    if (low >= 0xdc00 && low < 0xe000) {
+                        c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+                    }
+                    else {
+                        if (out)
+                            g_string_append_unichar(out, c);
+                        c = low;
+                    }
+                }
+                break;
+            default:
+                goto error;
+        }
+        if (out)
+            g_string_append_unichar(out, c);
+        run = reader->pos;
+    }
+
+error:
+    reader->error = TRUE;
+    return FALSE;
+}
+
+static gboolean cinet_json_match_literal(CINetJsonReader *reader, const gchar *literal, gsize len)
+{
+    if ((gsize)(reader->end - reader->pos) < len || memcmp(reader->pos, literal, len)) {
+        reader->error = TRUE;
+        return FALSE;
+    }
+    reader->pos += len;
+    return TRUE;
+}
+
+/* Read a number token. Non-integer values are truncated like json-glib does. */
+static gint64 cinet_json_scan_number(CINetJsonReader *reader)
+{
+    gchar buf[64];
+    const gchar *start = reader->pos;
+    gboolean is_float = FALSE;
+    gsize len;
+
+    if (reader->pos < reader->end && *reader->pos == '-')
+        ++reader->pos;
+    while (reader->pos < reader->end) {
+        if (*reader->pos == '.' || *reader->pos == 'e' || *reader->pos == 'E' ||
+                *reader->pos == '+' || *reader->pos == '-')
+            is_float = TRUE;
+        else if (!g_ascii_isdigit(*reader->pos))
+            break;
+        ++reader->pos;
+    }
+
+    len = reader->pos - start;
+    if (len == 0 || len >= sizeof(buf) || !g_ascii_isdigit(start[len-1])) {
+        reader->error = TRUE;
+        return 0;
+    }
+    memcpy(buf, start, len);
+    buf[len] = 0;
+
+    if (is_float)
+        return (gint64)g_ascii_strtod(buf, NULL);
+    return g_ascii_strtoll(buf, NULL, 10);
+}
+
+static gboolean cinet_json_skip_value(CINetJsonReader *reader);
+
+/* Advance to the next member of an object and look up its name to @reader->field.
+ * Returns FALSE at the end of the object or on error. @count holds the number
+ * of members read so far. */
+static gboolean cinet_json_next_member(CINetJsonReader *reader, gint *count)
+{
+    GString *str;
+
+    if (reader->error)
+        return FALSE;
+    if (cinet_json_peek(reader) == '}') {
+        ++reader->pos;
+        return FALSE;
+    }
+    if ((*count)++ > 0 && !cinet_json_expect(reader, ','))
+        return FALSE;
+
+    if (!reader->str)
+        reader->str = g_string_sized_new(64);
+    str = reader->str;
+    g_string_truncate(str, 0);
+    if (!cinet_json_scan_string(reader, str))
+        return FALSE;
+    reader->field = cinet_msg_field_lookup_len(str->str, str->len);
+
+    return cinet_json_expect(reader, ':');
+}
+
+/* Advance to the next element of an array. Returns FALSE at the end of the array
+ * or on error. */
+static gboolean cinet_json_next_element(CINetJsonReader *reader, gint *count)
+{
+    if (reader->error)
+        return FALSE;
+    if (cinet_json_peek(reader) == ']') {
+        ++reader->pos;
+        --reader->depth;
+        return FALSE;
+    }
+    if ((*count)++ > 0 && !cinet_json_expect(reader, ','))
+        return FALSE;
+    return TRUE;
+}
+
+/* Enter an array. If the next value is not an array it is skipped and FALSE
+ * is returned. */
+static gboolean cinet_json_begin_array(CINetJsonReader *reader)
+{
+    if (cinet_json_peek(reader) != '[') {
+        cinet_json_skip_value(reader);
+        return FALSE;
+    }
+    if (++reader->depth > CINET_JSON_MAX_DEPTH) {
+        reader->error = TRUE;
+        return FALSE;
+    }
+    ++reader->pos;
+    return TRUE;
+}
+
+/* Read an object and pass each member to @func. Members not handled by @func
+ * are skipped. If the next value is not an object it is skipped. */
+static gboolean cinet_json_read_object(CINetJsonReader *reader, gpointer data, CINetJsonMemberFunc func)
+{
+    gint count = 0;
+
+    if (cinet_json_peek(reader) != '{') {
+        cinet_json_skip_value(reader);
+        return FALSE;
+    }
+    if (++reader->depth > CINET_JSON_MAX_DEPTH) {
+        reader->error = TRUE;
+        return FALSE;
+    }
+    ++reader->pos;
+
+    while (cinet_json_next_member(reader, &count)) {
+        if (!func(data, reader->field, reader))
+            cinet_json_skip_value(reader);
+    }
+    --reader->depth;
+
+    return !reader->error;
+}
+
+static gboolean cinet_json_skip_member(gpointer data, CINetMsgField field, CINetJsonReader *reader)
+{
+    return FALSE;
+}
+
+static gboolean cinet_json_skip_value(CINetJsonReader *reader)
+{
+    gint count = 0;
+
+    switch (cinet_json_peek(reader)) {
+        case '{':
+            cinet_json_read_object(reader, NULL, cinet_json_skip_member);
+            break;
+        case '[':
+            if (cinet_json_begin_array(reader))
+                while (cinet_json_next_element(reader, &count))
+                    cinet_json_skip_value(reader);
+            break;
+        case '"':
+            cinet_json_scan_string(reader, NULL);
+            break;
+        case 't':
+            cinet_json_match_literal(reader, "true", 4);
+            break;
+        case 'f':
+            cinet_json_match_literal(reader, "false", 5);
+            break;
+        case 'n':
+            cinet_json_match_literal(reader, "null", 4);
+            break;
+        default:
+            cinet_json_scan_number(reader);
+            break;
+    }
+
+    return !reader->error;
+}
+
+/* Read an integer value. Like json_object_get_int_member() booleans are
+ * converted and all other types result in 0. */
+static gint64 cinet_json_read_int(CINetJsonReader *reader)
+{
+    gchar c = cinet_json_peek(reader);
+
+    if (c == '-' || g_ascii_isdigit(c))
+        return cinet_json_scan_number(reader);
+    if (c == 't')
+        return cinet_json_match_literal(reader, "true", 4) ? 1 : 0;
+    cinet_json_skip_value(reader);
+    return 0;
+}
+
+/* Unescape the string at the current position into the buffer. The result
+ * never is longer than the quoted string, so the closing quote becomes the
+ * terminating null byte at the latest. */
+static const gchar *cinet_json_read_string_in_place(CINetJsonReader *reader)
+{
+    gchar *start = (gchar*)reader->pos + 1;
+    gsize len;
+
+    if (!cinet_json_scan_string(reader, NULL))
+        return NULL;
+    len = reader->pos - 1 - start;
+    if (memchr(start, '\\', len) == NULL) {
+        start[len] = '\0';
+        return start;
+    }
+
+    reader->pos = start - 1;
+    if (!reader->str)
+        reader->str = g_string_sized_new(64);
+    g_string_truncate(reader->str, 0);
+    if (!cinet_json_scan_string(reader, reader->str))
+        return NULL;
+    memcpy(start, reader->str->str, reader->str->len + 1);
+
+    return start;
+}
+
+/* Read a string value. Returns NULL for null and all non-string values. The
+ * result is valid until the next string or member name is read, or as long
+ * as the buffer for a view. */
+static const gchar *cinet_json_read_string(CINetJsonReader *reader)
+{
+    if (cinet_json_peek(reader) != '"') {
+        cinet_json_skip_value(reader);
+        return NULL;
+    }
+    if (reader->view)
+        return cinet_json_read_string_in_place(reader);
+
+    if (!reader->str)
+        reader->str = g_string_sized_new(64);
+    g_string_truncate(reader->str, 0);
+    if (!cinet_json_scan_string(reader, reader->str))
+        return NULL;
+
+    return reader->str->str;
+}
+
+/* Binary payload encoding. A payload is a sequence of fields. Each field starts
+ * with a varint tag holding the field number and the wire type, followed by
+ * either a varint or a varint length and that many bytes. */
+#define CINET_BIN_VARINT               0
+#define CINET_BIN_BYTES                2
+
+#define CINET_BIN_TAG(field, wire)     (((field) << 3) | (wire))
+
+/* Field numbers. The guid is field 1 in all messages, the remaining members
+ * follow in the order of the schema. */
+enum {
+    CINET_BIN_GUID = 1,
+
+    /* columnar lists */
+    CINET_BIN_COLUMNS_ROWS = 1,
+    CINET_BIN_COLUMNS_DICT,
+    CINET_BIN_COLUMNS_PRESENT,
+    CINET_BIN_COLUMNS_ID,
+    CINET_BIN_COLUMNS_DATA
+};
+
+static void cinet_bin_add_varint(CINetWriter *out, guint64 value)
+{
+    guchar buf[10];
+    gint n = 0;
+
+    while (value >= 0x80) {
+        buf[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    buf[n++] = value;
+
+    cinet_writer_append_len(out, (gchar*)buf, n);
+}
+
+static void cinet_bin_add_uint_field(CINetWriter *out, guint field, guint64 value)
+{
+    if (value == 0)
+        return;
+    cinet_bin_add_varint(out, CINET_BIN_TAG(field, CINET_BIN_VARINT));
+    cinet_bin_add_varint(out, value);
+}
+
+/* Signed values are zigzag encoded so that small negative numbers stay short. */
+static void cinet_bin_add_int_field(CINetWriter *out, guint field, gint64 value)
+{
+    cinet_bin_add_uint_field(out, field, ((guint64)value << 1) ^ (guint64)(value >> 63));
+}
+
+static void cinet_bin_add_string_field_len(CINetWriter *out, guint field, const gchar *value, gsize len)
+{
+    cinet_bin_add_varint(out, CINET_BIN_TAG(field, CINET_BIN_BYTES));
+    cinet_bin_add_varint(out, len);
+    cinet_writer_append_len(out, value, len);
+}
+
+static void cinet_bin_add_string_field(CINetWriter *out, guint field, const gchar *value)
+{
+    if (value)
+        cinet_bin_add_string_field_len(out, field, value, strlen(value));
+}
+
+/* Start a nested record. Two bytes are reserved for its length which suffices
+ * for records up to 16 KiB. Returns the position of the length. */
+static gsize cinet_bin_begin_record(CINetWriter *out, guint field)
+{
+    gsize pos;
+
+    cinet_bin_add_varint(out, CINET_BIN_TAG(field, CINET_BIN_BYTES));
+    pos = out->len;
+    cinet_writer_append_len(out, "\0\0", 2);
+
+    return pos;
+}
+
+static void cinet_bin_end_record(CINetWriter *out, gsize pos)
+{
+    guchar buf[10];
+    gsize len = out->len - pos - 2;
+    gchar *data;
+    gint n = 0;
+
+    if (len < (1 << 14)) {
+        /* A two byte varint, padded if the length would fit in one byte. */
+        if ((data = cinet_writer_get_data(out, pos)) != NULL) {
+            data[0] = (len & 0x7f) | 0x80;
+            data[1] = len >> 7;
+        }
+        return;
+    }
+
+    while (len >= 0x80) {
+        buf[n++] = (len & 0x7f) | 0x80;
+        len >>= 7;
+    }
+    buf[n++] = len;
+    cinet_writer_insert_len(out, pos, (gchar*)buf, n - 2);
+    if ((data = cinet_writer_get_data(out, pos)) != NULL)
+        memcpy(data, buf, n);
+}
+
+struct _CINetBinReader {
+    const guchar *pos;
+    const guchar *end;
+    guint wire;                       /* Wire type of the current field. */
+    GString *str;                     /* Copy of the last string read. */
+    CINetArena *arena;                /* Arena for the message data or NULL. */
+    gboolean view;                    /* Terminate strings in place. */
+    gboolean error;
+};
+
+static void cinet_bin_reader_init(CINetBinReader *reader, const gchar *data, gsize len)
+{
+    memset(reader, 0, sizeof(CINetBinReader));
+    reader->pos = (const guchar*)data;
+    reader->end = (const guchar*)data + len;
+}
+
+static void cinet_bin_reader_clear(CINetBinReader *reader)
+{
+    if (reader->str)
+        g_string_free(reader->str, TRUE);
+    reader->str = NULL;
+}
+
+static guint64 cinet_bin_read_varint(CINetBinReader *reader)
+{
+    guint64 value = 0;
+    guint shift;
+
+    for (shift = 0; shift < 64 && reader->pos < reader->end; shift += 7) {
+        value |= (guint64)(*reader->pos & 0x7f) << shift;
+        if (!(*reader->pos++ & 0x80))
+            return value;
+    }
+
+    reader->error = TRUE;
+    return 0;
+}
+
+/* Read the tag of the next field. Returns FALSE at the end of the record or on
+ * error. */
+static gboolean cinet_bin_next_field(CINetBinReader *reader, guint *field)
+{
+    guint64 tag;
+
+    if (reader->error || reader->pos >= reader->end)
+        return FALSE;
+
+    tag = cinet_bin_read_varint(reader);
+    *field = tag >> 3;
+    reader->wire = tag & 7;
+
+    return !reader->error;
+}
+
+/* Get the content of a length-delimited field. */
+static const gchar *cinet_bin_read_bytes(CINetBinReader *reader, gsize *len)
+{
+    const gchar *data;
+    guint64 n;
+
+    n = cinet_bin_read_varint(reader);
+    if (reader->error || n > (guint64)(reader->end - reader->pos)) {
+        reader->error = TRUE;
+        return NULL;
+    }
+
+    data = (const gchar*)reader->pos;
+    reader->pos += n;
+    *len = n;
+
+    return data;
+}
+
+static void cinet_bin_skip_field(CINetBinReader *reader)
+{
+    gsize len;
+
+    switch (reader->wire) {
+        case CINET_BIN_VARINT:
+            cinet_bin_read_varint(reader);
+            break;
+        case CINET_BIN_BYTES:
+            cinet_bin_read_bytes(reader, &len);
+            break;
+        default:
+            reader->error = TRUE;
+            break;
+    }
+}
+
+static guint64 cinet_bin_read_uint(CINetBinReader *reader)
+{
+    if (reader->wire != CINET_BIN_VARINT) {
+        cinet_bin_skip_field(reader);
+        return 0;
+    }
+    return cinet_bin_read_varint(reader);
+}
+
+static gint64 cinet_bin_read_int(CINetBinReader *reader)
+{
+    guint64 value = cinet_bin_read_uint(reader);
+    return (gint64)(value >> 1) ^ -(gint64)(value & 1);
+}
+
+/* Terminate @len bytes of string data at @data in place. The data is moved
+ * back by one byte over the last byte of its length, which has been read. */
+static gchar *cinet_bin_terminate(const gchar *data, gsize len)
+{
+    gchar *str = (gchar*)data - 1;
+
+    memmove(str, data, len);
+    str[len] = '\0';
+
+    return str;
+}
+
+/* Read a string field. The result is valid until the next string is read, or
+ * as long as the buffer for a view. */
+static const gchar *cinet_bin_read_string(CINetBinReader *reader)
+{
+    const gchar *data;
+    gsize len;
+
+    if (reader->wire != CINET_BIN_BYTES) {
+        cinet_bin_skip_field(reader);
+        return NULL;
+    }
+    if ((data = cinet_bin_read_bytes(reader, &len)) == NULL)
+        return NULL;
+    if (reader->view)
+        return cinet_bin_terminate(data, len);
+
+    if (!reader->str)
+        reader->str = g_string_sized_new(64);
+    g_string_truncate(reader->str, 0);
+    g_string_append_len(reader->str, data, len);
+
+    return reader->str->str;
+}
+
+/* Read all fields of the record and pass them to @func. Fields not handled by
+ * @func are skipped. */
+static gboolean cinet_bin_read_fields(CINetBinReader *reader, gpointer data, CINetBinFieldFunc func)
+{
+    guint field;
+
+    while (cinet_bin_next_field(reader, &field)) {
+        if (!func(data, field, reader))
+            cinet_bin_skip_field(reader);
+    }
+
+    return !reader->error;
+}
+
+/* Read a nested record at the current field. */
+static gboolean cinet_bin_read_record(CINetBinReader *reader, gpointer data, CINetBinFieldFunc func)
+{
+    CINetBinReader sub;
+    const gchar *content;
+    gsize len;
+
+    if (reader->wire != CINET_BIN_BYTES) {
+        cinet_bin_skip_field(reader);
+        return FALSE;
+    }
+    if ((content = cinet_bin_read_bytes(reader, &len)) == NULL)
+        return FALSE;
+
+    cinet_bin_reader_init(&sub, content, len);
+    sub.str = reader->str;
+    sub.arena = reader->arena;
+    sub.view = reader->view;
+    cinet_bin_read_fields(&sub, data, func);
+
+    reader->str = sub.str;
+    if (sub.error)
+        reader->error = TRUE;
+
+    return !reader->error;
+}
+
+/* Allocate a list entry, from @arena if given. */
+static gpointer cinet_schema_alloc(const CINetSchema *schema, CINetArena *arena)
+{
+    if (arena == NULL)
+        return g_malloc0(schema->size);
+    return cinet_arena_alloc0(arena, schema->size);
+}
+
+/* Columnar encoding of lists. Each string member of the entries is sent as
+ * one column holding only the values present in a row. Values occurring more
+ * than once are sent once in a dictionary and referenced by index. */
+#define CINET_BIN_MAX_COLUMNS 9
+
+/* Get the columns of the entries described by @schema. These are the
+ * strings in the order of the schema, which matches the bits in
+ * @CINetMsgCallFields. The first integer is sent as id. Returns the number
+ * of columns. */
+static guint cinet_bin_get_columns(const CINetSchema *schema, const CINetSchemaField **columns,
+                                   const CINetSchemaField **id)
+{
+    guint i, n = 0;
+
+    *id = NULL;
+    for (i = 0; i < schema->n_fields; ++i) {
+        if (schema->fields[i].kind == CINET_KIND_STRING && n < CINET_BIN_MAX_COLUMNS)
+            columns[n++] = &schema->fields[i];
+        else if (schema->fields[i].kind == CINET_KIND_INT && *id == NULL)
+            *id = &schema->fields[i];
+    }
+
+    return n;
+}
+
+#define CINET_BIN_COLUMN(row, columns, i) CINET_FIELD_STRING((row), (columns)[(i)])
+
+static void cinet_bin_add_columns(CINetWriter *out, guint field, GList *rows, const CINetSchema *schema)
+{
+    const CINetSchemaField *columns[CINET_BIN_MAX_COLUMNS], *idfield;
+    guint ncolumns = cinet_bin_get_columns(schema, columns, &idfield);
+    GHashTable *counts = g_hash_table_new(g_str_hash, g_str_equal);
+    GHashTable *dict = g_hash_table_new(g_str_hash, g_str_equal);
+    GList *tmp;
+    gchar *str;
+    gpointer index;
+    gsize record, pos;
+    guint i, mask, nrows = 0;
+    gint32 id, last = 0;
+
+    for (tmp = rows; tmp != NULL; tmp = g_list_next(tmp), ++nrows) {
+        for (i = 0; i < ncolumns; ++i) {
+            if ((str = CINET_BIN_COLUMN(tmp->data, columns, i)) != NULL)
+                g_hash_table_insert(counts, str,
+                        GUINT_TO_POINTER(GPOINTER_TO_UINT(g_hash_table_lookup(counts, str)) + 1));
+        }
+    }
+
+    record = cinet_bin_begin_record(out, field);
+    cinet_bin_add_uint_field(out, CINET_BIN_COLUMNS_ROWS, nrows);
+
+    /* Indices are stored plus one so that they can be told from NULL. */
+    for (i = 0; i < ncolumns; ++i) {
+        for (tmp = rows; tmp != NULL; tmp = g_list_next(tmp)) {
+            str = CINET_BIN_COLUMN(tmp->data, columns, i);
+            if (str == NULL || str[0] == '\0' || str[1] == '\0' ||
+                    GPOINTER_TO_UINT(g_hash_table_lookup(counts, str)) < 2 ||
+                    g_hash_table_contains(dict, str))
+                continue;
+            g_hash_table_insert(dict, str, GUINT_TO_POINTER(g_hash_table_size(dict) + 1));
+            cinet_bin_add_string_field(out, CINET_BIN_COLUMNS_DICT, str);
+        }
+    }
+
+    pos = cinet_bin_begin_record(out, CINET_BIN_COLUMNS_PRESENT);
+    for (tmp = rows; tmp != NULL; tmp = g_list_next(tmp)) {
+        mask = 0;
+        for (i = 0; i < ncolumns; ++i) {
+            if (CINET_BIN_COLUMN(tmp->data, columns, i) != NULL)
+                mask |= 1 << i;
+        }
+        cinet_bin_add_varint(out, mask);
+    }
+    cinet_bin_end_record(out, pos);
+
+    /* Ids are usually consecutive, so only the difference is sent. */
+    if (idfield != NULL) {
+        pos = cinet_bin_begin_record(out, CINET_BIN_COLUMNS_ID);
+        for (tmp = rows; tmp != NULL; tmp = g_list_next(tmp)) {
+            id = CINET_FIELD_INT(tmp->data, idfield);
+            cinet_bin_add_varint(out, (((guint64)((gint64)id - last)) << 1) ^ (guint64)(((gint64)id - last) >> 63));
+            last = id;
+        }
+        cinet_bin_end_record(out, pos);
+    }
+
+    for (i = 0; i < ncolumns; ++i) {
+        pos = cinet_bin_begin_record(out, CINET_BIN_COLUMNS_DATA + i);
+        for (tmp = rows; tmp != NULL; tmp = g_list_next(tmp)) {
+            if ((str = CINET_BIN_COLUMN(tmp->data, columns, i)) == NULL)
+                continue;
+            if ((index = g_hash_table_lookup(dict, str)) != NULL)
+                cinet_bin_add_varint(out, ((guint64)(GPOINTER_TO_UINT(index) - 1) << 1) | 1);
+            else {
+                cinet_bin_add_varint(out, (guint64)strlen(str) << 1);
+                cinet_writer_append_len(out, str, strlen(str));
+            }
+        }
+        cinet_bin_end_record(out, pos);
+    }
+
+    cinet_bin_end_record(out, record);
+
+    g_hash_table_destroy(dict);
+    g_hash_table_destroy(counts);
+}
+
+typedef struct {
+    const gchar *data;
+    gsize len;
+} CINetBinSlice;
+
+typedef struct {
+    guint64 rows;
+    GArray *dict;                     /* [element-type: CINetBinSlice] */
+    CINetBinSlice present;
+    CINetBinSlice id;
+    CINetBinSlice columns[CINET_BIN_MAX_COLUMNS];
+} CINetBinColumnData;
+
+static gboolean cinet_bin_read_column_field(CINetBinColumnData *data, guint field, CINetBinReader *reader)
+{
+    CINetBinSlice slice;
+    CINetBinSlice *target;
+
+    if (field == CINET_BIN_COLUMNS_ROWS) {
+        data->rows = cinet_bin_read_uint(reader);
+        return TRUE;
+    }
+    if (field == CINET_BIN_COLUMNS_DICT)
+        target = &slice;
+    else if (field == CINET_BIN_COLUMNS_PRESENT)
+        target = &data->present;
+    else if (field == CINET_BIN_COLUMNS_ID)
+        target = &data->id;
+    else if (field >= CINET_BIN_COLUMNS_DATA && field < CINET_BIN_COLUMNS_DATA + CINET_BIN_MAX_COLUMNS)
+        target = &data->columns[field - CINET_BIN_COLUMNS_DATA];
+    else
+        return FALSE;
+
+    if (reader->wire != CINET_BIN_BYTES)
+        return FALSE;
+    if ((target->data = cinet_bin_read_bytes(reader, &target->len)) == NULL)
+        return TRUE;
+
+    if (field == CINET_BIN_COLUMNS_DICT)
+        g_array_append_val(data->dict, slice);
+
+    return TRUE;
+}
+
+/* Read a string value from a column. Dictionary entries are shared if the
+ * strings go to an arena. */
+static gchar *cinet_bin_read_column_value(CINetBinReader *column, CINetBinColumnData *data,
+                                          gchar **shared, CINetArena *arena)
+{
+    CINetBinSlice *slice;
+    guint64 value = cinet_bin_read_varint(column);
+    gsize len;
+    const gchar *str;
+    gchar *result;
+
+    if (column->error)
+        return NULL;
+
+    if (value & 1) {
+        if ((value >> 1) >= data->dict->len) {
+            column->error = TRUE;
+            return NULL;
+        }
+        if (arena && shared[value >> 1])
+            return shared[value >> 1];
+        slice = &g_array_index(data->dict, CINetBinSlice, value >> 1);
+        str = slice->data;
+        len = slice->len;
+    }
+    else {
+        len = value >> 1;
+        if (len > (gsize)(column->end - column->pos)) {
+            column->error = TRUE;
+            return NULL;
+        }
+        str = (const gchar*)column->pos;
+        column->pos += len;
+        if (column->view)
+            return cinet_bin_terminate(str, len);
+    }
+
+    if (arena) {
+        result = memcpy(cinet_arena_alloc_aligned(arena, len + 1, FALSE), str, len);
+        result[len] = '\0';
+        if (value & 1)
+            shared[value >> 1] = result;
+        return result;
+    }
+
+    return g_strndup(str, len);
+}
+
+/* Read a columnar list and prepend its entries to @list in reverse order,
+ * like entries sent one by one. */
+static gboolean cinet_bin_read_columns(CINetBinReader *reader, GList **list, const CINetSchema *schema)
+{
+    const CINetSchemaField *fields[CINET_BIN_MAX_COLUMNS], *idfield;
+    guint ncolumns = cinet_bin_get_columns(schema, fields, &idfield);
+    CINetBinColumnData data;
+    CINetBinReader present, id, columns[CINET_BIN_MAX_COLUMNS];
+    gchar **shared = NULL;
+    gpointer row;
+    guint64 mask, n;
+    gint64 delta, last = 0;
+    gboolean ok;
+    guint i;
+
+    memset(&data, 0, sizeof(data));
+    data.dict = g_array_new(FALSE, FALSE, sizeof(CINetBinSlice));
+
+    ok = cinet_bin_read_record(reader, &data, (CINetBinFieldFunc)cinet_bin_read_column_field);
+
+    cinet_bin_reader_init(&present, data.present.data, data.present.len);
+    cinet_bin_reader_init(&id, data.id.data, data.id.len);
+    for (i = 0; i < ncolumns; ++i) {
+        cinet_bin_reader_init(&columns[i], data.columns[i].data, data.columns[i].len);
+        columns[i].view = reader->view;
+    }
+    if (reader->arena && data.dict->len)
+        shared = g_new0(gchar*, data.dict->len);
+    for (i = 0; ok && reader->view && i < data.dict->len; ++i)
+        shared[i] = cinet_bin_terminate(g_array_index(data.dict, CINetBinSlice, i).data,
+                                        g_array_index(data.dict, CINetBinSlice, i).len);
+
+    /* The number of rows is only trusted as far as there is data for them. */
+    for (n = 0; ok && n < data.rows && present.pos < present.end; ++n) {
+        mask = cinet_bin_read_varint(&present);
+        if (present.error || (mask >> ncolumns)) {
+            ok = FALSE;
+            break;
+        }
+
+        row = cinet_schema_alloc(schema, reader->arena);
+        *list = cinet_list_prepend(*list, row, reader->arena);
+
+        if (idfield != NULL && id.pos < id.end) {
+            delta = cinet_bin_read_varint(&id);
+            delta = (gint64)((guint64)delta >> 1) ^ -(gint64)(delta & 1);
+            last += delta;
+            CINET_FIELD_INT(row, idfield) = (gint32)last;
+        }
+        for (i = 0; i < ncolumns; ++i) {
+            if (!(mask & (1 << i)))
+                continue;
+            CINET_BIN_COLUMN(row, fields, i) = cinet_bin_read_column_value(&columns[i], &data, shared, reader->arena);
+            if (schema->fields_offset >= 0)
+                G_STRUCT_MEMBER(guint32, row, schema->fields_offset) |= fields[i]->flag;
+            if (columns[i].error) {
+                ok = FALSE;
+                break;
+            }
+        }
+    }
+
+    g_free(shared);
+    g_array_free(data.dict, TRUE);
+
+    if (!ok || id.error)
+        reader->error = TRUE;
+
+    return !reader->error;
+}
+
+gssize cinet_msg_write_header(gchar *data, gsize len, CINetMsgHeader *header)
+{
+    return cinet_msg_write_header_full(data, len, header, 0);
+}
+
+gssize cinet_msg_write_header_full(gchar *data, gsize len, CINetMsgHeader *header, guint32 flags)
+{
+    if (!data || len < CINET_HEADER_LENGTH || !header)
+        return -1;
+    /* magic string */
+    strcpy(data, "ci-msg");
+    /* msg length */
+    CINET_HEADER_SET_LEN(data, header->msglen);
+    CINET_HEADER_SET_TYPE(data, (header->msgtype & 0xffff) | ((flags & 0xffff) << 16));
+
+    return CINET_HEADER_LENGTH;
+}
+
+gssize cinet_msg_read_header(CINetMsgHeader *header, gchar *data, gsize len)
+{
+    if (len < CINET_HEADER_LENGTH || !header || !data)
+        return -1;
+
+    if (!CINET_CHECK_MAGIC_STRING(data))
+        return -1;
+    header->msglen = CINET_HEADER_GET_LEN(data);
+    header->msgtype = CINET_HEADER_GET_TYPE(data) & 0xffff;
+    header->flags = (guint32)CINET_HEADER_GET_TYPE(data) >> 16;
+
+    return CINET_HEADER_LENGTH;
+}
+
+gint cinet_msg_build(CINetMsg *msg, CINetWriter *out)
+{
+    struct CINetMsgClass *cls = cinet_msg_get_class(msg);
+    if (!cls)
+        return -1;
+    if (!cls->schema) {
+        cinet_writer_append_len(out, "{}", 2);
+        return 0;
+    }
+
+    cinet_writer_append_c(out, '{');
+    cinet_json_add_int_member(out, "guid", msg->guid);
+    cinet_schema_build(cls->schema, msg, out);
+    cinet_writer_append_c(out, '}');
+    return 0;
+}
+
+gint cinet_msg_build_binary(CINetMsg *msg, CINetWriter *out)
+{
+    struct CINetMsgClass *cls = cinet_msg_get_class(msg);
+    if (!cls)
+        return -1;
+    cinet_bin_add_uint_field(out, CINET_BIN_GUID, msg->guid);
+    if (cls->schema)
+        cinet_schema_build_binary(cls->schema, msg, out, CINET_BIN_GUID + 1);
+    return 0;
+}
+
+/* CRC32C (Castagnoli) of frames with @CI_NET_MSG_FLAG_CHECKSUM. Uses the
+ * crc32 instruction of SSE4.2 if the CPU has it, a table otherwise. */
+#define CINET_CRC32C_POLY 0x82f63b78
+
+typedef guint32 (*CINetCrc32cFunc)(guint32 crc, const guchar *data, gsize len);
+
+static guint32 crc32c_table[256];
+
+static guint32 cinet_crc32c_table_update(guint32 crc, const guchar *data, gsize len)
+{
+    while (len-- > 0)
+        crc = crc32c_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if CINET_HAVE_SSE42
+__attribute__((target("sse4.2")))
+static guint32 cinet_crc32c_sse42_update(guint32 crc, const guchar *data, gsize len)
+{
+#if defined(__x86_64__)
+    guint64 crc64 = crc;
+    guint64 word;
+
+    for (; len >= 8; data += 8, len -= 8) {
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (guint32)crc64;
+#else
+    guint32 word;
+
+    for (; len >= 4; data += 4, len -= 4) {
+        memcpy(&word, data, 4);
+        crc = _mm_crc32_u32(crc, word);
+    }
+#endif
+    while (len-- > 0)
+        crc = _mm_crc32_u8(crc, *data++);
+    return crc;
+}
+#endif
+
+static CINetCrc32cFunc cinet_crc32c_get_func(void)
+{
+    static gsize func = 0;
+    guint32 crc;
+    guint i, k;
+
+    if (g_once_init_enter(&func)) {
+        for (i = 0; i < 256; ++i) {
+            crc = i;
+            for (k = 0; k < 8; ++k)
+                crc = (crc >> 1) ^ (crc & 1 ? CINET_CRC32C_POLY : 0);
+            crc32c_table[i] = crc;
+        }
+#if CINET_HAVE_SSE42
+        if (__builtin_cpu_supports("sse4.2"))
+            g_once_init_leave(&func, (gsize)cinet_crc32c_sse42_update);
+        else
+#endif
+            g_once_init_leave(&func, (gsize)cinet_crc32c_table_update);
+    }
+
+    return (CINetCrc32cFunc)func;
+}
+
+/* Continue the CRC32C @crc with @len bytes of @data. Start with 0. */
+static guint32 cinet_crc32c(guint32 crc, gconstpointer data, gsize len)
+{
+    return ~cinet_crc32c_get_func()(~crc, data, len);
+}
+
+/* Check the checksum of a frame. @len is the size of the whole frame. */
+static gboolean cinet_msg_check_frame(const gchar *frame, gsize len)
+{
+    if (len < CINET_HEADER_LENGTH + CINET_CHECKSUM_LENGTH)
+        return FALSE;
+    len -= CINET_CHECKSUM_LENGTH;
+    return cinet_crc32c(0, frame, len) == cinet_get_ulong(frame, len);
+}
+
+/* State reused from frame to frame. The zlib streams are only reset for each
+ * frame, scratch buffers keep their memory. Each thread has a default codec
+ * used by the functions without an explicit one. */
+struct _CINetCodec {
+    GConverter *compressor;
+    GConverter *decompressor;
+    GString *plain;                   /* Payload before compressing. */
+    GString *deflated;                /* Compressed payload. */
+    GString *inflated;                /* Payload after inflating. */
+    GString *str;                     /* Strings unescaped or copied by the readers. */
+    CINetCodecStats stats;
+};
+
+/* Inflated payloads are limited like frames in @CINetMsgReader. */
+#define CINET_INFLATE_MAX_SIZE (16 * 1024 * 1024)
+/* Larger buffers are not kept for the next frame. */
+#define CINET_CODEC_KEEP_SIZE  (256 * 1024)
+
+static GPrivate default_codec = G_PRIVATE_INIT((GDestroyNotify)cinet_codec_free);
+static gint compress_threshold = CINET_COMPRESS_DEFAULT_THRESHOLD;
+
+CINetCodec *cinet_codec_new(void)
+{
+    CINetCodec *codec = g_malloc0(sizeof(CINetCodec));
+
+    codec->plain = g_string_sized_new(4096);
+    codec->deflated = g_string_sized_new(4096);
+    codec->inflated = g_string_sized_new(4096);
+    codec->str = g_string_sized_new(64);
+
+    return codec;
+}
+
+void cinet_codec_free(CINetCodec *codec)
+{
+    if (!codec)
+        return;
+
+    if (codec->compressor)
+        g_object_unref(codec->compressor);
+    if (codec->decompressor)
+        g_object_unref(codec->decompressor);
+    g_string_free(codec->plain, TRUE);
+    g_string_free(codec->deflated, TRUE);
+    g_string_free(codec->inflated, TRUE);
+    if (codec->str)
+        g_string_free(codec->str, TRUE);
+    g_free(codec);
+}
+
+CINetCodec *cinet_codec_get_default(void)
+{
+    CINetCodec *codec = g_private_get(&default_codec);
+
+    if (G_UNLIKELY(codec == NULL)) {
+        codec = cinet_codec_new();
+        g_private_set(&default_codec, codec);
+    }
+
+    return codec;
+}
+
+void cinet_codec_get_stats(CINetCodec *codec, CINetCodecStats *stats)
+{
+    if (!stats)
+        return;
+
+    if (!codec)
+        codec = cinet_codec_get_default();
+    *stats = codec->stats;
+}
+
+void cinet_codec_reset_stats(CINetCodec *codec)
+{
+    if (!codec)
+        codec = cinet_codec_get_default();
+    memset(&codec->stats, 0, sizeof(CINetCodecStats));
+}
+
+/* Empty @str and drop its memory if it grew too large. */
+static void cinet_codec_release_buffer(GString *str)
+{
+    g_string_truncate(str, 0);
+    if (str->allocated_len > CINET_CODEC_KEEP_SIZE) {
+        g_free(str->str);
+        str->allocated_len = 4096;
+        str->str = g_malloc(str->allocated_len);
+        str->str[0] = 0;
+    }
+}
+
+/* Run @data through @converter, replacing the contents of @out. Fails if the
+ * output would exceed @max bytes or the data is broken.
+ *
+ * @converter: A GZlibCompressor or GZlibDecompressor.
+ * @data:      The input.
+ * @len:       Number of bytes in @data.
+ * @out:       Buffer for the output.
+ * @max:       Maximum size of the output.
+ *
+ * @return:    TRUE on success, FALSE otherwise.
+ */
+static gboolean cinet_zlib_convert(GConverter *converter, const gchar *data, gsize len,
+                                   GString *out, gsize max)
+{
+    GConverterResult res;
+    GError *error = NULL;
+    gsize space, nread, nwritten;
+    gsize pos = 0;
+
+    g_converter_reset(converter);
+
+    space = MAX(len, 1024);
+    do {
+        space = MIN(space, max - pos);
+        g_string_set_size(out, pos + space);
+        res = g_converter_convert(converter, data, len, &out->str[pos], space,
+                                  G_CONVERTER_INPUT_AT_END, &nread, &nwritten, &error);
+        if (res == G_CONVERTER_ERROR) {
+            if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NO_SPACE) || pos + space >= max) {
+                g_error_free(error);
+                g_string_truncate(out, 0);
+                return FALSE;
+            }
+            g_clear_error(&error);
+            space *= 2;
+            continue;
+        }
+        data += nread;
+        len -= nread;
+        pos += nwritten;
+        if (pos >= max && res != G_CONVERTER_FINISHED) {
+            g_string_truncate(out, 0);
+            return FALSE;
+        }
+    } while (res != G_CONVERTER_FINISHED);
+
+    g_string_truncate(out, pos);
+    return TRUE;
+}
+
+void cinet_msg_set_compress_threshold(gsize threshold)
+{
+    g_atomic_int_set(&compress_threshold, (gint)MIN(threshold, G_MAXINT));
+}
+
+/* Build the payload of @msg as given by @flags. With compression the payload
+ * is built separately first and only compressed if it is large enough.
+ * @flags is updated to the encoding actually used.
+ *
+ * @codec:  The codec providing the zlib stream and buffers.
+ * @msg:    The message.
+ * @out:    The output for the payload.
+ * @flags:  Requested encoding of the payload, returns the actual encoding.
+ *
+ * @return: 0 on success, -1 otherwise.
+ */
+static gint cinet_msg_build_payload(CINetCodec *codec, CINetMsg *msg, CINetWriter *out, guint32 *flags)
+{
+    CINetWriter plain;
+    gint rc;
+
+    /* Columns are part of the binary encoding. */
+    if (!(*flags & CI_NET_MSG_FLAG_BINARY))
+        *flags &= ~CI_NET_MSG_FLAG_COLUMNS;
+
+    if (!(*flags & CI_NET_MSG_FLAG_COMPRESSED)) {
+        out->flags = *flags;
+        if (*flags & CI_NET_MSG_FLAG_BINARY)
+            return cinet_msg_build_binary(msg, out);
+        return cinet_msg_build(msg, out);
+    }
+
+    *flags &= ~CI_NET_MSG_FLAG_COMPRESSED;
+
+    cinet_writer_init(&plain, codec->plain, NULL, 0);
+    plain.flags = *flags;
+    if (*flags & CI_NET_MSG_FLAG_BINARY)
+        rc = cinet_msg_build_binary(msg, &plain);
+    else
+        rc = cinet_msg_build(msg, &plain);
+
+    if (rc == 0) {
+        if (codec->compressor == NULL)
+            codec->compressor = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB, -1));
+        /* Only keep the compressed data if it is actually smaller. */
+        if (plain.len > 0 && plain.len >= (gsize)g_atomic_int_get(&compress_threshold) &&
+                cinet_zlib_convert(codec->compressor, codec->plain->str, plain.len,
+                                   codec->deflated, plain.len - 1)) {
+            *flags |= CI_NET_MSG_FLAG_COMPRESSED;
+            codec->stats.compressed++;
+            cinet_writer_append_len(out, codec->deflated->str, codec->deflated->len);
+        }
+        else
+            cinet_writer_append_len(out, codec->plain->str, plain.len);
+    }
+
+    cinet_codec_release_buffer(codec->plain);
+    cinet_codec_release_buffer(codec->deflated);
+
+    return rc;
+}
+
+/* Inflate a compressed payload. The data stays valid until
+ * @cinet_msg_inflate_done() is called.
+ *
+ * @codec:  The codec providing the zlib stream and buffer.
+ * @data:   The compressed payload.
+ * @len:    Size of the compressed payload, returns the size of the result.
+ *
+ * @return: The inflated payload or NULL if it is broken or too large.
+ */
+static gchar *cinet_msg_inflate_payload(CINetCodec *codec, const gchar *data, gsize *len)
+{
+    if (codec->decompressor == NULL)
+        codec->decompressor = G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB));
+
+    if (!cinet_zlib_convert(codec->decompressor, data, *len, codec->inflated, CINET_INFLATE_MAX_SIZE))
+        return NULL;
+
+    codec->stats.compressed++;
+    *len = codec->inflated->len;
+    return codec->inflated->str;
+}
+
+static void cinet_msg_inflate_done(CINetCodec *codec)
+{
+    cinet_codec_release_buffer(codec->inflated);
+}
+
+/* Write header and payload of @msg to @out. Only frames actually written
+ * are counted in the stats of @codec, not those just measured. */
+static gint cinet_msg_encode(CINetCodec *codec, CINetWriter *out, CINetMsg *msg, guint32 flags)
+{
+    static const gchar empty_header[CINET_HEADER_LENGTH] = { 0 };
+    CINetMsgHeader header;
+    gsize start = out->len;
+    gsize checksum = 0;
+    gchar *data;
+    gint rc;
+
+    if (!msg || (flags & ~CINET_MSG_FLAGS_SUPPORTED)) {
+        codec->stats.errors++;
+        return -1;
+    }
+
+    /* Reserve space for the header. The payload is written right behind it
+     * and the length is filled in once it is known. */
+    cinet_writer_append_len(out, empty_header, CINET_HEADER_LENGTH);
+
+    rc = cinet_msg_build_payload(codec, msg, out, &flags);
+
+    /* The checksum covers the header, so it is filled in last. */
+    if (rc == 0 && (flags & CI_NET_MSG_FLAG_CHECKSUM)) {
+        checksum = out->len - start;
+        cinet_writer_append_len(out, empty_header, CINET_CHECKSUM_LENGTH);
+    }
+
+    if (rc != 0 || out->len - start - CINET_HEADER_LENGTH > G_MAXUINT32) {
+        codec->stats.errors++;
+        return -1;
+    }
+
+    header.msgtype = msg->msgtype;
+    header.msglen  = out->len - start - CINET_HEADER_LENGTH;
+
+    if ((data = cinet_writer_get_data(out, start)) != NULL) {
+        cinet_msg_write_header_full(data, CINET_HEADER_LENGTH, &header, flags);
+        if (checksum)
+            cinet_set_ulong(data, checksum, cinet_crc32c(0, data, checksum));
+    }
+
+    if (out->str || out->buf) {
+        codec->stats.msgs_written++;
+        codec->stats.bytes_written += out->len - start;
+    }
+
+    return 0;
+}
+
+gint cinet_msg_write_msg(gchar **buffer, gsize *len, CINetMsg *msg)
+{
+    return cinet_msg_write_msg_full(buffer, len, msg, 0);
+}
+
+gint cinet_msg_write_msg_full(gchar **buffer, gsize *len, CINetMsg *msg, guint32 flags)
+{
+    gssize size;
+    gchar *data;
+
+    if (!buffer || !len)
+        return -1;
+
+    /* Compressing is not cheap, do it only once. */
+    if (flags & CI_NET_MSG_FLAG_COMPRESSED) {
+        GString *str = g_string_sized_new(1024);
+        if (cinet_codec_append_msg(NULL, str, msg, flags) < 0) {
+            g_string_free(str, TRUE);
+            *buffer = NULL;
+            *len = 0;
+            return -1;
+        }
+        *len = str->len;
+        *buffer = g_string_free(str, FALSE);
+        return 0;
+    }
+
+    /* Counting first is cheap and the buffer is allocated exactly once. */
+    if ((size = cinet_msg_get_size(msg, flags)) < 0)
+        return -1;
+
+    data = g_malloc(size);
+    if (cinet_msg_write_msg_to_buffer(data, size, msg, flags) != size) {
+        g_free(data);
+        *buffer = NULL;
+        *len = 0;
+        return -1;
+    }
+
+    *buffer = data;
+    *len = size;
+
+    return 0;
+}
+
+gssize cinet_msg_get_size(CINetMsg *msg, guint32 flags)
+{
+    CINetWriter out;
+
+    cinet_writer_init(&out, NULL, NULL, 0);
+    if (cinet_msg_encode(cinet_codec_get_default(), &out, msg, flags) != 0)
+        return -1;
+
+    return out.len;
+}
+
+gssize cinet_msg_write_msg_to_buffer(gchar *buffer, gsize size, CINetMsg *msg, guint32 flags)
+{
+    CINetWriter out;
+
+    if (!buffer)
+        return -1;
+
+    cinet_writer_init(&out, NULL, buffer, size);
+    if (cinet_msg_encode(cinet_codec_get_default(), &out, msg, flags) != 0 || out.len > size)
+        return -1;
+
+    return out.len;
+}
+
+gssize cinet_msg_append_msg(GString *str, CINetMsg *msg, guint32 flags)
+{
+    return cinet_codec_append_msg(NULL, str, msg, flags);
+}
+
+gssize cinet_codec_append_msg(CINetCodec *codec, GString *str, CINetMsg *msg, guint32 flags)
+{
+    CINetWriter out;
+
+    if (!str)
+        return -1;
+    if (!codec)
+        codec = cinet_codec_get_default();
+
+    cinet_writer_init(&out, str, NULL, 0);
+    if (cinet_msg_encode(codec, &out, msg, flags) != 0) {
+        g_string_truncate(str, out.base);
+        return -1;
+    }
+
+    return out.len;
+}
+
+GBytes *cinet_msg_write_bytes(CINetMsg *msg, guint32 flags)
+{
+    gchar *buffer;
+    gsize len;
+
+    if (cinet_msg_write_msg_full(&buffer, &len, msg, flags) != 0)
+        return NULL;
+
+    return g_bytes_new_take(buffer, len);
+}
+
+static gboolean cinet_msg_read_member(CINetMsg *msg, CINetMsgField field, CINetJsonReader *reader)
+{
+    struct CINetMsgClass *cls = cinet_msg_get_class(msg);
+
+    if (field == CI_NET_FIELD_GUID) {
+        msg->guid = (guint32)cinet_json_read_int(reader);
+        return TRUE;
+    }
+    return cinet_schema_read(msg, cls->schema, msg, field, reader);
+}
+
+CINetMsg *cinet_msg_read(CINetMsgType msgtype, CINetJsonReader *reader)
+{
+    struct CINetMsgClass *cls = cinet_msg_type_get_class(msgtype);
+    CINetMsg *msg;
+
+    if (!cls)
+       return NULL;
+    if (!cls->schema) {
+        /* Nothing to read, but the payload still has to be valid. */
+        if (!cinet_json_skip_value(reader))
+            return NULL;
+        return cinet_msg_alloc_full(msgtype, reader->arena);
+    }
+
+    msg = cinet_msg_alloc_full(msgtype, reader->arena);
+    if (!cinet_json_read_object(reader, msg, (CINetJsonMemberFunc)cinet_msg_read_member)) {
+        cinet_msg_discard(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
+static gboolean cinet_msg_read_field(CINetMsg *msg, guint field, CINetBinReader *reader)
+{
+    struct CINetMsgClass *cls = cinet_msg_get_class(msg);
+
+    if (field == CINET_BIN_GUID) {
+        msg->guid = (guint32)cinet_bin_read_uint(reader);
+        return TRUE;
+    }
+    if (!cls->schema)
+        return FALSE;
+    return cinet_schema_read_binary(msg, cls->schema, msg, field, CINET_BIN_GUID + 1, reader);
+}
+
+CINetMsg *cinet_msg_read_binary(CINetMsgType msgtype, CINetBinReader *reader)
+{
+    CINetMsg *msg = cinet_msg_alloc_full(msgtype, reader->arena);
+    const CINetSchema *schema;
+    guint i;
+
+    if (!msg)
+        return NULL;
+
+    if (!cinet_bin_read_fields(reader, msg, (CINetBinFieldFunc)cinet_msg_read_field)) {
+        cinet_msg_discard(msg);
+        return NULL;
+    }
+
+    /* List entries were prepended while reading. */
+    schema = cinet_msg_get_class(msg)->schema;
+    for (i = 0; schema && i < schema->n_fields; ++i) {
+        if (CINET_KIND_IS_LIST(schema->fields[i].kind))
+            CINET_FIELD_LIST(msg, &schema->fields[i]) = g_list_reverse(CINET_FIELD_LIST(msg, &schema->fields[i]));
+    }
+
+    return msg;
+}
+
+guint32 cinet_msg_flags_for_features(guint32 features)
+{
+    guint32 flags = 0;
+
+    features &= CINET_FEATURES_SUPPORTED;
+    if (features & CI_NET_FEATURE_BINARY)
+        flags |= CI_NET_MSG_FLAG_BINARY;
+    if ((features & CI_NET_FEATURE_BINARY) && (features & CI_NET_FEATURE_COLUMNS))
+        flags |= CI_NET_MSG_FLAG_COLUMNS;
+    if (features & CI_NET_FEATURE_COMPRESSION)
+        flags |= CI_NET_MSG_FLAG_COMPRESSED;
+    if (features & CI_NET_FEATURE_CHECKSUM)
+        flags |= CI_NET_MSG_FLAG_CHECKSUM;
+
+    return flags;
+}
+
+gint cinet_msg_read_msg(CINetMsg **msg, gchar *buffer, gsize len)
+{
+    return cinet_msg_read_msg_full(msg, buffer, len, 0);
+}
+
+/* Decode a frame. @checked tells if the checksum of the frame was already
+ * checked by @cinet_msg_reader_next_frame(). */
+static gint cinet_msg_decode(CINetCodec *codec, CINetMsg **msg, gchar *buffer, gsize len,
+                             guint32 flags, gboolean checked)
+{
+    CINetMsgHeader header;
+    gssize off;
+
+    CINetJsonReader reader;
+    CINetBinReader binreader;
+    CINetArena *arena = NULL;
+
+    if ((off = cinet_msg_read_header(&header, buffer, len)) < CINET_HEADER_LENGTH)
+        return -1;
+    if (header.flags & ~CINET_MSG_FLAGS_SUPPORTED)
+        return -1;
 
-void cinet_call_info_build(CICallInfo *info, JsonBuilder *builder);
-void cinet_call_info_read(CICallInfo *info, JsonObject *obj);
+    if (header.flags & CI_NET_MSG_FLAG_CHECKSUM) {
+        if (!checked && !cinet_msg_check_frame(buffer, len))
+            return -1;
+        len -= CINET_CHECKSUM_LENGTH;
+    }
 
-void cinet_caller_info_build(CICallerInfo *info, JsonBuilder *builder);
-void cinet_caller_info_read(CICallerInfo *info, JsonObject *obj);
+    if (header.flags & CI_NET_MSG_FLAG_COMPRESSED) {
+        len -= off;
+        if ((buffer = cinet_msg_inflate_payload(codec, &buffer[off], &len)) == NULL)
+            return -1;
+        off = 0;
+        /* The inflated data is reused, strings have to be copied. */
+        if (flags & CINET_READ_VIEW)
+            flags = (flags & ~CINET_READ_VIEW) | CINET_READ_ARENA;
+    }
 
-JsonNode *cinet_msg_version_build(CINetMsg *msg);
-CINetMsg *cinet_msg_version_read(JsonNode *root);
-void cinet_msg_version_set_value(CINetMsg *msg, const gchar *key, const gpointer value);
-void cinet_msg_version_free(CINetMsg *msg);
+    /* Decoded data is never larger than twice the payload plus the structures. */
+    if (flags & (CINET_READ_ARENA | CINET_READ_VIEW))
+        arena = cinet_arena_new(2 * (len - off) + 1024);
+    if (flags & CINET_READ_VIEW)
+        cinet_arena_set_view(arena, &buffer[off], MIN(len - off, header.msglen));
+
+    if (header.flags & CI_NET_MSG_FLAG_BINARY) {
+        cinet_bin_reader_init(&binreader, &buffer[off], len-off);
+        binreader.str = codec->str;
+        binreader.arena = arena;
+        binreader.view = (flags & CINET_READ_VIEW) != 0;
+        *msg = cinet_msg_read_binary(header.msgtype, &binreader);
+        codec->str = binreader.str;
+        binreader.str = NULL;
+    }
+    else {
+        cinet_json_reader_init(&reader, &buffer[off], len-off);
+        reader.str = codec->str;
+        reader.arena = arena;
+        reader.view = (flags & CINET_READ_VIEW) != 0;
 
-JsonNode *cinet_msg_event_ring_build(CINetMsg *msg);
-CINetMsg *cinet_msg_event_ring_read(JsonNode *root);
-void cinet_msg_event_ring_set_value(CINetMsg *msg, const gchar *key, const gpointer value);
-void cinet_msg_event_ring_free(CINetMsg *msg);
+        *msg = cinet_msg_read(header.msgtype, &reader);
 
-JsonNode *cinet_msg_event_call_build(CINetMsg *msg);
-CINetMsg *cinet_msg_event_call_read(JsonNode *root);
-void cinet_msg_event_call_set_value(CINetMsg *msg, const gchar *key, const gpointer value);
-void cinet_msg_event_call_free(CINetMsg *msg);
+        if (*msg && !cinet_json_reader_finish(&reader)) {
+            cinet_msg_discard(*msg);
+            *msg = NULL;
+        }
 
-JsonNode *cinet_msg_db_num_calls_build(CINetMsg *msg);
-CINetMsg *cinet_msg_db_num_calls_read(JsonNode *root);
-void cinet_msg_db_num_calls_set_value(CINetMsg *msg, const gchar *key, const gpointer value);
+        codec->str = reader.str;
+        reader.str = NULL;
+    }
+    cinet_codec_release_buffer(codec->str);
 
-JsonNode *cinet_msg_db_call_list_build(CINetMsg *msg);
-CINetMsg *cinet_msg_db_call_list_read(JsonNode *root);
-void cinet_msg_db_call_list_set_value(CINetMsg *msg, const gchar *key, const gpointer value);
-void cinet_msg_db_call_list_free(CINetMsg *msg);
+    if (header.flags & CI_NET_MSG_FLAG_COMPRESSED)
+        cinet_msg_inflate_done(codec);
 
-JsonNode *cinet_msg_db_get_caller_build(CINetMsg *msg);
-CINetMsg *cinet_msg_db_get_caller_read(JsonNode *root);
-void cinet_msg_db_get_caller_set_value(CINetMsg *msg, const gchar *key, const gpointer value);
-void cinet_msg_db_get_caller_free(CINetMsg *msg);
+    if (*msg)
+        return 0;
+    cinet_arena_free(arena);
+    return -1;
+}
 
-JsonNode *cinet_msg_db_add_caller_build(CINetMsg *msg);
-CINetMsg *cinet_msg_db_add_caller_read(JsonNode *root);
-void cinet_msg_db_add_caller_set_value(CINetMsg *msg, const gchar *key, const gpointer value);
-void cinet_msg_db_add_caller_free(CINetMsg *msg);
+/* Decode a frame with @codec and count it in its stats. */
+static gint cinet_msg_read_frame(CINetCodec *codec, CINetMsg **msg, gchar *buffer, gsize len,
+                                 guint32 flags, gboolean checked)
+{
+    if (!msg || !buffer)
+        return -1;
 
-JsonNode *cinet_msg_db_del_caller_build(CINetMsg *msg);
-CINetMsg *cinet_msg_db_del_caller_read(JsonNode *root);
-void cinet_msg_db_del_caller_set_value(CINetMsg *msg, const gchar *key, const gpointer value);
-void cinet_msg_db_del_caller_free(CINetMsg *msg);
+    if (cinet_msg_decode(codec, msg, buffer, len, flags, checked) != 0) {
+        *msg = NULL;
+        codec->stats.errors++;
+        return -1;
+    }
 
-JsonNode *cinet_msg_db_get_caller_list_build(CINetMsg *msg);
-CINetMsg *cinet_msg_db_get_caller_list_read(JsonNode *root);
-void cinet_msg_db_get_caller_list_set_value(CINetMsg *msg, const gchar *key, const gpointer value);
-void cinet_msg_db_get_caller_list_free(CINetMsg *msg);
+    codec->stats.msgs_read++;
+    codec->stats.bytes_read += len;
+    return 0;
+}
 
-static struct CINetMsgClass msgclasses[] = {
-    { CI_NET_MSG_VERSION, sizeof(CINetMsgVersion), cinet_msg_version_build,
-        cinet_msg_version_read, cinet_msg_version_free, cinet_msg_version_set_value},
-    { CI_NET_MSG_EVENT_RING, sizeof(CINetMsgEventRing), cinet_msg_event_ring_build,
-        cinet_msg_event_ring_read, cinet_msg_event_ring_free, cinet_msg_event_ring_set_value },
-    { CI_NET_MSG_EVENT_CALL, sizeof(CINetMsgEventCall), cinet_msg_event_call_build,
-        cinet_msg_event_call_read, cinet_msg_event_call_free, cinet_msg_event_call_set_value },
-    { CI_NET_MSG_EVENT_CONNECT, sizeof(CINetMsg), NULL, NULL, NULL, NULL },
-    { CI_NET_MSG_EVENT_DISCONNECT, sizeof(CINetMsg), NULL, NULL, NULL, NULL },
-    { CI_NET_MSG_LEAVE, sizeof(CINetMsgLeave), NULL, NULL, NULL, NULL },
-    { CI_NET_MSG_SHUTDOWN, sizeof(CINetMsgShutdown), NULL, NULL, NULL, NULL },
-    { CI_NET_MSG_DB_NUM_CALLS, sizeof(CINetMsgDbNumCalls), cinet_msg_db_num_calls_build,
-        cinet_msg_db_num_calls_read, NULL, cinet_msg_db_num_calls_set_value },
-    { CI_NET_MSG_DB_CALL_LIST, sizeof(CINetMsgDbCallList), cinet_msg_db_call_list_build,
-        cinet_msg_db_call_list_read, cinet_msg_db_call_list_free, cinet_msg_db_call_list_set_value },
-    { CI_NET_MSG_DB_GET_CALLER, sizeof(CINetMsgDbGetCaller), cinet_msg_db_get_caller_build,
-        cinet_msg_db_get_caller_read, cinet_msg_db_get_caller_free, cinet_msg_db_get_caller_set_value },
-    { CI_NET_MSG_DB_ADD_CALLER, sizeof(CINetMsgDbAddCaller), cinet_msg_db_add_caller_build,
-        cinet_msg_db_add_caller_read, cinet_msg_db_add_caller_free, cinet_msg_db_add_caller_set_value },
-    { CI_NET_MSG_DB_DEL_CALLER, sizeof(CINetMsgDbDelCaller), cinet_msg_db_del_caller_build,
-        cinet_msg_db_del_caller_read, cinet_msg_db_del_caller_free, cinet_msg_db_del_caller_set_value },
-    { CI_NET_MSG_DB_GET_CALLER_LIST, sizeof(CINetMsgDbGetCallerList), cinet_msg_db_get_caller_list_build,
-        cinet_msg_db_get_caller_list_read, cinet_msg_db_get_caller_list_free, cinet_msg_db_get_caller_list_set_value },
-};
+gint cinet_msg_read_msg_full(CINetMsg **msg, gchar *buffer, gsize len, guint32 flags)
+{
+    return cinet_msg_read_frame(cinet_codec_get_default(), msg, buffer, len, flags, FALSE);
+}
 
-static struct CINetMsgClass *cinet_msg_get_class(CINetMsg *msg)
+gint cinet_codec_read_msg(CINetCodec *codec, CINetMsg **msg, gchar *buffer, gsize len, guint32 flags)
 {
-    if (!msg || msg->msgtype >= CI_NET_MSG_COUNT)
-        return NULL;
-    return &msgclasses[msg->msgtype];
+    if (!codec)
+        codec = cinet_codec_get_default();
+    return cinet_msg_read_frame(codec, msg, buffer, len, flags, FALSE);
 }
 
-static struct CINetMsgClass *cinet_msg_type_get_class(CINetMsgType msgtype)
+CINetMsg *cinet_msg_materialize(CINetMsg *msg)
 {
-    if (msgtype >= CI_NET_MSG_COUNT)
+    CINetWriter out;
+    CINetBinReader reader;
+    CINetMsg *copy;
+    GString *payload;
+
+    if (!msg || !cinet_msg_get_class(msg))
         return NULL;
-    return &msgclasses[msgtype];
+
+    /* Going through the binary encoding copies exactly the data that is
+     * part of the message. */
+    payload = g_string_sized_new(256);
+    cinet_writer_init(&out, payload, NULL, 0);
+    out.flags = CI_NET_MSG_FLAG_BINARY;
+    cinet_msg_build_binary(msg, &out);
+
+    cinet_bin_reader_init(&reader, payload->str, payload->len);
+    copy = cinet_msg_read_binary(msg->msgtype, &reader);
+    cinet_bin_reader_clear(&reader);
+
+    g_string_free(payload, TRUE);
+
+    return copy;
 }
 
-JsonNode *cinet_msg_build(CINetMsg *msg)
+struct _CINetMsgReader {
+    gchar *data;
+    gsize size;                       /* Allocated size of @data. */
+    gsize start;                      /* Start of the data not yet consumed. */
+    gsize end;                        /* End of the data received so far. */
+    gsize need;                       /* Size of the incomplete frame at @start. */
+    gsize max_frame_size;
+    guint64 dropped;                  /* Number of bytes skipped. */
+};
+
+#define CINET_MSG_READER_DEFAULT_MAX_FRAME (16 * 1024 * 1024)
+#define CINET_MSG_READER_MIN_SPACE         (16 * 1024)
+
+CINetMsgReader *cinet_msg_reader_new(gsize max_frame_size)
 {
-    struct CINetMsgClass *cls = cinet_msg_get_class(msg);
-    if (!cls)
-        return NULL;
-    if (!cls->msg_build)
-        return cinet_msg_default_build(msg);
-    return cls->msg_build(msg);
+    CINetMsgReader *reader = g_malloc0(sizeof(CINetMsgReader));
+
+    reader->max_frame_size = max_frame_size ? max_frame_size : CINET_MSG_READER_DEFAULT_MAX_FRAME;
+
+    return reader;
 }
 
-CINetMsg *cinet_msg_read(CINetMsgType msgtype, JsonNode *root)
+void cinet_msg_reader_free(CINetMsgReader *reader)
 {
-    struct CINetMsgClass *cls = cinet_msg_type_get_class(msgtype);
-    if (!cls)
-       return NULL;
-    if (!cls->msg_read)
-        return (CINetMsg*)cinet_msg_alloc(msgtype);
-    return cls->msg_read(root);
+    if (reader == NULL)
+        return;
+    g_free(reader->data);
+    g_free(reader);
 }
 
-CINetMsg *cinet_msg_alloc(CINetMsgType msgtype)
+gchar *cinet_msg_reader_get_buffer(CINetMsgReader *reader, gsize *len)
 {
-    struct CINetMsgClass *cls = cinet_msg_type_get_class(msgtype);
-    if (!cls || cls->size == 0)
+    gsize avail, space;
+
+    if (reader == NULL || len == NULL)
         return NULL;
-    CINetMsg *msg = g_malloc0(cls->size);
-    msg->msgtype = msgtype;
 
-    return msg;
+    avail = reader->end - reader->start;
+    /* Enough room for the rest of a pending frame, but never read in small chunks. */
+    space = reader->need > avail ? reader->need - avail : 0;
+    space = MAX(space, CINET_MSG_READER_MIN_SPACE);
+
+    if (reader->size - reader->end < space) {
+        /* Data is only moved to the front if the space at the end does not
+         * suffice. Usually this is just the beginning of a single frame. */
+        if (reader->start > 0) {
+            memmove(reader->data, &reader->data[reader->start], avail);
+            reader->start = 0;
+            reader->end = avail;
+        }
+        if (reader->size - reader->end < space) {
+            reader->size = MAX(reader->size * 2, reader->end + space);
+            reader->data = g_realloc(reader->data, reader->size);
+        }
+    }
+
+    *len = reader->size - reader->end;
+    return &reader->data[reader->end];
 }
 
-void cinet_msg_free(CINetMsg *msg)
+void cinet_msg_reader_commit(CINetMsgReader *reader, gsize len)
 {
-    struct CINetMsgClass *cls = cinet_msg_get_class(msg);
-    if (cls && cls->msg_free)
-        cls->msg_free(msg);
-    g_free(msg);
+    if (reader == NULL || len > reader->size - reader->end)
+        return;
+    reader->end += len;
 }
 
-static inline void cinet_set_ulong(gpointer dst, gint off, guint32 val)
+void cinet_msg_reader_feed(CINetMsgReader *reader, const gchar *data, gsize len)
 {
-    ((guchar*)dst)[off  ] = val & 0xff;
-    ((guchar*)dst)[off+1] = (val >>  8) & 0xff;
-    ((guchar*)dst)[off+2] = (val >> 16) & 0xff;
-    ((guchar*)dst)[off+3] = (val >> 24) & 0xff;
+    gchar *buffer;
+    gsize space;
+
+    if (reader == NULL || data == NULL)
+        return;
+
+    while (len > 0) {
+        buffer = cinet_msg_reader_get_buffer(reader, &space);
+        space = MIN(space, len);
+        memcpy(buffer, data, space);
+        cinet_msg_reader_commit(reader, space);
+        data += space;
+        len -= space;
+    }
 }
 
-#define cinet_get_ulong(buf, off) ((((guchar*)(buf))[(off)] & 0xff) |\
-                                   ((((guchar*)(buf))[(off)+1] & 0xff) << 8) |\
-                                   ((((guchar*)(buf))[(off)+2] & 0xff) << 16) |\
-                                   ((((guchar*)(buf))[(off)+3] & 0xff) << 24))
+/* Find the next magic string from @p on. A magic string cut off at @end
+ * counts, too, it could be the beginning of the next header. Returns @end if
+ * there is none. */
+static gchar *cinet_msg_find_magic(gchar *p, gchar *end)
+{
+    while ((p = memchr(p, CINET_MAGIC_STRING[0], end - p)) != NULL) {
+        if ((end - p < 6 && !memcmp(p, CINET_MAGIC_STRING, end - p)) ||
+                (end - p >= 6 && CINET_CHECK_MAGIC_STRING(p)))
+            return p;
+        ++p;
+    }
 
-#define CINET_HEADER_SET_LEN(h, len)   cinet_set_ulong((h), 6, (len))
-#define CINET_HEADER_SET_TYPE(h, type) cinet_set_ulong((h), 10, (type))
+    return end;
+}
 
-#define CINET_HEADER_GET_LEN(h)        cinet_get_ulong((h), 6)
-#define CINET_HEADER_GET_TYPE(h)       cinet_get_ulong((h), 10)
+typedef enum {
+    CINET_FRAME_COMPLETE,
+    CINET_FRAME_INCOMPLETE,
+    CINET_FRAME_BROKEN                /* Not a frame or out of sync. */
+} CINetFrameState;
+
+/* Check the frame at @p. At least @CINET_HEADER_LENGTH bytes have to be
+ * available.
+ *
+ * @p:              Start of the frame.
+ * @avail:          Number of bytes available at @p.
+ * @max_frame_size: Larger frames are considered broken.
+ * @framelen:       Return location for the size of the frame.
+ *
+ * @return:         The state of the frame.
+ */
+static CINetFrameState cinet_msg_scan_frame(const gchar *p, gsize avail, gsize max_frame_size, gsize *framelen)
+{
+    if (!CINET_CHECK_MAGIC_STRING(p))
+        return CINET_FRAME_BROKEN;
 
-#define CINET_MAGIC_STRING "ci-msg"
-#define CINET_CHECK_MAGIC_STRING(data) (!strncmp((gchar*)(data), CINET_MAGIC_STRING, 6))
+    *framelen = (gsize)CINET_HEADER_GET_LEN(p) + CINET_HEADER_LENGTH;
+    if (*framelen > max_frame_size)
+        return CINET_FRAME_BROKEN;
+    if (avail < *framelen)
+        return CINET_FRAME_INCOMPLETE;
 
-gssize cinet_msg_write_header(gchar *data, gsize len, CINetMsgHeader *header)
+    /* A broken frame means the stream is out of sync, too. */
+    if (((guint32)CINET_HEADER_GET_TYPE(p) >> 16) & CI_NET_MSG_FLAG_CHECKSUM &&
+            !cinet_msg_check_frame(p, *framelen))
+        return CINET_FRAME_BROKEN;
+
+    return CINET_FRAME_COMPLETE;
+}
+
+/* Skip data until the next magic string. Bytes at the end are kept if they
+ * could be the beginning of the next header. */
+static void cinet_msg_reader_resync(CINetMsgReader *reader)
 {
-    if (!data || len < CINET_HEADER_LENGTH || !header)
-        return -1;
-    /* magic string */
-    strcpy(data, "ci-msg");
-    /* msg length */
-    CINET_HEADER_SET_LEN(data, header->msglen);
-    CINET_HEADER_SET_TYPE(data, header->msgtype);
+    gchar *found = cinet_msg_find_magic(&reader->data[reader->start + 1], &reader->data[reader->end]);
+    gsize skip = found - &reader->data[reader->start];
 
-    return CINET_HEADER_LENGTH;
+    reader->start += skip;
+    reader->dropped += skip;
+    reader->need = 0;
 }
 
-gssize cinet_msg_read_header(CINetMsgHeader *header, gchar *data, gsize len)
+gboolean cinet_msg_reader_next_frame(CINetMsgReader *reader, gchar **frame, gsize *len)
 {
-    if (len < CINET_HEADER_LENGTH || !header || !data)
-        return -1;
+    CINetFrameState state;
+    gchar *p;
+    gsize framelen;
+
+    if (reader == NULL || frame == NULL || len == NULL)
+        return FALSE;
+
+    while (reader->end - reader->start >= CINET_HEADER_LENGTH) {
+        p = &reader->data[reader->start];
+        state = cinet_msg_scan_frame(p, reader->end - reader->start, reader->max_frame_size, &framelen);
+        if (state == CINET_FRAME_BROKEN) {
+            cinet_msg_reader_resync(reader);
+            continue;
+        }
+        if (state == CINET_FRAME_INCOMPLETE) {
+            reader->need = framelen;
+            return FALSE;
+        }
+
+        *frame = p;
+        *len = framelen;
+        reader->start += framelen;
+        reader->need = 0;
+
+        if (reader->start == reader->end)
+            reader->start = reader->end = 0;
+
+        return TRUE;
+    }
 
-    if (!CINET_CHECK_MAGIC_STRING(data))
-        return -1;
-    header->msglen = CINET_HEADER_GET_LEN(data);
-    header->msgtype = CINET_HEADER_GET_TYPE(data);
+    return FALSE;
+}
 
-    return CINET_HEADER_LENGTH;
+gboolean cinet_msg_reader_next_msg(CINetMsgReader *reader, CINetMsg **msg)
+{
+    gchar *frame;
+    gsize len;
+
+    if (msg == NULL)
+        return FALSE;
+
+    while (cinet_msg_reader_next_frame(reader, &frame, &len)) {
+        if (cinet_msg_read_frame(cinet_codec_get_default(), msg, frame, len, 0, TRUE) == 0)
+            return TRUE;
+        /* Unknown or broken message. The frame itself was intact, so just
+         * continue with the next one. */
+        reader->dropped += len;
+    }
+
+    return FALSE;
 }
 
-gint cinet_msg_write_msg(gchar **buffer, gsize *len, CINetMsg *msg)
+guint64 cinet_msg_reader_get_dropped(CINetMsgReader *reader)
 {
-    if (!msg || !buffer || !len)
-       return -1;
-    JsonGenerator *gen = NULL;
-    JsonNode *node = NULL;
-    CINetMsgHeader header;
+    return reader ? reader->dropped : 0;
+}
 
-    gchar *payload;
-    gsize sz, off;
+/* Decoding of many frames at once. The frames are indexed first, then
+ * decoded in chunks, which may run in a shared thread pool. */
+#define CINET_READ_MANY_CHUNK_FRAMES 32
+
+typedef struct {
+    gsize offset;
+    gsize len;
+} CINetFrameSpan;
+
+typedef struct {
+    gchar *buffer;
+    CINetFrameSpan *frames;
+    CINetMsg **msgs;                  /* One slot per frame, NULL if it could not be decoded. */
+    guint32 flags;
+    GMutex lock;
+    GCond done;
+    guint pending;                    /* Chunks not decoded yet. */
+} CINetReadJob;
+
+typedef struct {
+    CINetReadJob *job;
+    guint first;
+    guint last;
+} CINetReadChunk;
+
+/* Each thread decodes with its own default codec. */
+static void cinet_msg_read_chunk(CINetReadJob *job, guint first, guint last)
+{
+    CINetCodec *codec = cinet_codec_get_default();
+    guint i;
 
-    node = cinet_msg_build(msg);
-    if (!node)
-        return -1;
+    for (i = first; i < last; ++i)
+        cinet_msg_read_frame(codec, &job->msgs[i], &job->buffer[job->frames[i].offset], job->frames[i].len,
+                             job->flags, TRUE);
+}
+
+static void cinet_msg_read_chunk_func(gpointer data, gpointer userdata)
+{
+    CINetReadChunk *chunk = data;
+    CINetReadJob *job = chunk->job;
+
+    cinet_msg_read_chunk(job, chunk->first, chunk->last);
+    g_free(chunk);
 
-    if (JSON_NODE_HOLDS_OBJECT(node) && json_node_get_object(node) == NULL) {
-        payload = g_strdup("{}");
-        sz = 2;
-        json_node_free(node);
+    g_mutex_lock(&job->lock);
+    if (--job->pending == 0)
+        g_cond_signal(&job->done);
+    g_mutex_unlock(&job->lock);
+}
+
+static GThreadPool *cinet_msg_get_read_pool(void)
+{
+    static gsize pool = 0;
+
+    if (g_once_init_enter(&pool))
+        g_once_init_leave(&pool, (gsize)g_thread_pool_new(cinet_msg_read_chunk_func, NULL,
+                                                          g_get_num_processors(), FALSE, NULL));
+
+    return (GThreadPool*)pool;
+}
+
+/* Decode @n frames into @job->msgs. The calling thread decodes the first
+ * chunk itself and waits for the others. */
+static void cinet_msg_read_frames(CINetReadJob *job, guint n, guint n_threads)
+{
+    CINetReadChunk *chunk;
+    guint n_chunks, size, first, i;
+
+    n_chunks = MIN(n_threads, n / CINET_READ_MANY_CHUNK_FRAMES);
+    if (n_chunks <= 1) {
+        cinet_msg_read_chunk(job, 0, n);
+        return;
     }
-    else {
-        gen = json_generator_new();
-        json_generator_set_root(gen, node);
-        payload = json_generator_to_data(gen, &sz);
-        json_node_free(node);
-        g_object_unref(gen);
+
+    size = (n + n_chunks - 1) / n_chunks;
+
+    g_mutex_init(&job->lock);
+    g_cond_init(&job->done);
+    job->pending = n_chunks - 1;
+
+    for (i = 1, first = size; i < n_chunks; ++i, first += size) {
+        chunk = g_malloc(sizeof(CINetReadChunk));
+        chunk->job = job;
+        chunk->first = first;
+        chunk->last = MIN(first + size, n);
+        g_thread_pool_push(cinet_msg_get_read_pool(), chunk, NULL);
     }
 
-    *len = sz+CINET_HEADER_LENGTH;
-    *buffer = g_malloc(*len);
-    header.msgtype = msg->msgtype;
-    header.msglen  = sz;
+    cinet_msg_read_chunk(job, 0, size);
 
-    off = cinet_msg_write_header(*buffer, *len, &header);
-    if (off < CINET_HEADER_LENGTH) {
-        g_free(payload);
-        g_free(*buffer);
-        *buffer = NULL;
-        *len = 0;
+    g_mutex_lock(&job->lock);
+    while (job->pending > 0)
+        g_cond_wait(&job->done, &job->lock);
+    g_mutex_unlock(&job->lock);
+
+    g_cond_clear(&job->done);
+    g_mutex_clear(&job->lock);
+}
+
+gssize cinet_msg_read_many(gchar *buffer, gsize len, guint32 flags, guint n_threads, GPtrArray *msgs)
+{
+    CINetFrameState state;
+    CINetFrameSpan span;
+    CINetReadJob job;
+    GArray *frames;
+    gchar *p, *end;
+    guint i;
+
+    if (!buffer || !msgs)
         return -1;
+
+    /* Frames can only be found one after another, but this only looks at
+     * the headers. Garbage is skipped as in @CINetMsgReader. */
+    frames = g_array_new(FALSE, FALSE, sizeof(CINetFrameSpan));
+    p = buffer;
+    end = buffer + len;
+    while (end - p >= CINET_HEADER_LENGTH) {
+        state = cinet_msg_scan_frame(p, end - p, CINET_MSG_READER_DEFAULT_MAX_FRAME, &span.len);
+        if (state == CINET_FRAME_INCOMPLETE)
+            break;
+        if (state == CINET_FRAME_BROKEN) {
+            p = cinet_msg_find_magic(p + 1, end);
+            continue;
+        }
+        span.offset = p - buffer;
+        g_array_append_val(frames, span);
+        p += span.len;
     }
 
-    if (sz > 0)
-        memcpy(&(*buffer)[off], payload, sz);
-    g_free(payload);
+    if (frames->len > 0) {
+        job.buffer = buffer;
+        job.frames = (CINetFrameSpan*)frames->data;
+        job.msgs = g_malloc0(frames->len * sizeof(CINetMsg*));
+        job.flags = flags;
 
-    return 0;
+        cinet_msg_read_frames(&job, frames->len, n_threads ? n_threads : g_get_num_processors());
+
+        for (i = 0; i < frames->len; ++i) {
+            if (job.msgs[i])
+                g_ptr_array_add(msgs, job.msgs[i]);
+        }
+        g_free(job.msgs);
+    }
+
+    g_array_free(frames, TRUE);
+
+    return p - buffer;
 }
 
-gint cinet_msg_read_msg(CINetMsg **msg, gchar *buffer, gsize len)
+/* Frames queued for output with a single vectored write. The header and the
+ * checksum of each frame are kept in the frame entry, the payload either in
+ * @payloads or in memory owned by the caller. Complete frames are kept in
+ * @bytes instead. */
+typedef struct {
+    GBytes *bytes;                    /* Complete frame or NULL. */
+    gchar header[CINET_HEADER_LENGTH];
+    const gchar *payload;             /* External payload or NULL if in @payloads. */
+    gsize offset;                     /* Offset of the payload in @payloads. */
+    gsize len;                        /* Length of the payload. */
+    gchar checksum[CINET_CHECKSUM_LENGTH];
+    gsize checksum_len;               /* 0 if the frame has no checksum. */
+} CINetMsgBatchFrame;
+
+struct _CINetMsgBatch {
+    GArray *frames;
+    GString *payloads;
+    guint frame;                      /* First frame not completely written. */
+    gsize offset;                     /* Bytes of @frame already written. */
+    gsize pending;                    /* Bytes not written yet. */
+};
+
+static void cinet_msg_batch_frame_clear(CINetMsgBatchFrame *frame)
 {
-    if (!msg || !buffer)
-        return -1;
+    if (frame->bytes) {
+        g_bytes_unref(frame->bytes);
+        frame->bytes = NULL;
+    }
+}
+
+static inline gsize cinet_msg_batch_frame_size(CINetMsgBatchFrame *frame)
+{
+    if (frame->bytes)
+        return g_bytes_get_size(frame->bytes);
+    return CINET_HEADER_LENGTH + frame->len + frame->checksum_len;
+}
+
+CINetMsgBatch *cinet_msg_batch_new(void)
+{
+    CINetMsgBatch *batch = g_malloc0(sizeof(CINetMsgBatch));
+
+    batch->frames = g_array_new(FALSE, TRUE, sizeof(CINetMsgBatchFrame));
+    g_array_set_clear_func(batch->frames, (GDestroyNotify)cinet_msg_batch_frame_clear);
+    batch->payloads = g_string_sized_new(4096);
+
+    return batch;
+}
+
+void cinet_msg_batch_free(CINetMsgBatch *batch)
+{
+    if (batch == NULL)
+        return;
+    g_array_free(batch->frames, TRUE);
+    g_string_free(batch->payloads, TRUE);
+    g_free(batch);
+}
+
+void cinet_msg_batch_clear(CINetMsgBatch *batch)
+{
+    if (batch == NULL)
+        return;
+    g_array_set_size(batch->frames, 0);
+    g_string_truncate(batch->payloads, 0);
+    batch->frame = 0;
+    batch->offset = 0;
+    batch->pending = 0;
+}
 
+static CINetMsgBatchFrame *cinet_msg_batch_add_frame(CINetMsgBatch *batch, CINetMsgType msgtype,
+                                                     guint32 flags, const gchar *payload, gsize len)
+{
+    CINetMsgBatchFrame *frame;
     CINetMsgHeader header;
-    gssize off;
+    guint32 crc;
 
-    JsonParser *parser;
-    JsonNode *root;
+    g_array_set_size(batch->frames, batch->frames->len + 1);
+    frame = &g_array_index(batch->frames, CINetMsgBatchFrame, batch->frames->len - 1);
 
-    if ((off = cinet_msg_read_header(&header, buffer, len)) < CINET_HEADER_LENGTH)
+    frame->len = len;
+    frame->checksum_len = (flags & CI_NET_MSG_FLAG_CHECKSUM) ? CINET_CHECKSUM_LENGTH : 0;
+
+    header.msgtype = msgtype;
+    header.msglen = len + frame->checksum_len;
+    cinet_msg_write_header_full(frame->header, CINET_HEADER_LENGTH, &header, flags);
+
+    if (frame->checksum_len) {
+        crc = cinet_crc32c(0, frame->header, CINET_HEADER_LENGTH);
+        crc = cinet_crc32c(crc, payload, len);
+        cinet_set_ulong(frame->checksum, 0, crc);
+    }
+
+    batch->pending += cinet_msg_batch_frame_size(frame);
+
+    return frame;
+}
+
+gint cinet_msg_batch_add_msg(CINetMsgBatch *batch, CINetMsg *msg, guint32 flags)
+{
+    CINetCodec *codec = cinet_codec_get_default();
+    CINetMsgBatchFrame *frame;
+    CINetWriter out;
+    gint rc;
+
+    if (!batch || !msg || (flags & ~CINET_MSG_FLAGS_SUPPORTED))
         return -1;
 
-    parser = json_parser_new();
-    if (!json_parser_load_from_data(parser, &buffer[off], len-off, NULL)) {
-        g_object_unref(parser);
+    cinet_writer_init(&out, batch->payloads, NULL, 0);
+    rc = cinet_msg_build_payload(codec, msg, &out, &flags);
+
+    if (rc != 0 || out.len > G_MAXUINT32 - CINET_CHECKSUM_LENGTH) {
+        g_string_truncate(batch->payloads, out.base);
+        codec->stats.errors++;
         return -1;
     }
 
-    root = json_parser_get_root(parser);
+    frame = cinet_msg_batch_add_frame(batch, msg->msgtype, flags,
+                                      &batch->payloads->str[out.base], out.len);
+    frame->payload = NULL;
+    frame->offset = out.base;
+
+    codec->stats.msgs_written++;
+    codec->stats.bytes_written += cinet_msg_batch_frame_size(frame);
 
-    *msg = cinet_msg_read(header.msgtype, root);
+    return 0;
+}
 
-    g_object_unref(parser);
+gint cinet_msg_batch_add_payload(CINetMsgBatch *batch, CINetMsgType msgtype, guint32 flags,
+                                 const gchar *payload, gsize len)
+{
+    CINetMsgBatchFrame *frame;
 
-    if (*msg)
+    if (!batch || (!payload && len) || len > G_MAXUINT32 - CINET_CHECKSUM_LENGTH)
+        return -1;
+
+    frame = cinet_msg_batch_add_frame(batch, msgtype, flags, payload, len);
+    frame->payload = payload;
+    frame->offset = 0;
+
+    return 0;
+}
+
+gint cinet_msg_batch_add_bytes(CINetMsgBatch *batch, GBytes *frame)
+{
+    CINetMsgBatchFrame *entry;
+
+    if (!batch || !frame || g_bytes_get_size(frame) < CINET_HEADER_LENGTH)
+        return -1;
+
+    g_array_set_size(batch->frames, batch->frames->len + 1);
+    entry = &g_array_index(batch->frames, CINetMsgBatchFrame, batch->frames->len - 1);
+    entry->bytes = g_bytes_ref(frame);
+    batch->pending += g_bytes_get_size(frame);
+
+    return 0;
+}
+
+guint cinet_msg_batch_get_vectors(CINetMsgBatch *batch, CINetIOVector *vectors, guint n)
+{
+    CINetMsgBatchFrame *frame;
+    gsize offset;
+    guint i, count = 0;
+
+    if (!batch || !vectors)
         return 0;
-    return -1;
+
+    offset = batch->offset;
+    for (i = batch->frame; i < batch->frames->len && count < n; ++i) {
+        frame = &g_array_index(batch->frames, CINetMsgBatchFrame, i);
+        if (frame->bytes) {
+            vectors[count].buffer = (const gchar*)g_bytes_get_data(frame->bytes, NULL) + offset;
+            vectors[count].size = g_bytes_get_size(frame->bytes) - offset;
+            ++count;
+            offset = 0;
+            continue;
+        }
+
+        if (offset < CINET_HEADER_LENGTH) {
+            vectors[count].buffer = &frame->header[offset];
+            vectors[count].size = CINET_HEADER_LENGTH - offset;
+            ++count;
+            offset = 0;
+        }
+        else
+            offset -= CINET_HEADER_LENGTH;
+
+        if (frame->len > offset) {
+            if (count < n) {
+                vectors[count].buffer = (frame->payload ? frame->payload : &batch->payloads->str[frame->offset]) + offset;
+                vectors[count].size = frame->len - offset;
+                ++count;
+            }
+            offset = 0;
+        }
+        else
+            offset -= frame->len;
+
+        if (frame->checksum_len > offset && count < n) {
+            vectors[count].buffer = &frame->checksum[offset];
+            vectors[count].size = frame->checksum_len - offset;
+            ++count;
+        }
+        offset = 0;
+    }
+
+    return count;
 }
 
-CINetMsg *cinet_message_new_va(CINetMsgType msgtype, va_list args)
+gsize cinet_msg_batch_get_pending(CINetMsgBatch *batch)
+{
+    return batch ? batch->pending : 0;
+}
+
+void cinet_msg_batch_consume(CINetMsgBatch *batch, gsize len)
+{
+    CINetMsgBatchFrame *frame;
+    gsize rest;
+
+    if (batch == NULL)
+        return;
+
+    len = MIN(len, batch->pending);
+    batch->pending -= len;
+
+    while (len > 0) {
+        frame = &g_array_index(batch->frames, CINetMsgBatchFrame, batch->frame);
+        rest = cinet_msg_batch_frame_size(frame) - batch->offset;
+        if (len < rest) {
+            batch->offset += len;
+            break;
+        }
+        len -= rest;
+        /* Shared frames are released as soon as possible. */
+        cinet_msg_batch_frame_clear(frame);
+        ++batch->frame;
+        batch->offset = 0;
+    }
+
+    /* Everything is written, start over. */
+    if (batch->pending == 0)
+        cinet_msg_batch_clear(batch);
+}
+
+/* Large enough to hold any message. */
+typedef union {
+    CINetMsg msg;
+    CINetMsgVersion version;
+    CINetMsgEventRing event_ring;
+    CINetMsgEventCall event_call;
+    CINetMsgDbNumCalls db_num_calls;
+    CINetMsgDbCallList db_call_list;
+    CINetMsgDbGetCaller db_get_caller;
+    CINetMsgDbAddCaller db_add_caller;
+    CINetMsgDbDelCaller db_del_caller;
+    CINetMsgDbGetCallerList db_get_caller_list;
+} CINetMsgStorage;
+
+static void cinet_message_set_values_va(CINetMsg *msg, va_list args)
 {
-    CINetMsg *msg = cinet_msg_alloc(msgtype);
-    struct CINetMsgClass *cls = cinet_msg_type_get_class(msgtype);
     gchar *key;
     gpointer val;
 
+    if (!cinet_msg_get_class(msg))
+        return;
+
+    do {
+        key = va_arg(args, gchar*);
+        val = va_arg(args, gpointer);
+        if (key)
+            cinet_message_set_field(msg, cinet_msg_field_lookup(key), val);
+    } while (key);
+}
+
+CINetMsg *cinet_message_new_va(CINetMsgType msgtype, va_list args)
+{
+    CINetMsg *msg = cinet_msg_alloc(msgtype);
+
     if (!msg)
         return NULL;
 
-    if (cls) {
-        do {
-            key = va_arg(args, gchar*);
-            val = va_arg(args, gpointer);
-            if (key) {
-                if (!g_strcmp0(key, "guid"))
-                    cinet_message_set_value(msg, key, val);
-                else if (cls->msg_set_value)
-                    cls->msg_set_value(msg, key, val);
-            }
-        } while (key);
-    }
+    cinet_message_set_values_va(msg, args);
 
     return msg;
 }
@@ -325,212 +3164,546 @@ gint cinet_message_new_for_data(gchar **buffer, gsize *len, guint msgtype, ...)
     return rc;
 }
 
+gssize cinet_message_new_for_buffer(gchar *buffer, gsize size, guint32 flags, guint msgtype, ...)
+{
+    struct CINetMsgClass *cls = cinet_msg_type_get_class(msgtype);
+    CINetMsgStorage storage;
+    CINetMsgField field;
+    gchar *key;
+    gpointer val;
+    va_list ap;
+    gssize rc;
+
+    if (!cls || cls->size == 0 || cls->size > sizeof(storage))
+        return -1;
+
+    /* The message only lives for the call, so keep it on the stack and let
+     * it point to the strings of the caller. */
+    memset(&storage, 0, cls->size);
+    storage.msg.msgtype = msgtype;
+
+    va_start(ap, msgtype);
+    while ((key = va_arg(ap, gchar*)) != NULL) {
+        val = va_arg(ap, gpointer);
+        field = cinet_msg_field_lookup(key);
+        if (!cls->schema || !cinet_schema_borrow_string(cls->schema, &storage.msg, field, val))
+            cinet_message_set_field(&storage.msg, field, val);
+    }
+    va_end(ap);
+
+    rc = cinet_msg_write_msg_to_buffer(buffer, size, &storage.msg, flags);
+
+    /* Entries set for lists belong to the message. */
+    if (cls->schema) {
+        cinet_schema_forget_strings(cls->schema, &storage.msg);
+        cinet_schema_free(&storage.msg, cls->schema, &storage.msg);
+    }
+
+    return rc;
+}
+
 void cinet_message_set_value(CINetMsg *msg, const gchar *key, const gpointer value)
+{
+    if (key)
+        cinet_message_set_field(msg, cinet_msg_field_lookup(key), value);
+}
+
+void cinet_message_set_field(CINetMsg *msg, CINetMsgField field, const gpointer value)
 {
     struct CINetMsgClass *cls = cinet_msg_get_class(msg);
-    if (!cls || !key)
+
+    g_return_if_fail(!cinet_msg_is_shared(msg));
+
+    if (!cls || field == CI_NET_FIELD_UNKNOWN)
         return;
-    if (g_strcmp0(key, "guid") == 0)
+    if (field == CI_NET_FIELD_GUID)
         msg->guid = GPOINTER_TO_UINT(value);
-    else if (cls->msg_set_value)
-        cls->msg_set_value(msg, key, value);
+    else if (cls->schema)
+        cinet_schema_set_field(msg, cls->schema, msg, field, value);
 }
 
-JsonNode *cinet_msg_version_build(CINetMsg *msg)
+void cinet_message_set_int(CINetMsg *msg, CINetMsgField field, gint value)
 {
-    CINetMsgVersion *cmsg = (CINetMsgVersion*)msg;
-    JsonBuilder *builder = json_builder_new();
-    JsonNode *root;
-
-    json_builder_begin_object(builder);
+    cinet_message_set_field(msg, field, GINT_TO_POINTER(value));
+}
 
-    json_builder_set_member_name(builder, "guid");
-    json_builder_add_int_value(builder, msg->guid);
+void cinet_message_set_string(CINetMsg *msg, CINetMsgField field, const gchar *value)
+{
+    cinet_message_set_field(msg, field, (const gpointer)value);
+}
 
-    json_builder_set_member_name(builder, "major");
-    json_builder_add_int_value(builder, cmsg->major);
+static const CINetSchema *cinet_schema_get_nested(const CINetSchemaField *f)
+{
+    switch (f->kind) {
+        case CINET_KIND_CALL_INFO:
+        case CINET_KIND_CALL_LIST:
+            return &cinet_call_info_schema;
+        case CINET_KIND_CALLER_INFO:
+        case CINET_KIND_CALLER_LIST:
+            return &cinet_caller_info_schema;
+        default:
+            return NULL;
+    }
+}
 
-    json_builder_set_member_name(builder, "minor");
-    json_builder_add_int_value(builder, cmsg->minor);
+/* Number of binary field numbers used by a member. Lists use one for the
+ * records and one for the columns. */
+static guint cinet_schema_field_count(const CINetSchemaField *f)
+{
+    if (CINET_KIND_IS_INFO(f->kind))
+        return cinet_schema_get_nested(f)->n_fields;
+    if (CINET_KIND_IS_LIST(f->kind))
+        return 2;
+    return 1;
+}
 
-    json_builder_set_member_name(builder, "patch");
-    json_builder_add_int_value(builder, cmsg->patch);
+static const CINetSchemaField *cinet_schema_find(const CINetSchema *schema, CINetMsgField field)
+{
+    guint i;
 
-    json_builder_set_member_name(builder, "human_readable");
-    json_builder_add_string_value(builder, cmsg->human_readable != NULL ?
-                                  cmsg->human_readable : "");
-    json_builder_end_object(builder);
+    for (i = 0; i < schema->n_fields; ++i) {
+        if (schema->fields[i].field == field)
+            return &schema->fields[i];
+    }
+    return NULL;
+}
 
-    root = json_builder_get_root(builder);
+/* In a @CICallInfo update the flag of the string @f after it was set. */
+static inline void cinet_schema_update_flag(const CINetSchema *schema, gpointer data,
+                                            const CINetSchemaField *f, const gchar *value)
+{
+    if (schema->fields_offset >= 0) {
+        if (value)
+            G_STRUCT_MEMBER(guint32, data, schema->fields_offset) |= f->flag;
+        else
+            G_STRUCT_MEMBER(guint32, data, schema->fields_offset) &= ~f->flag;
+    }
+}
 
-    g_object_unref(builder);
+/* Set the string @f of @data. The string is allocated in @arena if given.
+ * In a @CICallInfo the flag of the member is updated. */
+static void cinet_schema_set_string(CINetMsg *msg, const CINetSchema *schema, gpointer data,
+                                    const CINetSchemaField *f, const gchar *value, CINetArena *arena)
+{
+    gchar **str = &CINET_FIELD_STRING(data, f);
 
-    return root;
+    cinet_msg_free_string(msg, *str);
+    *str = cinet_arena_strdup(arena, value);
+    cinet_schema_update_flag(schema, data, f, value);
 }
 
-CINetMsg *cinet_msg_version_read(JsonNode *root)
+/* Let the string member @field of @data or of an embedded object point to
+ * @value without copying it. Only for data which is gone before @value, the
+ * strings have to be dropped with @cinet_schema_forget_strings() then.
+ *
+ * @return: TRUE if @field is such a string member.
+ */
+static gboolean cinet_schema_borrow_string(const CINetSchema *schema, gpointer data,
+                                           CINetMsgField field, const gchar *value)
 {
-    if (!JSON_NODE_HOLDS_OBJECT(root))
-        return NULL;
-
-    CINetMsgVersion *msg = cinet_msg_alloc(CI_NET_MSG_VERSION);
+    const CINetSchemaField *f;
+    guint i;
+
+    for (i = 0; i < schema->n_fields; ++i) {
+        f = &schema->fields[i];
+        if (CINET_KIND_IS_INFO(f->kind) && cinet_schema_find(cinet_schema_get_nested(f), field) != NULL)
+            return cinet_schema_borrow_string(cinet_schema_get_nested(f), CINET_FIELD_P(data, f), field, value);
+        if (f->field == field && f->kind == CINET_KIND_STRING) {
+            CINET_FIELD_STRING(data, f) = (gchar*)value;
+            cinet_schema_update_flag(schema, data, f, value);
+            return TRUE;
+        }
+    }
 
-    JsonObject *obj = json_node_get_object(root);
-    ((CINetMsg*)msg)->guid = (guint32)json_object_get_int_member(obj, "guid");
+    return FALSE;
+}
 
-    msg->major = (guint32)json_object_get_int_member(obj, "major");
-    msg->minor = (guint32)json_object_get_int_member(obj, "minor");
-    msg->patch = (guint32)json_object_get_int_member(obj, "patch");
-    msg->human_readable = g_strdup(json_object_get_string_member(obj, "human_readable"));
+/* Drop the strings of @data and its embedded objects without freeing them. */
+static void cinet_schema_forget_strings(const CINetSchema *schema, gpointer data)
+{
+    const CINetSchemaField *f;
+    guint i;
+
+    for (i = 0; i < schema->n_fields; ++i) {
+        f = &schema->fields[i];
+        if (f->kind == CINET_KIND_STRING)
+            CINET_FIELD_STRING(data, f) = NULL;
+        else if (CINET_KIND_IS_INFO(f->kind))
+            cinet_schema_forget_strings(cinet_schema_get_nested(f), CINET_FIELD_P(data, f));
+    }
+}
 
-    return (CINetMsg*)msg;
+static void cinet_schema_copy(const CINetSchema *schema, gpointer dst, gconstpointer src)
+{
+    const CINetSchemaField *f;
+    guint i;
+
+    for (i = 0; i < schema->n_fields; ++i) {
+        f = &schema->fields[i];
+        if (f->kind == CINET_KIND_INT)
+            CINET_FIELD_INT(dst, f) = CINET_FIELD_INT(src, f);
+        else if (f->kind == CINET_KIND_STRING) {
+            cinet_msg_free_string(NULL, CINET_FIELD_STRING(dst, f));
+            CINET_FIELD_STRING(dst, f) = g_strdup(CINET_FIELD_STRING(src, f));
+        }
+    }
+    if (schema->fields_offset >= 0)
+        G_STRUCT_MEMBER(guint32, dst, schema->fields_offset) = G_STRUCT_MEMBER(guint32, src, schema->fields_offset);
 }
 
-void cinet_msg_version_set_value(CINetMsg *msg, const gchar *key, const gpointer value)
+/* Free a list of entries described by @schema. Entries, nodes and strings
+ * in the arena of @msg are left to the arena. */
+static void cinet_schema_free_list(CINetMsg *msg, const CINetSchema *schema, GList *list)
 {
-    if (!msg || !key || msg->msgtype != CI_NET_MSG_VERSION)
-        return;
-    CINetMsgVersion *cmsg = (CINetMsgVersion*)msg; 
-    if (!strcmp(key, "major"))
-        cmsg->major = GPOINTER_TO_INT(value);
-    if (!strcmp(key, "minor"))
-        cmsg->minor = GPOINTER_TO_INT(value);
-    if (!strcmp(key, "patch"))
-        cmsg->patch = GPOINTER_TO_INT(value);
-    if (!strcmp(key, "human_readable")) {
-        g_free(cmsg->human_readable);
-        cmsg->human_readable = g_strdup((const gchar*)value);
+    CINetArena *arena = cinet_msg_get_arena(msg);
+    GList *next;
+
+    for (; list != NULL; list = next) {
+        next = list->next;
+        if (list->data != NULL) {
+            cinet_schema_free(msg, schema, list->data);
+            if (!cinet_arena_contains(arena, list->data))
+                g_free(list->data);
+        }
+        if (!cinet_arena_contains(arena, list))
+            g_list_free_1(list);
     }
 }
 
-void cinet_msg_version_free(CINetMsg *msg)
+static void cinet_schema_free(CINetMsg *msg, const CINetSchema *schema, gpointer data)
 {
-    CINetMsgVersion *cmsg = (CINetMsgVersion*)msg;
-    g_free(cmsg->human_readable);
+    const CINetSchemaField *f;
+    guint i;
+
+    for (i = 0; i < schema->n_fields; ++i) {
+        f = &schema->fields[i];
+        switch (f->kind) {
+            case CINET_KIND_STRING:
+                cinet_msg_free_string(msg, CINET_FIELD_STRING(data, f));
+                break;
+            case CINET_KIND_CALL_INFO:
+            case CINET_KIND_CALLER_INFO:
+                cinet_schema_free(msg, cinet_schema_get_nested(f), CINET_FIELD_P(data, f));
+                break;
+            case CINET_KIND_CALL_LIST:
+            case CINET_KIND_CALLER_LIST:
+                cinet_schema_free_list(msg, cinet_schema_get_nested(f), CINET_FIELD_LIST(data, f));
+                break;
+            default:
+                break;
+        }
+    }
 }
 
-void cinet_call_info_build(CICallInfo *info, JsonBuilder *builder)
+/* Set a member by its field id. Members of embedded objects are set in
+ * the object, for lists the id of an entry appends it to the list. The list
+ * takes ownership of the entry. */
+static void cinet_schema_set_field(CINetMsg *msg, const CINetSchema *schema, gpointer data,
+                                   CINetMsgField field, const gpointer value)
 {
-    if (info == NULL || builder == NULL)
+    const CINetSchemaField *f;
+    guint i;
+
+    for (i = 0; i < schema->n_fields; ++i) {
+        f = &schema->fields[i];
+        if (CINET_KIND_IS_INFO(f->kind)) {
+            if (cinet_schema_find(cinet_schema_get_nested(f), field) != NULL) {
+                cinet_schema_set_field(msg, cinet_schema_get_nested(f), CINET_FIELD_P(data, f), field, value);
+                return;
+            }
+            continue;
+        }
+        if (CINET_KIND_IS_LIST(f->kind)) {
+            if (field == (f->kind == CINET_KIND_CALL_LIST ? CI_NET_FIELD_CALL : CI_NET_FIELD_CALLER)) {
+                if (value != NULL)
+                    CINET_FIELD_LIST(data, f) = g_list_append(CINET_FIELD_LIST(data, f), value);
+                return;
+            }
+            continue;
+        }
+        if (f->field != field)
+            continue;
+
+        switch (f->kind) {
+            case CINET_KIND_INT:
+                CINET_FIELD_INT(data, f) = GPOINTER_TO_INT(value);
+                break;
+            case CINET_KIND_UINT:
+                CINET_FIELD_UINT(data, f) = GPOINTER_TO_UINT(value);
+                break;
+            case CINET_KIND_STRING:
+                cinet_schema_set_string(msg, schema, data, f, (const gchar*)value, NULL);
+                break;
+            case CINET_KIND_MSGID:
+                g_strlcpy(CINET_FIELD_P(data, f), value, 15);
+                break;
+        }
         return;
+    }
+}
 
-    json_builder_set_member_name(builder, "id");
-    json_builder_add_int_value(builder, info->id);
+static void cinet_schema_build(const CINetSchema *schema, gconstpointer data, CINetWriter *out)
+{
+    const CINetSchemaField *f;
+    const gchar *str;
+    GList *tmp;
+    gint64 value;
+    guint i;
+
+    for (i = 0; i < schema->n_fields; ++i) {
+        f = &schema->fields[i];
+        switch (f->kind) {
+            case CINET_KIND_INT:
+            case CINET_KIND_UINT:
+                if (f->kind == CINET_KIND_INT)
+                    value = CINET_FIELD_INT(data, f);
+                else
+                    value = CINET_FIELD_UINT(data, f);
+                /* Optional members are only sent if set so that older peers see
+                 * the same message as before. */
+                if (value || f->option != CINET_OPTION_OMIT)
+                    cinet_json_add_int_member(out, f->name, value);
+                break;
+            case CINET_KIND_STRING:
+                if ((str = CINET_FIELD_STRING(data, f)) == NULL && f->option == CINET_OPTION_OMIT)
+                    break;
+                if (str == NULL && f->option == CINET_OPTION_EMPTY)
+                    str = "";
+                cinet_json_add_string_member(out, f->name, str);
+                break;
+            case CINET_KIND_MSGID:
+                str = CINET_FIELD_P(data, f);
+                if (str[0] == '\0' && f->option == CINET_OPTION_OMIT)
+                    break;
+                cinet_json_add_member_name(out, f->name);
+                cinet_json_add_string_len(out, str, strnlen(str, 16));
+                break;
+            case CINET_KIND_CALL_INFO:
+            case CINET_KIND_CALLER_INFO:
+                cinet_schema_build(cinet_schema_get_nested(f), CINET_FIELD_P(data, f), out);
+                break;
+            case CINET_KIND_CALL_LIST:
+            case CINET_KIND_CALLER_LIST:
+                cinet_json_add_member_name(out, f->name);
+                cinet_writer_append_c(out, '[');
+                for (tmp = CINET_FIELD_LIST(data, f); tmp != NULL; tmp = g_list_next(tmp)) {
+                    if (tmp != CINET_FIELD_LIST(data, f))
+                        cinet_writer_append_c(out, ',');
+                    cinet_writer_append_c(out, '{');
+                    cinet_schema_build(cinet_schema_get_nested(f), tmp->data, out);
+                    cinet_writer_append_c(out, '}');
+                }
+                cinet_writer_append_c(out, ']');
+                break;
+        }
+    }
+}
 
-#define MSG_BUILD_STR(arg) do {\
-    if (info->arg) {\
-        json_builder_set_member_name(builder, #arg);\
-        json_builder_add_string_value(builder, info->arg);\
-    }\
-} while (0)
+/* Adapters for reading list entries. */
+static gboolean cinet_call_info_read(gpointer info, CINetMsgField field, CINetJsonReader *reader)
+{
+    return cinet_schema_read(NULL, &cinet_call_info_schema, info, field, reader);
+}
 
-    MSG_BUILD_STR(completenumber);
-    MSG_BUILD_STR(areacode);
-    MSG_BUILD_STR(number);
-    MSG_BUILD_STR(date);
-    MSG_BUILD_STR(time);
-    MSG_BUILD_STR(msn);
-    MSG_BUILD_STR(alias);
-    MSG_BUILD_STR(area);
-    MSG_BUILD_STR(name);
-#undef MSG_BUILD_STR
+static gboolean cinet_caller_info_read(gpointer info, CINetMsgField field, CINetJsonReader *reader)
+{
+    return cinet_schema_read(NULL, &cinet_caller_info_schema, info, field, reader);
 }
 
-void cinet_call_info_read(CICallInfo *info, JsonObject *obj)
+static void cinet_schema_read_list(CINetMsg *msg, const CINetSchemaField *f, GList **list,
+                                   CINetJsonReader *reader)
 {
-    if (info == NULL || obj == NULL)
-        return;
+    const CINetSchema *schema = cinet_schema_get_nested(f);
+    gpointer info;
+    gint count = 0;
 
-    if (json_object_has_member(obj, "id"))
-        cinet_call_info_set_value(info, "id",
-                GINT_TO_POINTER(json_object_get_int_member(obj, "id")));
+    cinet_schema_free_list(msg, schema, *list);
+    *list = NULL;
 
-#define MSG_STR_SET(arg) do {\
-    if (json_object_has_member(obj, arg)) \
-        cinet_call_info_set_value(info, arg, (const gpointer)json_object_get_string_member(obj, arg));\
-    } while (0)
+    if (!cinet_json_begin_array(reader))
+        return;
 
-    MSG_STR_SET("msgid");
-    MSG_STR_SET("completenumber");
-    MSG_STR_SET("areacode");
-    MSG_STR_SET("number");
-    MSG_STR_SET("date");
-    MSG_STR_SET("time");
-    MSG_STR_SET("msn");
-    MSG_STR_SET("alias");
-    MSG_STR_SET("area");
-    MSG_STR_SET("name");
+    while (cinet_json_next_element(reader, &count)) {
+        info = cinet_schema_alloc(schema, reader->arena);
+        *list = cinet_list_prepend(*list, info, reader->arena);
+        cinet_json_read_object(reader, info, f->kind == CINET_KIND_CALL_LIST ?
+                               cinet_call_info_read : cinet_caller_info_read);
+    }
 
-#undef MSG_STR_SET
+    *list = g_list_reverse(*list);
 }
 
-void cinet_caller_info_build(CICallerInfo *info, JsonBuilder *builder)
+static gboolean cinet_schema_read(CINetMsg *msg, const CINetSchema *schema, gpointer data,
+                                  CINetMsgField field, CINetJsonReader *reader)
 {
-    if (info == NULL || builder == NULL)
-        return;
+    const CINetSchemaField *f;
+    const gchar *str;
+    guint i;
+
+    for (i = 0; i < schema->n_fields; ++i) {
+        f = &schema->fields[i];
+        if (CINET_KIND_IS_INFO(f->kind)) {
+            if (cinet_schema_read(msg, cinet_schema_get_nested(f), CINET_FIELD_P(data, f), field, reader))
+                return TRUE;
+            continue;
+        }
+        if (f->field != field)
+            continue;
+
+        switch (f->kind) {
+            case CINET_KIND_INT:
+                CINET_FIELD_INT(data, f) = (gint)cinet_json_read_int(reader);
+                break;
+            case CINET_KIND_UINT:
+                CINET_FIELD_UINT(data, f) = (guint32)cinet_json_read_int(reader);
+                break;
+            case CINET_KIND_STRING:
+                cinet_schema_set_string(msg, schema, data, f, cinet_json_read_string(reader), reader->arena);
+                break;
+            case CINET_KIND_MSGID:
+                if ((str = cinet_json_read_string(reader)) != NULL)
+                    g_strlcpy(CINET_FIELD_P(data, f), str, 15);
+                break;
+            case CINET_KIND_CALL_LIST:
+            case CINET_KIND_CALLER_LIST:
+                cinet_schema_read_list(msg, f, &CINET_FIELD_LIST(data, f), reader);
+                break;
+        }
+        return TRUE;
+    }
 
-#define MSG_BUILD_STR(arg) do {\
-    if (info->arg) {\
-        json_builder_set_member_name(builder, #arg);\
-        json_builder_add_string_value(builder, info->arg);\
-    }\
-} while (0)
+    return FALSE;
+}
 
-    MSG_BUILD_STR(number);
-    MSG_BUILD_STR(name);
+/* Write the members of @data numbered from @field. Returns the number
+ * following the last member. */
+static guint cinet_schema_build_binary(const CINetSchema *schema, gconstpointer data, CINetWriter *out,
+                                       guint field)
+{
+    const CINetSchemaField *f;
+    const gchar *str;
+    GList *tmp;
+    gsize pos;
+    guint i;
+
+    for (i = 0; i < schema->n_fields; ++i) {
+        f = &schema->fields[i];
+        switch (f->kind) {
+            case CINET_KIND_INT:
+                cinet_bin_add_int_field(out, field, CINET_FIELD_INT(data, f));
+                break;
+            case CINET_KIND_UINT:
+                cinet_bin_add_uint_field(out, field, CINET_FIELD_UINT(data, f));
+                break;
+            case CINET_KIND_STRING:
+                cinet_bin_add_string_field(out, field, CINET_FIELD_STRING(data, f));
+                break;
+            case CINET_KIND_MSGID:
+                str = CINET_FIELD_P(data, f);
+                if (str[0] != '\0' || f->option != CINET_OPTION_OMIT)
+                    cinet_bin_add_string_field_len(out, field, str, strnlen(str, 16));
+                break;
+            case CINET_KIND_CALL_INFO:
+            case CINET_KIND_CALLER_INFO:
+                cinet_schema_build_binary(cinet_schema_get_nested(f), CINET_FIELD_P(data, f), out, field);
+                break;
+            case CINET_KIND_CALL_LIST:
+            case CINET_KIND_CALLER_LIST:
+                if (out->flags & CI_NET_MSG_FLAG_COLUMNS) {
+                    if (CINET_FIELD_LIST(data, f))
+                        cinet_bin_add_columns(out, field + 1, CINET_FIELD_LIST(data, f), cinet_schema_get_nested(f));
+                    break;
+                }
+                for (tmp = CINET_FIELD_LIST(data, f); tmp != NULL; tmp = g_list_next(tmp)) {
+                    pos = cinet_bin_begin_record(out, field);
+                    cinet_schema_build_binary(cinet_schema_get_nested(f), tmp->data, out, 1);
+                    cinet_bin_end_record(out, pos);
+                }
+                break;
+        }
+        field += cinet_schema_field_count(f);
+    }
 
-#undef MSG_BUILD_STR
+    return field;
 }
 
-void cinet_caller_info_read(CICallerInfo *info, JsonObject *obj)
+/* Adapters for reading list entries which start at field 1. */
+static gboolean cinet_call_info_read_record(gpointer info, guint field, CINetBinReader *reader)
 {
-    if (info == NULL || obj == NULL)
-        return;
+    return cinet_schema_read_binary(NULL, &cinet_call_info_schema, info, field, 1, reader);
+}
 
-#define MSG_STR_SET(arg) do {\
-    if (json_object_has_member(obj, #arg))\
-        cinet_caller_info_set_value(info, #arg, (const gpointer)json_object_get_string_member(obj, #arg));\
-    } while (0)
+static gboolean cinet_caller_info_read_record(gpointer info, guint field, CINetBinReader *reader)
+{
+    return cinet_schema_read_binary(NULL, &cinet_caller_info_schema, info, field, 1, reader);
+}
 
-    MSG_STR_SET(number);
-    MSG_STR_SET(name);
+/* Read @field of @data whose members are numbered from @base. List entries
+ * are prepended, the lists have to be reversed once the message is complete. */
+static gboolean cinet_schema_read_binary(CINetMsg *msg, const CINetSchema *schema, gpointer data,
+                                         guint field, guint base, CINetBinReader *reader)
+{
+    const CINetSchemaField *f;
+    const gchar *str;
+    gpointer info;
+    guint i;
+
+    if (field < base)
+        return FALSE;
+
+    for (i = 0; i < schema->n_fields; ++i) {
+        f = &schema->fields[i];
+        if (field >= base + cinet_schema_field_count(f)) {
+            base += cinet_schema_field_count(f);
+            continue;
+        }
+
+        switch (f->kind) {
+            case CINET_KIND_INT:
+                CINET_FIELD_INT(data, f) = (gint)cinet_bin_read_int(reader);
+                break;
+            case CINET_KIND_UINT:
+                CINET_FIELD_UINT(data, f) = (guint32)cinet_bin_read_uint(reader);
+                break;
+            case CINET_KIND_STRING:
+                cinet_schema_set_string(msg, schema, data, f, cinet_bin_read_string(reader), reader->arena);
+                break;
+            case CINET_KIND_MSGID:
+                if ((str = cinet_bin_read_string(reader)) != NULL)
+                    g_strlcpy(CINET_FIELD_P(data, f), str, 15);
+                break;
+            case CINET_KIND_CALL_INFO:
+            case CINET_KIND_CALLER_INFO:
+                return cinet_schema_read_binary(msg, cinet_schema_get_nested(f), CINET_FIELD_P(data, f),
+                                                field, base, reader);
+            case CINET_KIND_CALL_LIST:
+            case CINET_KIND_CALLER_LIST:
+                if (field == base + 1) {
+                    cinet_bin_read_columns(reader, &CINET_FIELD_LIST(data, f), cinet_schema_get_nested(f));
+                    break;
+                }
+                info = cinet_schema_alloc(cinet_schema_get_nested(f), reader->arena);
+                CINET_FIELD_LIST(data, f) = cinet_list_prepend(CINET_FIELD_LIST(data, f), info, reader->arena);
+                cinet_bin_read_record(reader, info, f->kind == CINET_KIND_CALL_LIST ?
+                                      cinet_call_info_read_record : cinet_caller_info_read_record);
+                break;
+        }
+        return TRUE;
+    }
 
-#undef MSG_STR_SET
+    return FALSE;
 }
 
 void cinet_call_info_set_value(CICallInfo *info, const gchar *key, const gpointer value)
 {
-    if (info == NULL || key == NULL)
-        return;
-    if (!strcmp(key, "id")) {
-        info->id = GPOINTER_TO_INT(value);
-        return;
-    }
-#define MSG_STR_SET(arg, flag) do {\
-    if (!strcmp(key, #arg)) {\
-        g_free(info->arg);\
-        if (value) {\
-            info->arg = g_strdup((const gchar*)value);\
-            info->fields |= flag;\
-        }\
-        else {\
-            info->arg = NULL;\
-            info->fields &= ~flag;\
-        }\
-        return;\
-    }} while(0)
-
-    MSG_STR_SET(completenumber, CIF_COMPLETENUMBER);
-    MSG_STR_SET(areacode, CIF_AREACODE);
-    MSG_STR_SET(number, CIF_NUMBER);
-    MSG_STR_SET(date, CIF_DATE);
-    MSG_STR_SET(time, CIF_TIME);
-    MSG_STR_SET(msn, CIF_MSN);
-    MSG_STR_SET(alias, CIF_ALIAS);
-    MSG_STR_SET(area, CIF_AREA);
-    MSG_STR_SET(name, CIF_NAME);
-
-#undef MSG_STR_SET
+    if (key)
+        cinet_call_info_set_field(info, cinet_msg_field_lookup(key), value);
+}
+
+void cinet_call_info_set_field(CICallInfo *info, CINetMsgField field, const gpointer value)
+{
+    if (info != NULL)
+        cinet_schema_set_field(NULL, &cinet_call_info_schema, info, field, value);
 }
 
 CICallInfo *cinet_call_info_new(void)
@@ -548,34 +3721,69 @@ void cinet_call_info_copy(CICallInfo *dst, CICallInfo *src)
 {
     if (dst == NULL || src == NULL || dst == src)
         return;
-    dst->id = src->id;
-    dst->fields = src->fields;
-#define CPY_STR(arg) do { g_free(dst->arg); dst->arg = g_strdup(src->arg); } while (0)
-    CPY_STR(completenumber);
-    CPY_STR(areacode);
-    CPY_STR(number);
-    CPY_STR(date);
-    CPY_STR(time);
-    CPY_STR(msn);
-    CPY_STR(alias);
-    CPY_STR(area);
-    CPY_STR(name);
-#undef CPY_STR
+    cinet_schema_copy(&cinet_call_info_schema, dst, src);
 }
 
-void cinet_call_info_free(CICallInfo *info)
+void cinet_call_info_merge(CICallInfo *dst, const CICallInfo *src)
+{
+    const CINetSchemaField *f;
+    guint i;
+
+    if (dst == NULL || src == NULL || dst == src)
+        return;
+
+    for (i = 0; i < cinet_call_info_schema.n_fields; ++i) {
+        f = &cinet_call_info_schema.fields[i];
+        if (f->kind == CINET_KIND_INT) {
+            if (CINET_FIELD_INT(src, f) != 0)
+                CINET_FIELD_INT(dst, f) = CINET_FIELD_INT(src, f);
+        }
+        else if (CINET_FIELD_STRING(src, f) != NULL) {
+            cinet_msg_free_string(NULL, CINET_FIELD_STRING(dst, f));
+            CINET_FIELD_STRING(dst, f) = NULL;
+            dst->fields &= ~f->flag;
+            if (CINET_FIELD_STRING(src, f)[0] != '\0') {
+                CINET_FIELD_STRING(dst, f) = g_strdup(CINET_FIELD_STRING(src, f));
+                dst->fields |= f->flag;
+            }
+        }
+    }
+}
+
+void cinet_call_info_diff(CICallInfo *info, const CICallInfo *previous)
 {
-    if (info == NULL)
+    const CINetSchemaField *f;
+    gchar **str;
+    guint i;
+
+    if (info == NULL || previous == NULL || info == previous)
         return;
-    g_free(info->completenumber);
-    g_free(info->areacode);
-    g_free(info->number);
-    g_free(info->date);
-    g_free(info->time);
-    g_free(info->msn);
-    g_free(info->alias);
-    g_free(info->area);
-    g_free(info->name);
+
+    for (i = 0; i < cinet_call_info_schema.n_fields; ++i) {
+        f = &cinet_call_info_schema.fields[i];
+        if (f->kind == CINET_KIND_INT) {
+            if (CINET_FIELD_INT(info, f) == CINET_FIELD_INT(previous, f))
+                CINET_FIELD_INT(info, f) = 0;
+            continue;
+        }
+        str = &CINET_FIELD_STRING(info, f);
+        if (g_strcmp0(*str, CINET_FIELD_STRING(previous, f)) == 0) {
+            cinet_msg_free_string(NULL, *str);
+            *str = NULL;
+            info->fields &= ~f->flag;
+        }
+        else if (*str == NULL) {
+            /* Absent members keep their value, clear it explicitly. */
+            *str = g_strdup("");
+            info->fields |= f->flag;
+        }
+    }
+}
+
+void cinet_call_info_free(CICallInfo *info)
+{
+    if (info != NULL)
+        cinet_schema_free(NULL, &cinet_call_info_schema, info);
 }
 
 void cinet_call_info_free_full(CICallInfo *info)
@@ -597,10 +3805,8 @@ void cinet_caller_info_init(CICallerInfo *info)
 
 void cinet_caller_info_free(CICallerInfo *info)
 {
-    if (info == NULL)
-        return;
-    g_free(info->number);
-    g_free(info->name);
+    if (info != NULL)
+        cinet_schema_free(NULL, &cinet_caller_info_schema, info);
 }
 
 void cinet_caller_info_free_full(CICallerInfo *info)
@@ -613,601 +3819,510 @@ void cinet_caller_info_copy(CICallerInfo *dst, CICallerInfo *src)
 {
     if (dst == NULL || src == NULL || dst == src)
         return;
-
-#define CPY_STR(arg) do { g_free(dst->arg); dst->arg = g_strdup(src->arg); } while (0)
-    CPY_STR(number);
-    CPY_STR(name);
-#undef CPY_STR
+    cinet_schema_copy(&cinet_caller_info_schema, dst, src);
 }
 
 void cinet_caller_info_set_value(CICallerInfo *info, const gchar *key, const gpointer value)
 {
-    if (info == NULL || key == NULL)
-        return;
-#define MSG_STR_SET(arg) do {\
-    if (!strcmp(key, #arg)) {\
-        g_free(info->arg);\
-        if (value)\
-            info->arg = g_strdup((const gchar*)value);\
-        else {\
-            info->arg = NULL;\
-        }\
-        return;\
-    }} while (0)
-
-    MSG_STR_SET(number);
-    MSG_STR_SET(name);
-
-#undef MSG_STR_SET
+    if (key)
+        cinet_caller_info_set_field(info, cinet_msg_field_lookup(key), value);
 }
 
-JsonNode *cinet_msg_event_ring_build(CINetMsg *msg)
+void cinet_caller_info_set_field(CICallerInfo *info, CINetMsgField field, const gpointer value)
 {
-    CINetMsgEventRing *cmsg = (CINetMsgEventRing*)msg;
-    JsonBuilder *builder = json_builder_new();
-    JsonNode *root;
-
-    json_builder_begin_object(builder);
-
-    json_builder_set_member_name(builder, "guid");
-    json_builder_add_int_value(builder, msg->guid);
-
-    json_builder_set_member_name(builder, "stage");
-    json_builder_add_int_value(builder, ((CINetMsgMultipart*)msg)->stage);
-
-    json_builder_set_member_name(builder, "part");
-    json_builder_add_int_value(builder, ((CINetMsgMultipart*)msg)->part);
-
-    json_builder_set_member_name(builder, "msgid");
-    json_builder_add_string_value(builder, ((CINetMsgMultipart*)msg)->msgid);
-
-    cinet_call_info_build(&cmsg->callinfo, builder);
-
-    json_builder_end_object(builder);
-
-    root = json_builder_get_root(builder);
-
-    g_object_unref(builder);
-
-    return root;
+    if (info != NULL)
+        cinet_schema_set_field(NULL, &cinet_caller_info_schema, info, field, value);
 }
 
-CINetMsg *cinet_msg_event_ring_read(JsonNode *root)
+/* Get the list of a message of type @msgtype and the schema of its entries. */
+static GList **cinet_msg_get_list(CINetMsg *msg, CINetMsgType msgtype, const CINetSchema **schema)
 {
-    if (!JSON_NODE_HOLDS_OBJECT(root))
-        return NULL;
-
-    CINetMsgEventRing *msg = cinet_msg_alloc(CI_NET_MSG_EVENT_RING);
-
-    JsonObject *obj = json_node_get_object(root);
-    ((CINetMsg*)msg)->guid = (guint32)json_object_get_int_member(obj, "guid");
-
-    cinet_msg_event_ring_set_value((CINetMsg*)msg, "stage", GINT_TO_POINTER(json_object_get_int_member(obj, "stage")));
-    cinet_msg_event_ring_set_value((CINetMsg*)msg, "part", GINT_TO_POINTER(json_object_get_int_member(obj, "part")));
-
-    if (json_object_has_member(obj, "msgid"))
-        cinet_msg_event_ring_set_value((CINetMsg*)msg, "msgid",
-                (gpointer)json_object_get_string_member(obj, "msgid"));
-
-    cinet_call_info_read(&msg->callinfo, obj);
+    struct CINetMsgClass *cls = cinet_msg_get_class(msg);
+    guint i;
 
-    return (CINetMsg*)msg;
-}
+    if (!cls || msg->msgtype != msgtype || !cls->schema)
+        return NULL;
 
-void cinet_msg_event_ring_set_value(CINetMsg *msg, const gchar *key, const gpointer value)
-{
-    if (!msg || !key || msg->msgtype != CI_NET_MSG_EVENT_RING)
-        return;
-    if (!strcmp(key, "msgid")) {
-        g_strlcpy(((CINetMsgMultipart*)msg)->msgid, value, 15);
-        return;
-    }
-    if (!strcmp(key, "stage")) {
-        ((CINetMsgMultipart*)msg)->stage = GPOINTER_TO_INT(value);
-        return;
+    for (i = 0; i < cls->schema->n_fields; ++i) {
+        if (CINET_KIND_IS_LIST(cls->schema->fields[i].kind)) {
+            *schema = cinet_schema_get_nested(&cls->schema->fields[i]);
+            return &CINET_FIELD_LIST(msg, &cls->schema->fields[i]);
+        }
     }
-    if (!strcmp(key, "part")) {
-        ((CINetMsgMultipart*)msg)->part = GPOINTER_TO_INT(value);
-        return;
-    }
-    
-    cinet_call_info_set_value(&((CINetMsgEventRing*)msg)->callinfo, key, value);
-}
 
-void cinet_msg_event_ring_free(CINetMsg *msg)
-{
-    cinet_call_info_free(&((CINetMsgEventRing*)msg)->callinfo);
+    return NULL;
 }
 
-JsonNode *cinet_msg_event_call_build(CINetMsg *msg)
+static gpointer cinet_msg_list_append(CINetMsg *msg, CINetMsgType msgtype)
 {
-    CINetMsgEventCall *cmsg = (CINetMsgEventCall*)msg;
-    JsonBuilder *builder = json_builder_new();
-    JsonNode *root;
+    const CINetSchema *schema;
+    GList **list = cinet_msg_get_list(msg, msgtype, &schema);
+    gpointer entry;
 
-    json_builder_begin_object(builder);
+    g_return_val_if_fail(!cinet_msg_is_shared(msg), NULL);
 
-    json_builder_set_member_name(builder, "guid");
-    json_builder_add_int_value(builder, msg->guid);
-
-    cinet_call_info_build(&cmsg->callinfo, builder);
-
-    json_builder_end_object(builder);
-
-    root = json_builder_get_root(builder);
+    if (list == NULL)
+        return NULL;
 
-    g_object_unref(builder);
+    entry = g_malloc0(schema->size);
+    *list = g_list_append(*list, entry);
 
-    return root;
+    return entry;
 }
 
-CINetMsg *cinet_msg_event_call_read(JsonNode *root)
+static guint cinet_msg_list_get_length(CINetMsg *msg, CINetMsgType msgtype)
 {
-    if (!JSON_NODE_HOLDS_OBJECT(root))
-        return NULL;
-
-    CINetMsgEventCall *msg = cinet_msg_alloc(CI_NET_MSG_EVENT_CALL);
-
-    JsonObject *obj = json_node_get_object(root);
-    ((CINetMsg*)msg)->guid = (guint32)json_object_get_int_member(obj, "guid");
-
-    cinet_call_info_read(&msg->callinfo, obj);
+    const CINetSchema *schema;
+    GList **list = cinet_msg_get_list(msg, msgtype, &schema);
 
-    return (CINetMsg*)msg;
+    if (list == NULL)
+        return 0;
+    return g_list_length(*list);
 }
 
-void cinet_msg_event_call_set_value(CINetMsg *msg, const gchar *key, const gpointer value)
+CICallInfo *cinet_msg_db_call_list_append(CINetMsg *msg)
 {
-    if (!msg || !key || msg->msgtype != CI_NET_MSG_EVENT_CALL)
-        return;
-    
-    cinet_call_info_set_value(&((CINetMsgEventCall*)msg)->callinfo, key, value);
+    return (CICallInfo*)cinet_msg_list_append(msg, CI_NET_MSG_DB_CALL_LIST);
 }
 
-void cinet_msg_event_call_free(CINetMsg *msg)
+guint cinet_msg_db_call_list_get_length(CINetMsg *msg)
 {
-    cinet_call_info_free(&((CINetMsgEventCall*)msg)->callinfo);
+    return cinet_msg_list_get_length(msg, CI_NET_MSG_DB_CALL_LIST);
 }
 
-JsonNode *cinet_msg_db_num_calls_build(CINetMsg *msg)
+CICallerInfo *cinet_msg_db_get_caller_list_append(CINetMsg *msg)
 {
-    CINetMsgDbNumCalls *cmsg = (CINetMsgDbNumCalls*)msg;
-
-    JsonBuilder *builder = json_builder_new();
-    JsonNode *root;
-
-    json_builder_begin_object(builder);
-
-    json_builder_set_member_name(builder, "guid");
-    json_builder_add_int_value(builder, msg->guid);
-
-    json_builder_set_member_name(builder, "count");
-    json_builder_add_int_value(builder, cmsg->count);
-
-    json_builder_end_object(builder);
-
-    root = json_builder_get_root(builder);
-    g_object_unref(builder);
-
-    return root;
+    return (CICallerInfo*)cinet_msg_list_append(msg, CI_NET_MSG_DB_GET_CALLER_LIST);
 }
 
-CINetMsg *cinet_msg_db_num_calls_read(JsonNode *root)
+guint cinet_msg_db_get_caller_list_get_length(CINetMsg *msg)
 {
-    if (!JSON_NODE_HOLDS_OBJECT(root))
-        return NULL;
-    CINetMsgDbNumCalls *msg = cinet_msg_alloc(CI_NET_MSG_DB_NUM_CALLS);
-
-    JsonObject *obj = json_node_get_object(root);
-    ((CINetMsg*)msg)->guid = (guint32)json_object_get_int_member(obj, "guid");
-
-    cinet_msg_db_num_calls_set_value((CINetMsg*)msg, "count",
-            GINT_TO_POINTER(json_object_get_int_member(obj, "count")));
-
-    return (CINetMsg*)msg;
+    return cinet_msg_list_get_length(msg, CI_NET_MSG_DB_GET_CALLER_LIST);
 }
 
-void cinet_msg_db_num_calls_set_value(CINetMsg *msg, const gchar *key, const gpointer value)
+void cinet_msg_list_builder_init(CINetMsgListBuilder *builder, CINetMsg *msg)
 {
-    if (!msg || !key || msg->msgtype != CI_NET_MSG_DB_NUM_CALLS)
-        return;
+    g_return_if_fail(builder != NULL);
 
-    if (!strcmp(key, "count")) {
-        ((CINetMsgDbNumCalls*)msg)->count = GPOINTER_TO_INT(value);
-        return;
-    }
+    builder->msg = msg;
+    builder->entries = NULL;
 }
 
-JsonNode *cinet_msg_db_call_list_build(CINetMsg *msg)
+static gpointer cinet_msg_list_builder_add(CINetMsgListBuilder *builder, CINetMsgType msgtype)
 {
-    JsonBuilder *builder = json_builder_new();
-    JsonNode *root;
-    GList *tmp;
-
-    CINetMsgDbCallList *cmsg = (CINetMsgDbCallList*)msg;
-
-    json_builder_begin_object(builder);
+    const CINetSchema *schema;
+    gpointer entry;
 
-    json_builder_set_member_name(builder, "guid");
-    json_builder_add_int_value(builder, msg->guid);
+    g_return_val_if_fail(builder != NULL && !cinet_msg_is_shared(builder->msg), NULL);
 
-    json_builder_set_member_name(builder, "user");
-    json_builder_add_int_value(builder, cmsg->user);
-
-    json_builder_set_member_name(builder, "offset");
-    json_builder_add_int_value(builder, cmsg->offset);
-
-    json_builder_set_member_name(builder, "count");
-    json_builder_add_int_value(builder, cmsg->count);
-
-    json_builder_set_member_name(builder, "calls");
-    json_builder_begin_array(builder);
-    for (tmp = cmsg->calls; tmp != NULL; tmp = g_list_next(tmp)) {
-        json_builder_begin_object(builder);
-        cinet_call_info_build((CICallInfo*)tmp->data, builder);
-        json_builder_end_object(builder);
-    }
-    json_builder_end_array(builder);
-
-    json_builder_end_object(builder);
+    if (cinet_msg_get_list(builder->msg, msgtype, &schema) == NULL)
+        return NULL;
 
-    root = json_builder_get_root(builder);
-    g_object_unref(builder);
+    entry = g_malloc0(schema->size);
+    builder->entries = g_list_prepend(builder->entries, entry);
 
-    return root;
+    return entry;
 }
 
-CINetMsg *cinet_msg_db_call_list_read(JsonNode *root)
+CICallInfo *cinet_msg_list_builder_add_call(CINetMsgListBuilder *builder)
 {
-    if (!JSON_NODE_HOLDS_OBJECT(root))
-        return NULL;
-    CINetMsgDbCallList *msg = cinet_msg_alloc(CI_NET_MSG_DB_CALL_LIST);
-
-    JsonObject *obj = json_node_get_object(root);
-
-    ((CINetMsg*)msg)->guid = (guint32)json_object_get_int_member(obj, "guid");
-
-    cinet_msg_db_call_list_set_value((CINetMsg*)msg, "user",
-            GINT_TO_POINTER(json_object_get_int_member(obj, "user")));
-    cinet_msg_db_call_list_set_value((CINetMsg*)msg, "offset",
-            GINT_TO_POINTER(json_object_get_int_member(obj, "offset")));
-    cinet_msg_db_call_list_set_value((CINetMsg*)msg, "count",
-            GINT_TO_POINTER(json_object_get_int_member(obj, "count")));
-
-    /* calls=array of cicallinfo objects */
-    JsonArray *arr = json_node_get_array(json_object_get_member(obj, "calls"));
-    GList *calls = json_array_get_elements(arr);
-    GList *tmp;
-    CICallInfo *info;
-
-    for (tmp = calls; tmp != NULL; tmp = g_list_next(tmp)) {
-        info = cinet_call_info_new();
-        cinet_call_info_read(info, json_node_get_object((JsonNode*)tmp->data));
-        msg->calls = g_list_prepend(msg->calls, (gpointer)info);
-    }
-
-    msg->calls = g_list_reverse(msg->calls);
-
-    g_list_free(calls);
+    return (CICallInfo*)cinet_msg_list_builder_add(builder, CI_NET_MSG_DB_CALL_LIST);
+}
 
-    return (CINetMsg*)msg;
+CICallerInfo *cinet_msg_list_builder_add_caller(CINetMsgListBuilder *builder)
+{
+    return (CICallerInfo*)cinet_msg_list_builder_add(builder, CI_NET_MSG_DB_GET_CALLER_LIST);
 }
 
-void cinet_msg_db_call_list_set_value(CINetMsg *msg, const gchar *key, const gpointer value)
+void cinet_msg_list_builder_finish(CINetMsgListBuilder *builder)
 {
-    if (!msg || !key || msg->msgtype != CI_NET_MSG_DB_CALL_LIST)
-        return;
+    const CINetSchema *schema;
+    GList **list;
 
-    if (!strcmp(key, "user")) {
-        ((CINetMsgDbCallList*)msg)->user = GPOINTER_TO_INT(value);
-        return;
-    }
-    if (!strcmp(key, "offset")) {
-        ((CINetMsgDbCallList*)msg)->offset = GPOINTER_TO_INT(value);
-        return;
-    }
-    if (!strcmp(key, "count")) {
-        ((CINetMsgDbCallList*)msg)->count = GPOINTER_TO_INT(value);
+    if (builder == NULL || builder->entries == NULL)
         return;
-    }
-    if (!strcmp(key, "call")) {
-        ((CINetMsgDbCallList*)msg)->calls = g_list_append(
-            ((CINetMsgDbCallList*)msg)->calls, value);
-        return;
-    }
+
+    list = cinet_msg_get_list(builder->msg, builder->msg->msgtype, &schema);
+    *list = g_list_concat(*list, g_list_reverse(builder->entries));
+    builder->entries = NULL;
 }
 
-void cinet_msg_db_call_list_free(CINetMsg *msg)
+/* Encode the current part of a chunked list and pass it to @write. */
+static gint cinet_msg_write_part(CINetMsg *part, GString *frame, guint32 flags,
+                                 CINetFrameFunc write, gpointer userdata)
 {
-    g_list_free_full(((CINetMsgDbCallList*)msg)->calls, (GDestroyNotify)cinet_call_info_free_full);
+    g_string_truncate(frame, 0);
+    if (cinet_msg_append_msg(frame, part, flags) < 0)
+        return -1;
+    return write(frame->str, frame->len, userdata);
 }
 
-JsonNode *cinet_msg_db_get_caller_build(CINetMsg *msg)
+gint cinet_msg_db_call_list_write_parts(CINetMsg *msg, const gchar *msgid, guint max_rows, guint32 flags,
+                                        CINetCallInfoFunc next, CINetFrameFunc write, gpointer userdata)
 {
-    JsonBuilder *builder = json_builder_new();
-    JsonNode *root;
-
-    CINetMsgDbGetCaller *cmsg = (CINetMsgDbGetCaller*)msg;
+    CINetMsgDbCallList *cmsg = (CINetMsgDbCallList*)msg;
+    CINetMsgDbCallList *part;
+    CICallInfo *info;
+    GString *frame;
+    gboolean more = TRUE;
+    guint rows;
+    gint rc = 0;
 
-    json_builder_begin_object(builder);
+    if (msg == NULL || msg->msgtype != CI_NET_MSG_DB_CALL_LIST || msgid == NULL || msgid[0] == '\0' ||
+            next == NULL || write == NULL)
+        return -1;
+    if (max_rows == 0)
+        max_rows = CINET_MSG_PARTS_DEFAULT_ROWS;
+
+    part = (CINetMsgDbCallList*)cinet_msg_alloc(CI_NET_MSG_DB_CALL_LIST);
+    ((CINetMsg*)part)->guid = msg->guid;
+    part->user = cmsg->user;
+    part->offset = cmsg->offset;
+    part->count = cmsg->count;
+    cinet_message_set_string((CINetMsg*)part, CI_NET_FIELD_MSGID, msgid);
+
+    frame = g_string_sized_new(4096);
+
+    /* Only the rows of one part are held at a time. The Init part is sent even
+     * if there are no rows, empty Update parts are not sent. */
+    while (rc == 0 && more) {
+        for (rows = 0; more && rows < max_rows; ++rows) {
+            info = cinet_call_info_new();
+            if (!next(info, userdata)) {
+                cinet_call_info_free_full(info);
+                more = FALSE;
+                break;
+            }
+            part->calls = g_list_prepend(part->calls, info);
+        }
+        part->calls = g_list_reverse(part->calls);
+        if (rows > 0 || part->stage == MultipartStageInit) {
+            rc = cinet_msg_write_part((CINetMsg*)part, frame, flags, write, userdata);
+            part->stage = MultipartStageUpdate;
+            ++part->part;
+        }
+        g_list_free_full(part->calls, (GDestroyNotify)cinet_call_info_free_full);
+        part->calls = NULL;
+    }
 
-    json_builder_set_member_name(builder, "guid");
-    json_builder_add_int_value(builder, msg->guid);
+    if (rc == 0) {
+        part->stage = MultipartStageComplete;
+        rc = cinet_msg_write_part((CINetMsg*)part, frame, flags, write, userdata);
+    }
 
-    json_builder_set_member_name(builder, "user");
-    json_builder_add_int_value(builder, cmsg->user);
+    g_string_free(frame, TRUE);
+    cinet_msg_free((CINetMsg*)part);
 
-    cinet_caller_info_build(&cmsg->caller, builder);
+    return rc;
+}
 
-    json_builder_end_object(builder);
+/* Collects the parts of call lists until they are complete. */
+struct _CINetMsgAssembler {
+    GHashTable *pending;              /* msgid -> CINetMsgAssemblerList [owned] */
+    guint max_rows;
+};
 
-    root = json_builder_get_root(builder);
-    g_object_unref(builder);
+/* An incomplete list. */
+typedef struct {
+    CINetMsgDbCallList *list;         /* Holds the key of the list. [owned] */
+    GList *last;                      /* Last node of the calls of @list. */
+    guint rows;                       /* Number of calls in @list. */
+} CINetMsgAssemblerList;
 
-    return root;
+static void cinet_msg_assembler_list_free(CINetMsgAssemblerList *pending)
+{
+    cinet_msg_free((CINetMsg*)pending->list);
+    g_free(pending);
 }
 
-CINetMsg *cinet_msg_db_get_caller_read(JsonNode *root)
+CINetMsgAssembler *cinet_msg_assembler_new(guint max_rows)
 {
-    if (!JSON_NODE_HOLDS_OBJECT(root))
-        return NULL;
-
-    CINetMsgDbGetCaller *msg = cinet_msg_alloc(CI_NET_MSG_DB_GET_CALLER);
-    
-    JsonObject *obj = json_node_get_object(root);
-
-    ((CINetMsg*)msg)->guid = (guint32)json_object_get_int_member(obj, "guid");
-
-    cinet_msg_db_get_caller_set_value((CINetMsg*)msg, "user", GINT_TO_POINTER(json_object_get_int_member(obj, "user")));
+    CINetMsgAssembler *assembler = g_new0(CINetMsgAssembler, 1);
 
-    cinet_caller_info_read(&msg->caller, obj);
+    /* The key is the msgid of the message. */
+    assembler->pending = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                               (GDestroyNotify)cinet_msg_assembler_list_free);
+    assembler->max_rows = max_rows;
 
-    return (CINetMsg*)msg;
+    return assembler;
 }
 
-void cinet_msg_db_get_caller_set_value(CINetMsg *msg, const gchar *key, const gpointer value)
+void cinet_msg_assembler_free(CINetMsgAssembler *assembler)
 {
-    if (!msg || !key || msg->msgtype != CI_NET_MSG_DB_GET_CALLER)
+    if (assembler == NULL)
         return;
+    g_hash_table_destroy(assembler->pending);
+    g_free(assembler);
+}
 
-    if (!strcmp(key, "user")) {
-        ((CINetMsgDbGetCaller*)msg)->user = GPOINTER_TO_INT(value);
+void cinet_msg_assembler_remove(CINetMsgAssembler *assembler, const gchar *msgid)
+{
+    if (assembler == NULL || msgid == NULL)
         return;
-    }
-
-    cinet_caller_info_set_value(&((CINetMsgDbGetCaller*)msg)->caller, key, value);
+    g_hash_table_remove(assembler->pending, msgid);
 }
 
-void cinet_msg_db_get_caller_free(CINetMsg *msg)
+void cinet_msg_assembler_set_max_rows(CINetMsgAssembler *assembler, guint max_rows)
 {
-    cinet_caller_info_free(&((CINetMsgDbGetCaller*)msg)->caller);
+    if (assembler == NULL)
+        return;
+    assembler->max_rows = max_rows;
 }
 
-JsonNode *cinet_msg_db_add_caller_build(CINetMsg *msg)
+/* Move the calls of @src to the end of the pending list. The calls of a
+ * message decoded into an arena or referenced elsewhere are copied. The list
+ * is not visible outside of the assembler until it is complete, so its last
+ * node can be kept. */
+static void cinet_msg_assembler_move_calls(CINetMsgAssemblerList *pending, CINetMsgDbCallList *src)
 {
-    JsonBuilder *builder = json_builder_new();
-    JsonNode *root;
-
-    CINetMsgDbAddCaller *cmsg = (CINetMsgDbAddCaller*)msg;
-
-    json_builder_begin_object(builder);
-
-    json_builder_set_member_name(builder, "guid");
-    json_builder_add_int_value(builder, msg->guid);
-
-    json_builder_set_member_name(builder, "user");
-    json_builder_add_int_value(builder, cmsg->user);
-
-    cinet_caller_info_build(&cmsg->caller, builder);
-
-    json_builder_end_object(builder);
+    CICallInfo *info;
+    GList *entries = NULL, *tmp;
 
-    root = json_builder_get_root(builder);
-    g_object_unref(builder);
+    if (cinet_msg_get_arena((CINetMsg*)src) == NULL && !cinet_msg_is_shared((CINetMsg*)src)) {
+        entries = src->calls;
+        src->calls = NULL;
+    }
+    else {
+        for (tmp = g_list_last(src->calls); tmp != NULL; tmp = g_list_previous(tmp)) {
+            info = cinet_call_info_new();
+            cinet_call_info_copy(info, tmp->data);
+            entries = g_list_prepend(entries, info);
+        }
+    }
 
-    return root;
+    if (entries == NULL)
+        return;
+    if (pending->last == NULL)
+        pending->list->calls = entries;
+    else {
+        pending->last->next = entries;
+        entries->prev = pending->last;
+    }
+    pending->last = g_list_last(entries);
 }
 
-CINetMsg *cinet_msg_db_add_caller_read(JsonNode *root)
+CINetMsg *cinet_msg_assembler_add(CINetMsgAssembler *assembler, CINetMsg *msg)
 {
-    if (!JSON_NODE_HOLDS_OBJECT(root))
+    CINetMsgDbCallList *part = (CINetMsgDbCallList*)msg;
+    CINetMsgAssemblerList *pending;
+    CINetMsgDbCallList *list;
+    CINetArena *arena;
+    guint rows;
+
+    if (assembler == NULL || msg == NULL || msg->msgtype != CI_NET_MSG_DB_CALL_LIST ||
+            part->msgid[0] == '\0')
+        return msg;
+
+    rows = (guint)cinet_msg_db_call_list_get_length(msg);
+
+    if (part->stage == MultipartStageInit) {
+        /* A new Init part replaces an incomplete list with the same msgid. */
+        if (assembler->max_rows && rows > assembler->max_rows) {
+            g_hash_table_remove(assembler->pending, part->msgid);
+            cinet_msg_free(msg);
+            return NULL;
+        }
+
+        /* A view is only valid until the next frame is received, and a
+         * message referenced elsewhere must not be changed. The list is then
+         * only referenced by the assembler until it is complete. */
+        if (((arena = cinet_msg_get_arena(msg)) != NULL && arena->view.data != NULL) ||
+                cinet_msg_is_shared(msg)) {
+            list = (CINetMsgDbCallList*)cinet_msg_materialize(msg);
+            cinet_msg_free(msg);
+            if (list == NULL)
+                return NULL;
+        }
+        else
+            list = part;
+        pending = g_new(CINetMsgAssemblerList, 1);
+        pending->list = list;
+        pending->last = g_list_last(list->calls);
+        pending->rows = rows;
+        g_hash_table_replace(assembler->pending, list->msgid, pending);
         return NULL;
+    }
 
-    CINetMsgDbAddCaller *msg = cinet_msg_alloc(CI_NET_MSG_DB_ADD_CALLER);
-    
-    JsonObject *obj = json_node_get_object(root);
+    pending = g_hash_table_lookup(assembler->pending, part->msgid);
+    if (pending == NULL) {
+        cinet_msg_free(msg);
+        return NULL;
+    }
+    list = pending->list;
 
-    ((CINetMsg*)msg)->guid = (guint32)json_object_get_int_member(obj, "guid");
+    /* Drop the list if a part is missing or it grows too large. */
+    if (part->part != list->part + 1 ||
+            (assembler->max_rows && pending->rows + rows > assembler->max_rows)) {
+        g_hash_table_remove(assembler->pending, part->msgid);
+        cinet_msg_free(msg);
+        return NULL;
+    }
 
-    cinet_msg_db_add_caller_set_value((CINetMsg*)msg, "user", GINT_TO_POINTER(json_object_get_int_member(obj, "user")));
+    cinet_msg_assembler_move_calls(pending, part);
+    pending->rows += rows;
+    list->part = part->part;
+    list->stage = part->stage;
+    cinet_msg_free(msg);
 
-    cinet_caller_info_read(&msg->caller, obj);
+    if (list->stage != MultipartStageComplete)
+        return NULL;
 
-    return (CINetMsg*)msg;
+    g_hash_table_steal(assembler->pending, list->msgid);
+    g_free(pending);
+    return (CINetMsg*)list;
 }
 
-void cinet_msg_db_add_caller_set_value(CINetMsg *msg, const gchar *key, const gpointer value)
-{
-    if (!msg || !key || msg->msgtype != CI_NET_MSG_DB_ADD_CALLER)
-        return;
-
-    if (!strcmp(key, "user")) {
-        ((CINetMsgDbAddCaller*)msg)->user = GPOINTER_TO_INT(value);
-        return;
-    }
-
-    cinet_caller_info_set_value(&((CINetMsgDbAddCaller*)msg)->caller, key, value);
-}
+/* The merged state of a RING sent in stages. */
+typedef struct {
+    CINetMsgEventRing *state;         /* Owns its strings, holds the key of the session. */
+    gint64 last_seen;                 /* Monotonic time of the last stage received. */
+    GList *link;                      /* Link in the changed sessions or NULL. */
+    gboolean reported;                /* The session was returned at least once. */
+} CINetRingSession;
+
+struct _CINetRingTracker {
+    GHashTable *sessions;             /* msgid -> CINetRingSession */
+    GQueue changed;                   /* Sessions with stages not returned yet, oldest first. */
+    gint64 timeout;                   /* In microseconds. */
+    gboolean delta;                   /* Stages carry only the members that changed. */
+};
 
-void cinet_msg_db_add_caller_free(CINetMsg *msg)
+static void cinet_ring_session_free(CINetRingSession *session)
 {
-    cinet_caller_info_free(&((CINetMsgDbAddCaller*)msg)->caller);
+    cinet_msg_free((CINetMsg*)session->state);
+    g_free(session);
 }
 
-JsonNode *cinet_msg_db_del_caller_build(CINetMsg *msg)
+CINetRingTracker *cinet_ring_tracker_new(guint timeout)
 {
-    JsonBuilder *builder = json_builder_new();
-    JsonNode *root;
-
-    CINetMsgDbDelCaller *cmsg = (CINetMsgDbDelCaller*)msg;
-
-    json_builder_begin_object(builder);
+    CINetRingTracker *tracker = g_new0(CINetRingTracker, 1);
 
-    json_builder_set_member_name(builder, "guid");
-    json_builder_add_int_value(builder, msg->guid);
+    /* The key is the msgid of the state. */
+    tracker->sessions = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                              (GDestroyNotify)cinet_ring_session_free);
+    g_queue_init(&tracker->changed);
+    tracker->timeout = (gint64)(timeout ? timeout : CINET_RING_TRACKER_DEFAULT_TIMEOUT) * G_USEC_PER_SEC;
 
-    json_builder_set_member_name(builder, "user");
-    json_builder_add_int_value(builder, cmsg->user);
-
-    cinet_caller_info_build(&cmsg->caller, builder);
-
-    json_builder_end_object(builder);
-
-    root = json_builder_get_root(builder);
-    g_object_unref(builder);
-
-    return root;
+    return tracker;
 }
 
-CINetMsg *cinet_msg_db_del_caller_read(JsonNode *root)
+void cinet_ring_tracker_free(CINetRingTracker *tracker)
 {
-    if (!JSON_NODE_HOLDS_OBJECT(root))
-        return NULL;
-
-    CINetMsgDbDelCaller *msg = cinet_msg_alloc(CI_NET_MSG_DB_DEL_CALLER);
-    
-    JsonObject *obj = json_node_get_object(root);
-
-    ((CINetMsg*)msg)->guid = (guint32)json_object_get_int_member(obj, "guid");
-
-    cinet_msg_db_del_caller_set_value((CINetMsg*)msg, "user", GINT_TO_POINTER(json_object_get_int_member(obj, "user")));
-
-    cinet_caller_info_read(&msg->caller, obj);
-
-    return (CINetMsg*)msg;
+    if (tracker == NULL)
+        return;
+    g_queue_clear(&tracker->changed);
+    g_hash_table_destroy(tracker->sessions);
+    g_free(tracker);
 }
 
-void cinet_msg_db_del_caller_set_value(CINetMsg *msg, const gchar *key, const gpointer value)
+void cinet_ring_tracker_set_features(CINetRingTracker *tracker, guint32 features)
 {
-    if (!msg || !key || msg->msgtype != CI_NET_MSG_DB_DEL_CALLER)
-        return;
-
-    if (!strcmp(key, "user")) {
-        ((CINetMsgDbDelCaller*)msg)->user = GPOINTER_TO_INT(value);
-        return;
-    }
-
-    cinet_caller_info_set_value(&((CINetMsgDbDelCaller*)msg)->caller, key, value);
+    if (tracker != NULL)
+        tracker->delta = (features & CI_NET_FEATURE_DELTA) != 0;
 }
 
-void cinet_msg_db_del_caller_free(CINetMsg *msg)
+static void cinet_ring_tracker_remove(CINetRingTracker *tracker, CINetRingSession *session)
 {
-    cinet_caller_info_free(&((CINetMsgDbDelCaller*)msg)->caller);
+    if (session->link)
+        g_queue_delete_link(&tracker->changed, session->link);
+    g_hash_table_remove(tracker->sessions, session->state->parent.msgid);
 }
 
-JsonNode *cinet_msg_db_get_caller_list_build(CINetMsg *msg)
+gboolean cinet_ring_tracker_add(CINetRingTracker *tracker, CINetMsg *msg)
 {
-    JsonBuilder *builder = json_builder_new();
-    JsonNode *root;
-    GList *tmp;
-
-    CINetMsgDbGetCallerList *cmsg = (CINetMsgDbGetCallerList*)msg;
-
-    json_builder_begin_object(builder);
-
-    json_builder_set_member_name(builder, "guid");
-    json_builder_add_int_value(builder, msg->guid);
+    CINetMsgEventRing *ring = (CINetMsgEventRing*)msg;
+    CINetRingSession *session;
 
-    json_builder_set_member_name(builder, "user");
-    json_builder_add_int_value(builder, cmsg->user);
+    if (tracker == NULL || msg == NULL || msg->msgtype != CI_NET_MSG_EVENT_RING ||
+            ring->parent.msgid[0] == '\0')
+        return FALSE;
 
-    json_builder_set_member_name(builder, "filter");
-    json_builder_add_string_value(builder, cmsg->filter);
+    session = g_hash_table_lookup(tracker->sessions, ring->parent.msgid);
 
-    json_builder_set_member_name(builder, "callers");
-    json_builder_begin_array(builder);
-    for (tmp = cmsg->callers; tmp != NULL; tmp = g_list_next(tmp)) {
-        json_builder_begin_object(builder);
-        cinet_caller_info_build((CICallerInfo*)tmp->data, builder);
-        json_builder_end_object(builder);
+    /* A new Init reuses the msgid of a session that never completed. */
+    if (session && ring->parent.stage == MultipartStageInit) {
+        cinet_ring_tracker_remove(tracker, session);
+        session = NULL;
     }
-    json_builder_end_array(builder);
 
-    json_builder_end_object(builder);
+    /* Sessions joined late start with the stage received first. */
+    if (session == NULL) {
+        session = g_new0(CINetRingSession, 1);
+        session->state = (CINetMsgEventRing*)cinet_msg_alloc(CI_NET_MSG_EVENT_RING);
+        memcpy(session->state->parent.msgid, ring->parent.msgid, sizeof(ring->parent.msgid));
+        session->state->parent.msgid[sizeof(ring->parent.msgid) - 1] = '\0';
+        g_hash_table_insert(tracker->sessions, session->state->parent.msgid, session);
+    }
 
-    root = json_builder_get_root(builder);
-    g_object_unref(builder);
+    if (tracker->delta)
+        cinet_call_info_merge(&session->state->callinfo, &ring->callinfo);
+    else
+        cinet_call_info_copy(&session->state->callinfo, &ring->callinfo);
+    session->state->parent.parent.guid = msg->guid;
+    session->state->parent.stage = ring->parent.stage;
+    session->state->parent.part = ring->parent.part;
+    session->last_seen = g_get_monotonic_time();
+
+    if (session->link == NULL) {
+        g_queue_push_tail(&tracker->changed, session);
+        session->link = tracker->changed.tail;
+    }
 
-    return root;
+    return TRUE;
 }
 
-CINetMsg *cinet_msg_db_get_caller_list_read(JsonNode *root)
+CINetMsg *cinet_ring_tracker_pop(CINetRingTracker *tracker)
 {
-    if (!JSON_NODE_HOLDS_OBJECT(root))
-        return NULL;
-
-    CINetMsgDbGetCallerList *msg = cinet_msg_alloc(CI_NET_MSG_DB_GET_CALLER_LIST);
-    
-    JsonObject *obj = json_node_get_object(root);
+    CINetRingSession *session;
+    CINetMsgEventRing *ring;
 
-    ((CINetMsg*)msg)->guid = (guint32)json_object_get_int_member(obj, "guid");
-
-    cinet_msg_db_get_caller_list_set_value((CINetMsg*)msg, "user", GINT_TO_POINTER(json_object_get_int_member(obj, "user")));
-
-    if (json_object_has_member(obj, "filter"))
-        cinet_msg_db_get_caller_list_set_value((CINetMsg*)msg, "filter",
-                (gpointer)json_object_get_string_member(obj, "filter"));
-
-    JsonArray *arr = json_node_get_array(json_object_get_member(obj, "callers"));
-    GList *callers = json_array_get_elements(arr);
-    GList *tmp;
-    CICallerInfo *info;
+    if (tracker == NULL || (session = g_queue_pop_head(&tracker->changed)) == NULL)
+        return NULL;
+    session->link = NULL;
 
-    for (tmp = callers; tmp != NULL; tmp = g_list_next(tmp)) {
-        info = cinet_caller_info_new();
-        cinet_caller_info_read(info, json_node_get_object((JsonNode*)tmp->data));
-        msg->callers = g_list_prepend(msg->callers, (gpointer)info);
-    }
+    ring = (CINetMsgEventRing*)cinet_msg_alloc(CI_NET_MSG_EVENT_RING);
+    ring->parent.parent.guid = session->state->parent.parent.guid;
+    ring->parent.stage = session->state->parent.stage;
+    ring->parent.part = session->state->parent.part;
+    memcpy(ring->parent.msgid, session->state->parent.msgid, sizeof(ring->parent.msgid));
+    cinet_call_info_copy(&ring->callinfo, &session->state->callinfo);
 
-    msg->callers = g_list_reverse(msg->callers);
+    /* Updates coalesced with the Init are still new to the caller. */
+    if (!session->reported && ring->parent.stage == MultipartStageUpdate)
+        ring->parent.stage = MultipartStageInit;
+    session->reported = TRUE;
 
-    g_list_free(callers);
+    if (ring->parent.stage == MultipartStageComplete)
+        cinet_ring_tracker_remove(tracker, session);
 
-    return (CINetMsg*)msg;
+    return (CINetMsg*)ring;
 }
 
-void cinet_msg_db_get_caller_list_set_value(CINetMsg *msg, const gchar *key, const gpointer value)
+guint cinet_ring_tracker_expire(CINetRingTracker *tracker)
 {
-    if (!msg || !key || msg->msgtype != CI_NET_MSG_DB_GET_CALLER_LIST)
-        return;
+    GHashTableIter iter;
+    CINetRingSession *session;
+    gint64 now;
+    guint expired = 0;
 
-    if (!strcmp(key, "user")) {
-        ((CINetMsgDbGetCallerList*)msg)->user = GPOINTER_TO_INT(value);
-        return;
-    }
+    if (tracker == NULL)
+        return 0;
 
-    if (!strcmp(key, "caller")) {
-        ((CINetMsgDbGetCallerList*)msg)->callers = g_list_append(
-            ((CINetMsgDbGetCallerList*)msg)->callers, value);
-        return;
-    }
-    
-    if (!strcmp(key, "filter")) {
-        g_free(((CINetMsgDbGetCallerList*)msg)->filter);
-        ((CINetMsgDbGetCallerList*)msg)->filter = g_strdup((const gchar *)value);
-        return;
+    now = g_get_monotonic_time();
+    g_hash_table_iter_init(&iter, tracker->sessions);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&session)) {
+        if (now - session->last_seen < tracker->timeout)
+            continue;
+        if (session->link)
+            g_queue_delete_link(&tracker->changed, session->link);
+        g_hash_table_iter_remove(&iter);
+        ++expired;
     }
-}
 
-void cinet_msg_db_get_caller_list_free(CINetMsg *msg)
-{
-    g_list_free_full(((CINetMsgDbGetCallerList*)msg)->callers,
-            (GDestroyNotify)cinet_caller_info_free_full);
-    g_free(((CINetMsgDbGetCallerList*)msg)->filter);
+    return expired;
 }
 
-JsonNode *cinet_msg_default_build(CINetMsg *msg)
+guint cinet_ring_tracker_get_sessions(CINetRingTracker *tracker)
 {
-    JsonNode *node = json_node_new(JSON_NODE_OBJECT);
-    return node;
+    return tracker ? g_hash_table_size(tracker->sessions) : 0;
 }
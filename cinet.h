@@ -6,10 +6,28 @@
 
 /* 6 bytes magic string, 4 bytes len, 4 bytes type */
 #define CINET_HEADER_LENGTH            14
+/* CRC32C at the end of the payload with @CI_NET_MSG_FLAG_CHECKSUM */
+#define CINET_CHECKSUM_LENGTH          4
+
+/* Options for @cinet_msg_read_msg_full(). */
+typedef enum {
+    CINET_READ_ARENA = (1<<0),        /* Allocate all data of the message in one block. */
+    CINET_READ_VIEW = (1<<1)          /* Strings point into the buffer. Implies @CINET_READ_ARENA. */
+} CINetReadFlags;
+
+/* Payload flags and features this library understands. */
+#define CINET_MSG_FLAGS_SUPPORTED      (CI_NET_MSG_FLAG_BINARY | CI_NET_MSG_FLAG_COLUMNS |\
+                                        CI_NET_MSG_FLAG_COMPRESSED | CI_NET_MSG_FLAG_CHECKSUM)
+#define CINET_FEATURES_SUPPORTED       (CI_NET_FEATURE_BINARY | CI_NET_FEATURE_COLUMNS | CI_NET_FEATURE_PARTS |\
+                                        CI_NET_FEATURE_COMPRESSION | CI_NET_FEATURE_CHECKSUM | CI_NET_FEATURE_DELTA)
+
+/* Payloads smaller than this are never compressed. */
+#define CINET_COMPRESS_DEFAULT_THRESHOLD 1024
 
 /* Write data from @header to the buffer given by @data which is at least
  * @len bytes long. The buffer should be at least @CINET_HEADER_LENGTH
  * bytes long. On success the number of bytes written is returned, -1 otherwise.
+ * The header announces a JSON payload, @header->flags is not used.
  *
  * @data:   A buffer to write the data to.
  * @len:    The size of the buffer.
@@ -19,6 +37,17 @@
  */
 gssize cinet_msg_write_header(gchar *data, gsize len, CINetMsgHeader *header);
 
+/* Like @cinet_msg_write_header() but for a payload encoded with @flags.
+ *
+ * @data:   A buffer to write the data to.
+ * @len:    The size of the buffer.
+ * @header: Header data. @header->flags is not used.
+ * @flags:  Encoding of the payload, a combination of @CINetMsgFlags.
+ *
+ * @return: Number of bytes written or -1 if an error occured.
+ */
+gssize cinet_msg_write_header_full(gchar *data, gsize len, CINetMsgHeader *header, guint32 flags);
+
 /* Read header data from raw @data to @header. @len is the size of @data.
  * Returns the number of bytes read or -1 on failure.
  *
@@ -41,8 +70,85 @@ gssize cinet_msg_read_header(CINetMsgHeader *header, gchar *data, gsize len);
  */
 gint cinet_msg_write_msg(gchar **buffer, gsize *len, CINetMsg *msg);
 
+/* Like @cinet_msg_write_msg() but encode the payload as given by @flags.
+ * With @CI_NET_MSG_FLAG_COMPRESSED the payload is only compressed if it is at
+ * least as large as the threshold and actually gets smaller. The flag is set
+ * in the header only in this case.
+ *
+ * @buffer: Pointer to hold the newly allocated message data. Free with @g_free().
+ * @len:    Number of bytes in the buffer (header and payload).
+ * @msg:    The message to be converted.
+ * @flags:  Encoding of the payload, a combination of @CINetMsgFlags. Only use
+ *          flags for features the peer supports.
+ *
+ * @return: 0 on success, -1 otherwise.
+ */
+gint cinet_msg_write_msg_full(gchar **buffer, gsize *len, CINetMsg *msg, guint32 flags);
+
+/* Get the exact number of bytes needed to write a message.
+ *
+ * @msg:    The message.
+ * @flags:  Encoding of the payload, a combination of @CINetMsgFlags.
+ *
+ * @return: Size of header and payload, or -1 if the message cannot be written.
+ */
+gssize cinet_msg_get_size(CINetMsg *msg, guint32 flags);
+
+/* Write a message to a buffer provided by the caller. Nothing is allocated.
+ *
+ * @buffer: The buffer to write the message to.
+ * @size:   Size of the buffer. Use @cinet_msg_get_size() to get the size needed.
+ * @msg:    The message to be converted.
+ * @flags:  Encoding of the payload, a combination of @CINetMsgFlags.
+ *
+ * @return: Number of bytes written, or -1 on error or if the buffer is too small.
+ */
+gssize cinet_msg_write_msg_to_buffer(gchar *buffer, gsize size, CINetMsg *msg, guint32 flags);
+
+/* Append a message to @str. This allows to reuse one buffer for many messages.
+ * On error @str is left unchanged.
+ *
+ * @str:    The string to append the message to.
+ * @msg:    The message to be converted.
+ * @flags:  Encoding of the payload, a combination of @CINetMsgFlags.
+ *
+ * @return: Number of bytes appended, or -1 on error.
+ */
+gssize cinet_msg_append_msg(GString *str, CINetMsg *msg, guint32 flags);
+
+/* Encode a message to an immutable frame, e.g. to send the same message to
+ * many peers. The frame can be queued with @cinet_msg_batch_add_bytes() in
+ * any number of batches without copying it.
+ *
+ * @msg:    The message to be converted.
+ * @flags:  Encoding of the payload, a combination of @CINetMsgFlags.
+ *
+ * @return: The frame, header and payload, or NULL on error. Free with
+ *          @g_bytes_unref().
+ */
+GBytes *cinet_msg_write_bytes(CINetMsg *msg, guint32 flags);
+
+/* Get the flags to use when writing messages to a peer.
+ *
+ * @features: The features announced by the peer in its @CINetMsgVersion.
+ *
+ * @return:   A combination of @CINetMsgFlags for use with @cinet_msg_write_msg_full().
+ */
+guint32 cinet_msg_flags_for_features(guint32 features);
+
+/* Set the minimum size of a payload to be compressed. The default is
+ * @CINET_COMPRESS_DEFAULT_THRESHOLD. A payload is only sent compressed if
+ * that makes it smaller.
+ *
+ * @threshold: Minimum size in bytes. 0 compresses every payload, pass
+ *             @CINET_COMPRESS_DEFAULT_THRESHOLD to restore the default.
+ */
+void cinet_msg_set_compress_threshold(gsize threshold);
+
 /* Convert raw message data from the network to a CINetMsg.
  * The memory for the message will be allocated according to the message type.
+ * The encoding of the payload is taken from the flags in the header. If the
+ * frame has a checksum, it is checked before the payload is decoded.
  *
  * @msg:    Return location of the newly allocated message. Free with
  *          @cinet_msg_free().
@@ -53,6 +159,457 @@ gint cinet_msg_write_msg(gchar **buffer, gsize *len, CINetMsg *msg);
  */
 gint cinet_msg_read_msg(CINetMsg **msg, gchar *buffer, gsize len);
 
+/* Like @cinet_msg_read_msg() but with options for decoding.
+ * With @CINET_READ_ARENA the message, its strings and list entries are
+ * allocated from one arena, which takes a few allocations instead of several
+ * per list entry. @cinet_msg_free() releases everything at once. Such messages
+ * can be used like any other, but list entries belong to the message and must
+ * not be freed or moved to other messages. Its @CICallInfo and @CICallerInfo
+ * members may be read and copied from, but are only changed through the
+ * message setters: functions like @cinet_call_info_set_field() do not know
+ * about the arena. Use @cinet_msg_materialize() to edit them freely.
+ * With @CINET_READ_VIEW strings are not copied but terminated in place and
+ * point into @buffer. The buffer is modified and has to stay valid until the
+ * message is freed. Use @cinet_msg_materialize() to keep the data longer.
+ * Compressed payloads are inflated first, @CINET_READ_VIEW then only has the
+ * effect of @CINET_READ_ARENA.
+ *
+ * @msg:    Return location for the message. Free with @cinet_msg_free().
+ * @buffer: The raw message data.
+ * @len:    Number of bytes in the buffer.
+ * @flags:  A combination of @CINetReadFlags.
+ *
+ * @return: 0 on success, -1 otherwise.
+ */
+gint cinet_msg_read_msg_full(CINetMsg **msg, gchar *buffer, gsize len, guint32 flags);
+
+/* Create a copy of @msg owning all its data, e.g. to keep a message read with
+ * @CINET_READ_VIEW after its buffer is gone.
+ *
+ * @msg:    The message to copy.
+ *
+ * @return: A new message. Free with @cinet_msg_free().
+ */
+CINetMsg *cinet_msg_materialize(CINetMsg *msg);
+
+/* Incremental reader splitting a byte stream into frames. Data can be received
+ * in chunks of any size. Frames are returned as soon as they are complete. If
+ * the stream is corrupted, data is skipped until the next magic string. */
+typedef struct _CINetMsgReader CINetMsgReader;
+
+/* Create a new reader.
+ *
+ * @max_frame_size: Frames larger than this are treated as corrupt. Use 0 for
+ *                  the default of 16 MiB.
+ *
+ * @return:         The new reader. Free with @cinet_msg_reader_free().
+ */
+CINetMsgReader *cinet_msg_reader_new(gsize max_frame_size);
+
+/* Free a reader and all data it holds.
+ *
+ * @reader: The reader.
+ */
+void cinet_msg_reader_free(CINetMsgReader *reader);
+
+/* Get space to receive data into directly, e.g. with @recv(). Call
+ * @cinet_msg_reader_commit() afterwards with the number of bytes received.
+ * The space is large enough to hold the rest of a pending frame.
+ *
+ * @reader: The reader.
+ * @len:    Return location for the number of bytes available.
+ *
+ * @return: Pointer to the free space.
+ */
+gchar *cinet_msg_reader_get_buffer(CINetMsgReader *reader, gsize *len);
+
+/* Mark @len bytes of the space returned by @cinet_msg_reader_get_buffer() as
+ * received.
+ *
+ * @reader: The reader.
+ * @len:    Number of bytes received.
+ */
+void cinet_msg_reader_commit(CINetMsgReader *reader, gsize len);
+
+/* Copy data into the reader.
+ *
+ * @reader: The reader.
+ * @data:   The data received.
+ * @len:    Number of bytes in @data.
+ */
+void cinet_msg_reader_feed(CINetMsgReader *reader, const gchar *data, gsize len);
+
+/* Get the next complete frame, header and payload. The frame points into the
+ * buffer of the reader and is valid until more data is added. Frames with a
+ * wrong checksum are skipped like any other garbage.
+ *
+ * @reader: The reader.
+ * @frame:  Return location for the frame.
+ * @len:    Return location for the size of the frame.
+ *
+ * @return: TRUE if a frame was returned, FALSE if more data is needed.
+ */
+gboolean cinet_msg_reader_next_frame(CINetMsgReader *reader, gchar **frame, gsize *len);
+
+/* Get the next message. Frames that cannot be decoded are skipped.
+ *
+ * @reader: The reader.
+ * @msg:    Return location for the message. Free with @cinet_msg_free().
+ *
+ * @return: TRUE if a message was returned, FALSE if more data is needed.
+ */
+gboolean cinet_msg_reader_next_msg(CINetMsgReader *reader, CINetMsg **msg);
+
+/* Get the number of bytes skipped because of corrupt or undecodable frames.
+ *
+ * @reader: The reader.
+ *
+ * @return: Number of bytes skipped.
+ */
+guint64 cinet_msg_reader_get_dropped(CINetMsgReader *reader);
+
+/* Reusable state for encoding and decoding: zlib streams, scratch buffers and
+ * counters. A codec must only be used by one thread at a time. Each thread has
+ * a default codec, which is used by all functions without an explicit one, so
+ * a server can keep one codec per worker thread without any shared state. */
+typedef struct _CINetCodec CINetCodec;
+
+/* Counters of a codec. */
+typedef struct {
+    guint64 msgs_written;             /* Frames encoded. */
+    guint64 bytes_written;            /* Size of the frames encoded. */
+    guint64 msgs_read;                /* Frames decoded. */
+    guint64 bytes_read;               /* Size of the frames decoded. */
+    guint64 compressed;               /* Payloads compressed or inflated. */
+    guint64 errors;                   /* Messages that could not be encoded or decoded. */
+} CINetCodecStats;
+
+/* Create a new codec, e.g. for a worker thread.
+ *
+ * @return: The new codec. Free with @cinet_codec_free().
+ */
+CINetCodec *cinet_codec_new(void);
+
+/* Free a codec and all buffers it holds.
+ *
+ * @codec: The codec.
+ */
+void cinet_codec_free(CINetCodec *codec);
+
+/* Get the default codec of the calling thread. It is freed when the thread exits.
+ *
+ * @return: The codec of the thread.
+ */
+CINetCodec *cinet_codec_get_default(void);
+
+/* Like @cinet_msg_append_msg() but with the given codec.
+ *
+ * @codec:  The codec, NULL for the default codec of the thread.
+ * @str:    The string to append the message to.
+ * @msg:    The message to be converted.
+ * @flags:  Encoding of the payload, a combination of @CINetMsgFlags.
+ *
+ * @return: Number of bytes appended, or -1 on error.
+ */
+gssize cinet_codec_append_msg(CINetCodec *codec, GString *str, CINetMsg *msg, guint32 flags);
+
+/* Like @cinet_msg_read_msg_full() but with the given codec.
+ *
+ * @codec:  The codec, NULL for the default codec of the thread.
+ * @msg:    Return location for the message. Free with @cinet_msg_free().
+ * @buffer: The raw message data.
+ * @len:    Number of bytes in the buffer.
+ * @flags:  A combination of @CINetReadFlags.
+ *
+ * @return: 0 on success, -1 otherwise.
+ */
+gint cinet_codec_read_msg(CINetCodec *codec, CINetMsg **msg, gchar *buffer, gsize len, guint32 flags);
+
+/* Get the counters of a codec.
+ *
+ * @codec: The codec, NULL for the default codec of the thread.
+ * @stats: Return location for the counters.
+ */
+void cinet_codec_get_stats(CINetCodec *codec, CINetCodecStats *stats);
+
+/* Reset all counters of a codec to 0.
+ *
+ * @codec: The codec, NULL for the default codec of the thread.
+ */
+void cinet_codec_reset_stats(CINetCodec *codec);
+
+/* Decode all complete frames in @buffer, e.g. a capture or everything read
+ * from a busy socket. Garbage and frames that cannot be decoded are skipped
+ * as in @cinet_msg_reader_next_msg(). With more than one thread, large
+ * batches are decoded in a shared thread pool. The messages are appended to
+ * @msgs in the order of the frames.
+ *
+ * @buffer:    The data.
+ * @len:       Number of bytes in @buffer.
+ * @flags:     A combination of @CINetReadFlags.
+ * @n_threads: Maximum number of threads to use, 0 for the number of
+ *             processors. With 1 everything is decoded in the calling thread.
+ * @msgs:      Array to append the messages to. Free them with @cinet_msg_free().
+ *
+ * @return:    Number of bytes consumed, the rest is the beginning of an
+ *             incomplete frame. -1 if an error occured.
+ */
+gssize cinet_msg_read_many(gchar *buffer, gsize len, guint32 flags, guint n_threads, GPtrArray *msgs);
+
+/* A chunk of data for vectored output. The layout matches struct iovec and
+ * GOutputVector, so an array of these can be passed to @writev() or
+ * @g_socket_send_message() directly. */
+typedef struct {
+    gconstpointer buffer;
+    gsize size;
+} CINetIOVector;
+
+/* A batch of frames to be written with as few calls as possible. Headers are
+ * kept separately and payloads are not copied into contiguous frames. */
+typedef struct _CINetMsgBatch CINetMsgBatch;
+
+/* Create a new, empty batch.
+ *
+ * @return: The new batch. Free with @cinet_msg_batch_free().
+ */
+CINetMsgBatch *cinet_msg_batch_new(void);
+
+/* Free a batch and all payloads it holds.
+ *
+ * @batch: The batch.
+ */
+void cinet_msg_batch_free(CINetMsgBatch *batch);
+
+/* Remove all frames from the batch, whether written or not.
+ *
+ * @batch: The batch.
+ */
+void cinet_msg_batch_clear(CINetMsgBatch *batch);
+
+/* Encode a message and append it to the batch.
+ *
+ * @batch:  The batch.
+ * @msg:    The message. It is not needed after this call.
+ * @flags:  Encoding of the payload, a combination of @CINetMsgFlags.
+ *
+ * @return: 0 on success, -1 otherwise.
+ */
+gint cinet_msg_batch_add_msg(CINetMsgBatch *batch, CINetMsg *msg, guint32 flags);
+
+/* Append a frame with an already encoded payload to the batch. The payload
+ * is not copied and has to stay valid until the frame is written. With
+ * @CI_NET_MSG_FLAG_CHECKSUM the checksum is added to the frame, @payload
+ * must not contain it.
+ *
+ * @batch:   The batch.
+ * @msgtype: Type of the message.
+ * @flags:   Encoding of the payload, a combination of @CINetMsgFlags.
+ * @payload: The payload.
+ * @len:     Length of the payload.
+ *
+ * @return:  0 on success, -1 otherwise.
+ */
+gint cinet_msg_batch_add_payload(CINetMsgBatch *batch, CINetMsgType msgtype, guint32 flags,
+                                 const gchar *payload, gsize len);
+
+/* Append a complete frame to the batch. The batch holds a reference to
+ * @frame until it is written.
+ *
+ * @batch:   The batch.
+ * @frame:   The frame, e.g. from @cinet_msg_write_bytes().
+ *
+ * @return:  0 on success, -1 otherwise.
+ */
+gint cinet_msg_batch_add_bytes(CINetMsgBatch *batch, GBytes *frame);
+
+/* Fill @vectors with the data not written yet, starting after the part
+ * passed to @cinet_msg_batch_consume(). Each frame needs up to two vectors.
+ * The vectors are valid until the batch is changed.
+ *
+ * @batch:   The batch.
+ * @vectors: Array to fill.
+ * @n:       Number of elements in @vectors, e.g. IOV_MAX.
+ *
+ * @return:  Number of vectors filled. 0 if nothing is left to write.
+ */
+guint cinet_msg_batch_get_vectors(CINetMsgBatch *batch, CINetIOVector *vectors, guint n);
+
+/* Get the number of bytes not written yet.
+ *
+ * @batch:  The batch.
+ *
+ * @return: Number of bytes pending.
+ */
+gsize cinet_msg_batch_get_pending(CINetMsgBatch *batch);
+
+/* Mark data as written, e.g. the result of a partial @writev(). Once all data
+ * is written, the batch is cleared and can be reused.
+ *
+ * @batch: The batch.
+ * @len:   Number of bytes written.
+ */
+void cinet_msg_batch_consume(CINetMsgBatch *batch, gsize len);
+
+/* Fill in the next call of a list sent in parts.
+ *
+ * @info:     A zeroed @CICallInfo owned by the list. Set its members with
+ *            @cinet_call_info_set_field().
+ * @userdata: Data passed to @cinet_msg_db_call_list_write_parts().
+ *
+ * @return:   TRUE if @info was filled in, FALSE if there are no more calls.
+ */
+typedef gboolean (*CINetCallInfoFunc)(CICallInfo *info, gpointer userdata);
+
+/* Write an encoded frame.
+ *
+ * @data:     Header and payload of the frame, only valid during the call.
+ * @len:      Size of the frame.
+ * @userdata: Data passed to @cinet_msg_db_call_list_write_parts().
+ *
+ * @return:   0 on success, -1 to stop writing.
+ */
+typedef gint (*CINetFrameFunc)(const gchar *data, gsize len, gpointer userdata);
+
+/* Number of calls per part if none is given. */
+#define CINET_MSG_PARTS_DEFAULT_ROWS   256
+
+/* Send a @CI_NET_MSG_DB_CALL_LIST in parts of at most @max_rows calls, so that
+ * only one part has to be held in memory. The calls are produced by @next.
+ * Parts are sent as Init and Update stages, an empty Complete part ends the
+ * list. Only send this to peers announcing @CI_NET_FEATURE_PARTS.
+ *
+ * @msg:      The list. Guid, user, offset and count are sent in each part,
+ *            its calls are not sent.
+ * @msgid:    Id of the list, unique among the lists currently sent.
+ * @max_rows: Maximum number of calls per part. 0 for @CINET_MSG_PARTS_DEFAULT_ROWS.
+ * @flags:    Encoding of the payload, a combination of @CINetMsgFlags.
+ * @next:     Called for each call.
+ * @write:    Called for each encoded part.
+ * @userdata: Data passed to @next and @write.
+ *
+ * @return:   0 on success, -1 if a part could not be encoded or @write failed.
+ */
+gint cinet_msg_db_call_list_write_parts(CINetMsg *msg, const gchar *msgid, guint max_rows, guint32 flags,
+                                        CINetCallInfoFunc next, CINetFrameFunc write, gpointer userdata);
+
+/* Reassembles call lists sent in parts. */
+typedef struct _CINetMsgAssembler CINetMsgAssembler;
+
+/* Create a new assembler.
+ *
+ * @max_rows: Lists with more calls are dropped. 0 for no limit.
+ *
+ * @return:   The new assembler. Free with @cinet_msg_assembler_free().
+ */
+CINetMsgAssembler *cinet_msg_assembler_new(guint max_rows);
+
+/* Free an assembler and all incomplete lists.
+ *
+ * @assembler: The assembler.
+ */
+void cinet_msg_assembler_free(CINetMsgAssembler *assembler);
+
+/* Add a received message. Parts of a list are kept until the Complete part
+ * arrives, lists with a missing part are dropped. All other messages are
+ * returned as they are, so every received message can be passed here.
+ *
+ * @assembler: The assembler.
+ * @msg:       The message. The assembler takes ownership of it.
+ *
+ * @return:    A complete message or NULL if more parts are needed. Free with
+ *             @cinet_msg_free().
+ */
+CINetMsg *cinet_msg_assembler_add(CINetMsgAssembler *assembler, CINetMsg *msg);
+
+/* Drop an incomplete list, e.g. when nobody waits for it anymore.
+ *
+ * @assembler: The assembler.
+ * @msgid:     The msgid of the list.
+ */
+void cinet_msg_assembler_remove(CINetMsgAssembler *assembler, const gchar *msgid);
+
+/* Set the maximum number of calls of a list. Lists already larger are dropped
+ * when their next part arrives.
+ *
+ * @assembler: The assembler.
+ * @max_rows:  Lists with more calls are dropped. 0 for no limit.
+ */
+void cinet_msg_assembler_set_max_rows(CINetMsgAssembler *assembler, guint max_rows);
+
+/* Keeps the state of RINGs sent in stages. Each session is identified by its
+ * msgid. Update and Complete stages replace the state, or are merged into it
+ * if @CI_NET_FEATURE_DELTA is in effect, see @cinet_ring_tracker_set_features().
+ * Stages received in a burst are coalesced, only the latest state of a
+ * session is returned. */
+typedef struct _CINetRingTracker CINetRingTracker;
+
+/* Seconds after which a session without a Complete stage is dropped. */
+#define CINET_RING_TRACKER_DEFAULT_TIMEOUT 300
+
+/* Create a new tracker.
+ *
+ * @timeout:  Seconds without a stage after which @cinet_ring_tracker_expire()
+ *            drops a session. 0 for @CINET_RING_TRACKER_DEFAULT_TIMEOUT.
+ *
+ * @return:   The new tracker. Free with @cinet_ring_tracker_free().
+ */
+CINetRingTracker *cinet_ring_tracker_new(guint timeout);
+
+/* Free a tracker and all sessions.
+ *
+ * @tracker: The tracker.
+ */
+void cinet_ring_tracker_free(CINetRingTracker *tracker);
+
+/* Set the features announced by both sides of the connection the stages are
+ * received on. With @CI_NET_FEATURE_DELTA stages carry only the members that
+ * changed and are merged into the state. Without it, the default, each stage
+ * carries the whole state.
+ *
+ * @tracker:  The tracker.
+ * @features: A combination of @CINetFeatures.
+ */
+void cinet_ring_tracker_set_features(CINetRingTracker *tracker, guint32 features);
+
+/* Pass a received message to the tracker.
+ *
+ * @tracker: The tracker.
+ * @msg:     The message. The tracker copies what it needs.
+ *
+ * @return:  TRUE if the message was a stage of a RING and its state should be
+ *           taken from @cinet_ring_tracker_pop(), FALSE otherwise.
+ */
+gboolean cinet_ring_tracker_add(CINetRingTracker *tracker, CINetMsg *msg);
+
+/* Get the state of the next session changed since it was last returned, e.g.
+ * after all messages received so far have been added. The stage is Init the
+ * first time a session is returned unless it is already complete. Complete
+ * sessions are removed.
+ *
+ * @tracker: The tracker.
+ *
+ * @return:  A @CI_NET_MSG_EVENT_RING with all members known or NULL if no
+ *           session changed. Free with @cinet_msg_free().
+ */
+CINetMsg *cinet_ring_tracker_pop(CINetRingTracker *tracker);
+
+/* Drop sessions without a stage for longer than the timeout, e.g. because
+ * the Complete stage was lost. Call this from time to time.
+ *
+ * @tracker: The tracker.
+ *
+ * @return:  Number of sessions dropped.
+ */
+guint cinet_ring_tracker_expire(CINetRingTracker *tracker);
+
+/* Get the number of sessions currently tracked.
+ *
+ * @tracker: The tracker.
+ *
+ * @return:  Number of sessions.
+ */
+guint cinet_ring_tracker_get_sessions(CINetRingTracker *tracker);
+
 /* Allocate memory for a message of a given type.
  *
  * @msgtype: The type of message.
@@ -62,12 +619,42 @@ gint cinet_msg_read_msg(CINetMsg **msg, gchar *buffer, gsize len);
  */
 CINetMsg *cinet_msg_alloc(CINetMsgType msgtype);
 
-/* Free memory used by a @CINetMsg and associated data.
+/* Free memory used by a @CINetMsg and associated data. This is the same as
+ * @cinet_msg_unref(), the message is only freed with its last reference.
+ * Messages not allocated by the library, e.g. with @g_malloc0(), are freed
+ * with @g_free(). They have no reference count.
  *
  * @msg:     The message to be freed.
  */
 void cinet_msg_free(CINetMsg *msg);
 
+/* Add a reference to a message, e.g. to hand it to several consumers,
+ * possibly in other threads. A message with more than one reference must not
+ * be changed, the setters emit a critical warning and leave it alone. Only
+ * messages allocated by the library can be referenced.
+ *
+ * @msg:     The message.
+ *
+ * @return:  @msg
+ */
+CINetMsg *cinet_msg_ref(CINetMsg *msg);
+
+/* Drop a reference to a message. The message is freed with the last one.
+ *
+ * @msg:     The message.
+ */
+void cinet_msg_unref(CINetMsg *msg);
+
+/* Keep freed messages for reuse by @cinet_msg_alloc(). Each thread caches a
+ * few messages per type, up to @max more per type are shared between threads.
+ * The pool is disabled by default.
+ *
+ * @max:     Maximum number of shared messages per type. 0 disables the pool
+ *           and frees the shared messages and those cached by the calling
+ *           thread. Other threads keep their caches until they exit.
+ */
+void cinet_msg_pool_set_max(guint max);
+
 /* Create a new @CINetMsg of the given type and initialize with the given data.
  *
  * @msgtype: Type of the new message.
@@ -88,6 +675,19 @@ CINetMsg *cinet_message_new(CINetMsgType msgtype, ...);
  */
 gint cinet_message_new_for_data(gchar **buffer, gsize *len, guint msgtype, ...);
 
+/* Like @cinet_message_new_for_data() but write to a buffer provided by the
+ * caller. The message is only kept on the stack and strings are not copied.
+ *
+ * @buffer:  The buffer to write the message to.
+ * @size:    Size of the buffer.
+ * @flags:   Encoding of the payload, a combination of @CINetMsgFlags.
+ * @msgtype: Type of the new message.
+ * @...:     List of key-value-pairs with the message data. End with two NULL.
+ *
+ * @return:  Number of bytes written, or -1 on error or if the buffer is too small.
+ */
+gssize cinet_message_new_for_buffer(gchar *buffer, gsize size, guint32 flags, guint msgtype, ...);
+
 /* Set a member of a message to the given value.
  *
  * @msg:     The message.
@@ -96,6 +696,102 @@ gint cinet_message_new_for_data(gchar **buffer, gsize *len, guint msgtype, ...);
  */
 void cinet_message_set_value(CINetMsg *msg, const gchar *key, const gpointer value);
 
+/* Get the id of a member from its name.
+ *
+ * @key:     The name of the member.
+ *
+ * @return:  The id of the member or @CI_NET_FIELD_UNKNOWN.
+ */
+CINetMsgField cinet_msg_field_lookup(const gchar *key);
+
+/* Like @cinet_message_set_value() but with the id of the member, which saves
+ * looking up the name.
+ *
+ * @msg:     The message.
+ * @field:   The member to be set.
+ * @value:   The new value. For integers use GINT_TO_POINTER (or _UINT).
+ */
+void cinet_message_set_field(CINetMsg *msg, CINetMsgField field, const gpointer value);
+
+/* Set an integer member of a message.
+ *
+ * @msg:     The message.
+ * @field:   The member to be set.
+ * @value:   The new value.
+ */
+void cinet_message_set_int(CINetMsg *msg, CINetMsgField field, gint value);
+
+/* Set a string member of a message.
+ *
+ * @msg:     The message.
+ * @field:   The member to be set.
+ * @value:   The new value. The string is copied.
+ */
+void cinet_message_set_string(CINetMsg *msg, CINetMsgField field, const gchar *value);
+
+/* Append an empty call to the @calls of a @CI_NET_MSG_DB_CALL_LIST message.
+ * Set its members with @cinet_call_info_set_field(). This walks the list, use
+ * a @CINetMsgListBuilder to add many calls.
+ *
+ * @msg:     The message.
+ *
+ * @return:  The new entry, owned by the message. NULL if @msg is not a call
+ *           list.
+ */
+CICallInfo *cinet_msg_db_call_list_append(CINetMsg *msg);
+
+/* Get the number of calls of a @CI_NET_MSG_DB_CALL_LIST message. This counts
+ * the nodes of the list. To read the calls, walk @calls:
+ *
+ *     for (link = ((CINetMsgDbCallList*)msg)->calls; link; link = link->next)
+ *         info = link->data;
+ *
+ * @msg:     The message.
+ *
+ * @return:  The number of calls.
+ */
+guint cinet_msg_db_call_list_get_length(CINetMsg *msg);
+
+/* The same for the @callers of a @CI_NET_MSG_DB_GET_CALLER_LIST message. */
+CICallerInfo *cinet_msg_db_get_caller_list_append(CINetMsg *msg);
+guint cinet_msg_db_get_caller_list_get_length(CINetMsg *msg);
+
+/* Builder adding many entries to the list of a @CI_NET_MSG_DB_CALL_LIST or
+ * @CI_NET_MSG_DB_GET_CALLER_LIST message in O(1) each. The entries are kept
+ * by the builder and linked to the end of the list when it is finished, so
+ * the list of the message may be changed in between. Usually kept on the
+ * stack, the members are private. */
+typedef struct {
+    CINetMsg *msg;
+    GList *entries;
+} CINetMsgListBuilder;
+
+/* Start adding entries to the list of a message.
+ *
+ * @builder: The builder.
+ * @msg:     The message.
+ */
+void cinet_msg_list_builder_init(CINetMsgListBuilder *builder, CINetMsg *msg);
+
+/* Add an empty call. Set its members with @cinet_call_info_set_field().
+ *
+ * @builder: The builder.
+ *
+ * @return:  The new entry, owned by the builder and then by the message. NULL
+ *           if the message is not a call list.
+ */
+CICallInfo *cinet_msg_list_builder_add_call(CINetMsgListBuilder *builder);
+
+/* The same for a @CI_NET_MSG_DB_GET_CALLER_LIST message. */
+CICallerInfo *cinet_msg_list_builder_add_caller(CINetMsgListBuilder *builder);
+
+/* Append the added entries to the list of the message. This has to be called
+ * before the message is used. The builder can be used again afterwards.
+ *
+ * @builder: The builder.
+ */
+void cinet_msg_list_builder_finish(CINetMsgListBuilder *builder);
+
 /* Allocate memory for a new call info.
  *
  * @return:  The new @CICallInfo. Free with @cinet_call_info_free_full().
@@ -128,6 +824,24 @@ void cinet_call_info_free_full(CICallInfo *info);
  */
 void cinet_call_info_copy(CICallInfo *dst, CICallInfo *src);
 
+/* Merge an Update carrying only the members that changed into a @CICallInfo.
+ * Members present in @src, as marked in its fields, replace those of @dst,
+ * the id only if it is not 0. An empty string clears a member.
+ *
+ * @dst:     The state to update.
+ * @src:     The changed members.
+ */
+void cinet_call_info_merge(CICallInfo *dst, const CICallInfo *src);
+
+/* Reduce a @CICallInfo to the members that changed since @previous, e.g.
+ * before sending it in an Update to a peer announcing @CI_NET_FEATURE_DELTA.
+ * Unchanged members are cleared, members removed since are set to "".
+ *
+ * @info:     The current state. It is changed in place.
+ * @previous: The state sent last.
+ */
+void cinet_call_info_diff(CICallInfo *info, const CICallInfo *previous);
+
 /* Set a member of a @CICallInfo to the given value.
  *
  * @info:    The @CICallInfo.
@@ -136,11 +850,20 @@ void cinet_call_info_copy(CICallInfo *dst, CICallInfo *src);
  */
 void cinet_call_info_set_value(CICallInfo *info, const gchar *key, const gpointer value);
 
+/* Like @cinet_call_info_set_value() but with the id of the member.
+ *
+ * @info:    The @CICallInfo.
+ * @field:   The member to be set.
+ * @value:   The new value. For integers use GINT_TO_POINTER (or _UINT).
+ */
+void cinet_call_info_set_field(CICallInfo *info, CINetMsgField field, const gpointer value);
+
 CICallerInfo *cinet_caller_info_new(void);
 void cinet_caller_info_init(CICallerInfo *info);
 void cinet_caller_info_free(CICallerInfo *info);
 void cinet_caller_info_free_full(CICallerInfo *info);
 void cinet_caller_info_copy(CICallerInfo *dst, CICallerInfo *src);
 void cinet_caller_info_set_value(CICallerInfo *info, const gchar *key, const gpointer value);
+void cinet_caller_info_set_field(CICallerInfo *info, CINetMsgField field, const gpointer value);
 
 #endif
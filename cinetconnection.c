@@ -0,0 +1,329 @@
+#include "cinetconnection.h"
+
+/* Number of reads per dispatch, so that a busy peer cannot starve others. */
+#define CINET_CONNECTION_MAX_READS    16
+/* Number of vectors per write. */
+#define CINET_CONNECTION_MAX_VECTORS  64
+
+struct _CINetConnection {
+    gint refcount;
+    GIOStream *stream;
+    GPollableInputStream *input;
+    GPollableOutputStream *output;
+    GMainContext *context;
+    GSource *in_source;
+    GSource *out_source;              /* Idle source for a flush or waiting for the socket to become writable. */
+    CINetConnectionCallbacks callbacks;
+    gpointer userdata;
+    CINetMsgReader *reader;
+    CINetMsgBatch *batch;
+    guint32 flags;                    /* Encoding of outgoing payloads. [type: CINetMsgFlags] */
+    gsize high_water;
+    gboolean congested;
+    gboolean shutdown;                /* Close once everything is written. */
+    gboolean closed;
+};
+
+static gboolean cinet_connection_input_ready(GObject *stream, gpointer userdata);
+static gboolean cinet_connection_output_ready(GObject *stream, gpointer userdata);
+static gboolean cinet_connection_output_idle(gpointer userdata);
+
+static void cinet_connection_clear_source(GSource **source)
+{
+    if (*source) {
+        g_source_destroy(*source);
+        g_source_unref(*source);
+        *source = NULL;
+    }
+}
+
+static void cinet_connection_attach(CINetConnection *conn, GSource **source, GSource *new_source,
+                                    GSourceFunc func)
+{
+    cinet_connection_clear_source(source);
+    g_source_set_callback(new_source, func, conn, NULL);
+    g_source_attach(new_source, conn->context);
+    *source = new_source;
+}
+
+CINetConnection *cinet_connection_new(GIOStream *stream, GMainContext *context,
+                                      const CINetConnectionCallbacks *callbacks, gpointer userdata)
+{
+    CINetConnection *conn;
+    GInputStream *input;
+    GOutputStream *output;
+
+    if (!stream)
+        return NULL;
+
+    input = g_io_stream_get_input_stream(stream);
+    output = g_io_stream_get_output_stream(stream);
+    if (!G_IS_POLLABLE_INPUT_STREAM(input) || !G_IS_POLLABLE_OUTPUT_STREAM(output) ||
+            !g_pollable_input_stream_can_poll(G_POLLABLE_INPUT_STREAM(input)) ||
+            !g_pollable_output_stream_can_poll(G_POLLABLE_OUTPUT_STREAM(output)))
+        return NULL;
+
+    conn = g_malloc0(sizeof(CINetConnection));
+    conn->refcount = 1;
+    conn->stream = g_object_ref(stream);
+    conn->input = G_POLLABLE_INPUT_STREAM(input);
+    conn->output = G_POLLABLE_OUTPUT_STREAM(output);
+    conn->context = context ? g_main_context_ref(context) : NULL;
+    if (callbacks)
+        conn->callbacks = *callbacks;
+    conn->userdata = userdata;
+    conn->reader = cinet_msg_reader_new(0);
+    conn->batch = cinet_msg_batch_new();
+    conn->high_water = CINET_CONNECTION_DEFAULT_HIGH_WATER;
+
+    cinet_connection_attach(conn, &conn->in_source,
+                            g_pollable_input_stream_create_source(conn->input, NULL),
+                            (GSourceFunc)cinet_connection_input_ready);
+
+    return conn;
+}
+
+CINetConnection *cinet_connection_ref(CINetConnection *conn)
+{
+    if (conn)
+        g_atomic_int_inc(&conn->refcount);
+    return conn;
+}
+
+void cinet_connection_unref(CINetConnection *conn)
+{
+    if (conn == NULL || !g_atomic_int_dec_and_test(&conn->refcount))
+        return;
+
+    cinet_connection_close(conn);
+
+    cinet_msg_reader_free(conn->reader);
+    cinet_msg_batch_free(conn->batch);
+    g_object_unref(conn->stream);
+    if (conn->context)
+        g_main_context_unref(conn->context);
+    g_free(conn);
+}
+
+void cinet_connection_close(CINetConnection *conn)
+{
+    if (!conn || conn->closed)
+        return;
+
+    conn->closed = TRUE;
+    cinet_connection_clear_source(&conn->in_source);
+    cinet_connection_clear_source(&conn->out_source);
+    cinet_msg_batch_clear(conn->batch);
+
+    g_io_stream_close(conn->stream, NULL, NULL);
+}
+
+/* Close the connection because of the peer or a finished shutdown and
+ * tell the user.
+ *
+ * @conn:  The connection.
+ * @error: The error, NULL if the connection was closed regularly.
+ */
+static void cinet_connection_fail(CINetConnection *conn, const GError *error)
+{
+    if (conn->closed)
+        return;
+
+    cinet_connection_close(conn);
+    if (conn->callbacks.closed)
+        conn->callbacks.closed(conn, error, conn->userdata);
+}
+
+/* Report changes of the congestion state. The caller has to hold a
+ * reference, the callback may drop the last one of the user. */
+static void cinet_connection_update_congestion(CINetConnection *conn)
+{
+    gsize pending = cinet_msg_batch_get_pending(conn->batch);
+
+    if (!conn->congested && pending > conn->high_water)
+        conn->congested = TRUE;
+    else if (conn->congested && pending <= conn->high_water / 2)
+        conn->congested = FALSE;
+    else
+        return;
+
+    if (conn->callbacks.backpressure)
+        conn->callbacks.backpressure(conn, conn->congested, conn->userdata);
+}
+
+/* Write as much as possible without blocking. If the socket is full, wait
+ * until it becomes writable again. */
+static void cinet_connection_flush(CINetConnection *conn)
+{
+    CINetIOVector vectors[CINET_CONNECTION_MAX_VECTORS];
+    GPollableReturn res;
+    GError *error = NULL;
+    gsize written;
+    guint n;
+
+    while (!conn->closed &&
+            (n = cinet_msg_batch_get_vectors(conn->batch, vectors, CINET_CONNECTION_MAX_VECTORS)) > 0) {
+        /* CINetIOVector has the layout of GOutputVector. */
+        res = g_pollable_output_stream_writev_nonblocking(conn->output, (const GOutputVector*)vectors, n,
+                                                          &written, NULL, &error);
+        if (res == G_POLLABLE_RETURN_WOULD_BLOCK) {
+            cinet_connection_attach(conn, &conn->out_source,
+                                    g_pollable_output_stream_create_source(conn->output, NULL),
+                                    (GSourceFunc)cinet_connection_output_ready);
+            break;
+        }
+        if (res == G_POLLABLE_RETURN_FAILED) {
+            cinet_connection_fail(conn, error);
+            g_error_free(error);
+            return;
+        }
+        cinet_msg_batch_consume(conn->batch, written);
+    }
+
+    if (!conn->closed && conn->shutdown && cinet_msg_batch_get_pending(conn->batch) == 0) {
+        cinet_connection_fail(conn, NULL);
+        return;
+    }
+
+    cinet_connection_update_congestion(conn);
+}
+
+/* Flush once the context runs, so that messages queued in the meantime are
+ * written together. */
+static void cinet_connection_schedule_flush(CINetConnection *conn)
+{
+    if (conn->out_source == NULL)
+        cinet_connection_attach(conn, &conn->out_source, g_idle_source_new(), cinet_connection_output_idle);
+}
+
+static gboolean cinet_connection_output_idle(gpointer userdata)
+{
+    CINetConnection *conn = userdata;
+
+    cinet_connection_ref(conn);
+    cinet_connection_clear_source(&conn->out_source);
+    cinet_connection_flush(conn);
+    cinet_connection_unref(conn);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean cinet_connection_output_ready(GObject *stream, gpointer userdata)
+{
+    return cinet_connection_output_idle(userdata);
+}
+
+static gboolean cinet_connection_input_ready(GObject *stream, gpointer userdata)
+{
+    CINetConnection *conn = userdata;
+    GError *error = NULL;
+    CINetMsg *msg;
+    gchar *buffer;
+    gsize len;
+    gssize n;
+    guint i;
+
+    cinet_connection_ref(conn);
+
+    for (i = 0; i < CINET_CONNECTION_MAX_READS && !conn->closed; ++i) {
+        buffer = cinet_msg_reader_get_buffer(conn->reader, &len);
+        n = g_pollable_input_stream_read_nonblocking(conn->input, buffer, len, NULL, &error);
+        if (n < 0) {
+            if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+                cinet_connection_fail(conn, error);
+            g_error_free(error);
+            break;
+        }
+        if (n == 0) {
+            cinet_connection_fail(conn, NULL);
+            break;
+        }
+
+        cinet_msg_reader_commit(conn->reader, n);
+        while (!conn->closed && cinet_msg_reader_next_msg(conn->reader, &msg)) {
+            if (conn->callbacks.message)
+                conn->callbacks.message(conn, msg, conn->userdata);
+            cinet_msg_unref(msg);
+        }
+    }
+
+    cinet_connection_unref(conn);
+
+    /* A closed connection already removed the source. */
+    return G_SOURCE_CONTINUE;
+}
+
+void cinet_connection_set_flags(CINetConnection *conn, guint32 flags)
+{
+    if (conn)
+        conn->flags = flags & CINET_MSG_FLAGS_SUPPORTED;
+}
+
+void cinet_connection_set_high_water(CINetConnection *conn, gsize high_water)
+{
+    if (!conn)
+        return;
+
+    conn->high_water = high_water ? high_water : CINET_CONNECTION_DEFAULT_HIGH_WATER;
+}
+
+/* Write queued data soon and report backpressure. */
+static void cinet_connection_queued(CINetConnection *conn)
+{
+    cinet_connection_schedule_flush(conn);
+
+    cinet_connection_ref(conn);
+    cinet_connection_update_congestion(conn);
+    cinet_connection_unref(conn);
+}
+
+void cinet_connection_shutdown(CINetConnection *conn)
+{
+    if (!conn || conn->closed || conn->shutdown)
+        return;
+
+    conn->shutdown = TRUE;
+    cinet_connection_clear_source(&conn->in_source);
+    /* Even with nothing pending the connection is closed from the context,
+     * so the callback is never called from within this function. */
+    cinet_connection_schedule_flush(conn);
+}
+
+gint cinet_connection_send(CINetConnection *conn, CINetMsg *msg)
+{
+    if (!conn || conn->closed || conn->shutdown)
+        return -1;
+
+    if (cinet_msg_batch_add_msg(conn->batch, msg, conn->flags) != 0)
+        return -1;
+
+    cinet_connection_queued(conn);
+    return 0;
+}
+
+gint cinet_connection_send_bytes(CINetConnection *conn, GBytes *frame)
+{
+    if (!conn || conn->closed || conn->shutdown)
+        return -1;
+
+    if (cinet_msg_batch_add_bytes(conn->batch, frame) != 0)
+        return -1;
+
+    cinet_connection_queued(conn);
+    return 0;
+}
+
+gsize cinet_connection_get_pending(CINetConnection *conn)
+{
+    return conn ? cinet_msg_batch_get_pending(conn->batch) : 0;
+}
+
+gboolean cinet_connection_is_congested(CINetConnection *conn)
+{
+    return conn ? conn->congested : FALSE;
+}
+
+gboolean cinet_connection_is_open(CINetConnection *conn)
+{
+    return conn ? !conn->closed : FALSE;
+}
@@ -0,0 +1,139 @@
+#ifndef __CINET_CONNECTION_H__
+#define __CINET_CONNECTION_H__
+
+#include <gio/gio.h>
+#include <cinet.h>
+
+/* A connection to a peer driven by a @GMainContext. Frames are read without
+ * blocking as soon as data arrives and decoded messages are passed to a
+ * callback. Outgoing messages are queued and written when the socket is
+ * writable. A connection must only be used from the thread running its
+ * context. */
+typedef struct _CINetConnection CINetConnection;
+
+/* Outgoing data above this size is reported as backpressure. */
+#define CINET_CONNECTION_DEFAULT_HIGH_WATER (1024 * 1024)
+
+/* Callbacks of a connection. Each of them may be NULL. The connection may be
+ * closed or unreferenced from within any of them. */
+typedef struct {
+    /* A message was received. The message is freed after the call, use
+     * @cinet_msg_ref() to keep it. */
+    void (*message)(CINetConnection *conn, CINetMsg *msg, gpointer userdata);
+
+    /* The outgoing data crossed the high-water mark (@congested is TRUE) or
+     * dropped back to half of it (@congested is FALSE). Messages can still be
+     * sent while congested, but producers should slow down. */
+    void (*backpressure)(CINetConnection *conn, gboolean congested, gpointer userdata);
+
+    /* The peer closed the connection or a shutdown finished (@error is NULL),
+     * or an error occured. Nothing is read or written afterwards. Not called
+     * for @cinet_connection_close(). */
+    void (*closed)(CINetConnection *conn, const GError *error, gpointer userdata);
+} CINetConnectionCallbacks;
+
+/* Create a connection on a stream and start reading. Sources are attached
+ * to @context.
+ *
+ * @stream:    The stream, e.g. a @GSocketConnection. Its input and output
+ *             streams have to be pollable.
+ * @context:   The context to run in, NULL for the global default context.
+ * @callbacks: The callbacks. They are copied.
+ * @userdata:  Data passed to the callbacks.
+ *
+ * @return:    The new connection, or NULL if the stream is not pollable.
+ *             Release with @cinet_connection_unref().
+ */
+CINetConnection *cinet_connection_new(GIOStream *stream, GMainContext *context,
+                                      const CINetConnectionCallbacks *callbacks, gpointer userdata);
+
+/* Take a reference to a connection.
+ *
+ * @conn:   The connection.
+ *
+ * @return: @conn.
+ */
+CINetConnection *cinet_connection_ref(CINetConnection *conn);
+
+/* Release a reference. The last one closes the connection and frees it.
+ *
+ * @conn: The connection.
+ */
+void cinet_connection_unref(CINetConnection *conn);
+
+/* Stop reading and writing and close the stream. Data not written yet is
+ * dropped, use @cinet_connection_get_pending() to check for it before.
+ *
+ * @conn: The connection.
+ */
+void cinet_connection_close(CINetConnection *conn);
+
+/* Stop reading and close the connection once all queued data is written,
+ * e.g. after sending @CI_NET_MSG_SHUTDOWN. The closed callback is called
+ * then. Nothing can be sent afterwards.
+ *
+ * @conn: The connection.
+ */
+void cinet_connection_shutdown(CINetConnection *conn);
+
+/* Set the encoding of outgoing payloads, e.g. from
+ * @cinet_msg_flags_for_features() once the peer announced its features.
+ *
+ * @conn:  The connection.
+ * @flags: A combination of @CINetMsgFlags.
+ */
+void cinet_connection_set_flags(CINetConnection *conn, guint32 flags);
+
+/* Set the high-water mark for outgoing data.
+ *
+ * @conn:       The connection.
+ * @high_water: Size in bytes. 0 for @CINET_CONNECTION_DEFAULT_HIGH_WATER.
+ */
+void cinet_connection_set_high_water(CINetConnection *conn, gsize high_water);
+
+/* Queue a message. It is written once the context runs and the socket is
+ * writable, together with other messages queued in the meantime.
+ *
+ * @conn:   The connection.
+ * @msg:    The message. It is not needed after this call.
+ *
+ * @return: 0 on success, -1 if the message cannot be encoded or the
+ *          connection is closed or shut down.
+ */
+gint cinet_connection_send(CINetConnection *conn, CINetMsg *msg);
+
+/* Queue a complete frame, e.g. from @cinet_msg_write_bytes() to send the
+ * same message to many peers.
+ *
+ * @conn:   The connection.
+ * @frame:  The frame. The connection holds a reference until it is written.
+ *
+ * @return: 0 on success, -1 if the connection is closed or shut down.
+ */
+gint cinet_connection_send_bytes(CINetConnection *conn, GBytes *frame);
+
+/* Get the number of bytes queued but not written yet.
+ *
+ * @conn:   The connection.
+ *
+ * @return: Number of bytes pending.
+ */
+gsize cinet_connection_get_pending(CINetConnection *conn);
+
+/* Check if outgoing data is above the high-water mark.
+ *
+ * @conn:   The connection.
+ *
+ * @return: TRUE if the connection is congested.
+ */
+gboolean cinet_connection_is_congested(CINetConnection *conn);
+
+/* Check if the connection is still open.
+ *
+ * @conn:   The connection.
+ *
+ * @return: TRUE if the connection is neither closed nor failed.
+ */
+gboolean cinet_connection_is_open(CINetConnection *conn);
+
+#endif
@@ -0,0 +1,626 @@
+#include "cinethub.h"
+#include <string.h>
+
+/* Data held by the connection of a client, beyond that events are queued. */
+#define CINET_HUB_HIGH_WATER (64 * 1024)
+
+typedef struct _CINetHubReactor CINetHubReactor;
+
+/* An event shared by all reactors. It is encoded on first use for each
+ * payload encoding, the frames are shared by all clients using it. */
+typedef struct {
+    gint refcount;
+    CINetMsg *msg;
+    gint stage;                       /* Stage of a multipart message, -1 otherwise. */
+    GMutex lock;                      /* Protects @frames. */
+    GBytes *frames[CINET_MSG_FLAGS_SUPPORTED + 1];
+} CINetHubEvent;
+
+struct _CINetHubReactor {
+    CINetHub *hub;
+    GMainContext *context;
+    GMainLoop *loop;
+    GThread *thread;
+    GQueue clients;                   /* Only used in the reactor thread. */
+    gint n_clients;
+};
+
+struct _CINetHubClient {
+    CINetHubReactor *reactor;
+    CINetConnection *conn;
+    GList *link;                      /* Link in the clients of the reactor. */
+    GQueue events;                    /* Events not passed to the connection yet. */
+    guint32 flags;                    /* Encoding of payloads. [type: CINetMsgFlags] */
+    guint32 features;                 /* Features announced by both sides. [type: CINetFeatures] */
+    CINetHubPolicy policy;
+    guint max_queue;
+    gboolean closing;                 /* Shut down once @events is empty. */
+    gpointer data;
+};
+
+struct _CINetHub {
+    CINetHubReactor *reactors;
+    guint n_reactors;
+    CINetHubCallbacks callbacks;
+    gpointer userdata;
+    gint features;
+    gint policy;
+    gint max_queue;
+    gint shutdown;
+    GMutex lock;                      /* Protects @stats. */
+    CINetHubStats stats;
+};
+
+typedef struct {
+    CINetHubReactor *reactor;
+    CINetHubEvent *event;
+    GIOStream *stream;
+} CINetHubJob;
+
+static CINetHubEvent *cinet_hub_event_new(CINetMsg *msg)
+{
+    CINetHubEvent *event = g_malloc0(sizeof(CINetHubEvent));
+
+    event->refcount = 1;
+    event->msg = cinet_msg_ref(msg);
+    event->stage = -1;
+    if (msg->msgtype == CI_NET_MSG_EVENT_RING && ((CINetMsgMultipart*)msg)->msgid[0])
+        event->stage = ((CINetMsgMultipart*)msg)->stage;
+    g_mutex_init(&event->lock);
+
+    return event;
+}
+
+static CINetHubEvent *cinet_hub_event_ref(CINetHubEvent *event)
+{
+    g_atomic_int_inc(&event->refcount);
+    return event;
+}
+
+static void cinet_hub_event_unref(CINetHubEvent *event)
+{
+    guint i;
+
+    if (!g_atomic_int_dec_and_test(&event->refcount))
+        return;
+
+    for (i = 0; i < G_N_ELEMENTS(event->frames); ++i) {
+        if (event->frames[i])
+            g_bytes_unref(event->frames[i]);
+    }
+    g_mutex_clear(&event->lock);
+    cinet_msg_unref(event->msg);
+    g_free(event);
+}
+
+/* Get the frame of an event for an encoding. It is valid as long as the
+ * event.
+ *
+ * @event:  The event.
+ * @flags:  The encoding, a combination of @CINetMsgFlags.
+ *
+ * @return: The frame or NULL if the event cannot be encoded.
+ */
+static GBytes *cinet_hub_event_get_frame(CINetHubEvent *event, guint32 flags)
+{
+    GBytes *frame;
+
+    flags &= CINET_MSG_FLAGS_SUPPORTED;
+
+    g_mutex_lock(&event->lock);
+    if (event->frames[flags] == NULL)
+        event->frames[flags] = cinet_msg_write_bytes(event->msg, flags);
+    frame = event->frames[flags];
+    g_mutex_unlock(&event->lock);
+
+    return frame;
+}
+
+/* Check if two events are stages of the same RING. */
+static gboolean cinet_hub_event_same_ring(CINetHubEvent *event, CINetHubEvent *other)
+{
+    return event->stage >= 0 && other->stage >= 0 &&
+           strncmp(((CINetMsgMultipart*)event->msg)->msgid, ((CINetMsgMultipart*)other->msg)->msgid, 16) == 0;
+}
+
+/* Merge the queued @event into @newer. With @CI_NET_FEATURE_DELTA Updates
+ * carry only the members that changed, so the members of @event are kept
+ * unless @newer has them. Otherwise @newer holds the whole state.
+ *
+ * @event:  The older event.
+ * @newer:  The event following it.
+ * @stage:  The stage of the result.
+ * @delta:  Whether the stages carry only the members that changed.
+ *
+ * @return: A new event.
+ */
+static CINetHubEvent *cinet_hub_event_merge(CINetHubEvent *event, CINetHubEvent *newer, CINetMsgMultipartStage stage,
+                                            gboolean delta)
+{
+    CINetMsgEventRing *older = (CINetMsgEventRing*)event->msg;
+    CINetMsgEventRing *ring;
+    CINetHubEvent *merged;
+
+    ring = (CINetMsgEventRing*)cinet_msg_alloc(CI_NET_MSG_EVENT_RING);
+    ring->parent.parent.guid = newer->msg->guid;
+    ring->parent.stage = stage;
+    ring->parent.part = stage == MultipartStageInit ? older->parent.part : ((CINetMsgMultipart*)newer->msg)->part;
+    memcpy(ring->parent.msgid, older->parent.msgid, sizeof(ring->parent.msgid));
+    if (delta) {
+        cinet_call_info_copy(&ring->callinfo, &older->callinfo);
+        cinet_call_info_merge(&ring->callinfo, &((CINetMsgEventRing*)newer->msg)->callinfo);
+    }
+    else
+        cinet_call_info_copy(&ring->callinfo, &((CINetMsgEventRing*)newer->msg)->callinfo);
+
+    merged = cinet_hub_event_new((CINetMsg*)ring);
+    cinet_msg_unref((CINetMsg*)ring);
+
+    return merged;
+}
+
+/* Find the next event of the same RING queued after @link. */
+static GList *cinet_hub_event_find_next(GList *link)
+{
+    CINetHubEvent *event = link->data;
+
+    for (link = link->next; link; link = link->next) {
+        if (cinet_hub_event_same_ring(event, link->data))
+            return link;
+    }
+
+    return NULL;
+}
+
+static void cinet_hub_count(CINetHub *hub, guint64 events, guint64 frames, guint64 coalesced, guint64 dropped)
+{
+    g_mutex_lock(&hub->lock);
+    hub->stats.events += events;
+    hub->stats.frames += frames;
+    hub->stats.coalesced += coalesced;
+    hub->stats.dropped += dropped;
+    g_mutex_unlock(&hub->lock);
+}
+
+static void cinet_hub_client_remove(CINetHubClient *client)
+{
+    CINetHubReactor *reactor = client->reactor;
+    CINetHub *hub = reactor->hub;
+    CINetHubEvent *event;
+
+    g_queue_delete_link(&reactor->clients, client->link);
+    g_atomic_int_add(&reactor->n_clients, -1);
+
+    if (hub->callbacks.removed)
+        hub->callbacks.removed(hub, client, hub->userdata);
+
+    while ((event = g_queue_pop_head(&client->events)) != NULL)
+        cinet_hub_event_unref(event);
+
+    cinet_connection_close(client->conn);
+    cinet_connection_unref(client->conn);
+    g_free(client);
+}
+
+/* Pass queued events to the connection as long as it is not congested. */
+static void cinet_hub_client_feed(CINetHubClient *client)
+{
+    CINetHubEvent *event;
+    GBytes *frame;
+    guint64 frames = 0;
+
+    while (!cinet_connection_is_congested(client->conn) &&
+            (event = g_queue_pop_head(&client->events)) != NULL) {
+        frame = cinet_hub_event_get_frame(event, client->flags);
+        if (frame && cinet_connection_send_bytes(client->conn, frame) == 0)
+            ++frames;
+        cinet_hub_event_unref(event);
+    }
+
+    if (frames)
+        cinet_hub_count(client->reactor->hub, 0, frames, 0, 0);
+
+    if (client->closing && g_queue_is_empty(&client->events))
+        cinet_connection_shutdown(client->conn);
+}
+
+/* Make room in a full queue by merging the oldest Update stage into the
+ * Complete stage of its RING, either queued or @event.
+ *
+ * @client: The client.
+ * @event:  The event to be queued.
+ *
+ * @return: A reference to the event to queue instead of @event, or NULL if
+ *          there is no such Update.
+ */
+static CINetHubEvent *cinet_hub_client_fold(CINetHubClient *client, CINetHubEvent *event)
+{
+    CINetHubEvent *update, *complete, *merged;
+    GList *link, *next;
+
+    for (link = client->events.head; link; link = link->next) {
+        update = link->data;
+        if (update->stage != MultipartStageUpdate)
+            continue;
+        if ((next = cinet_hub_event_find_next(link)) != NULL)
+            complete = next->data;
+        else if (cinet_hub_event_same_ring(update, event))
+            complete = event;
+        else
+            continue;
+        if (complete->stage != MultipartStageComplete)
+            continue;
+
+        merged = cinet_hub_event_merge(update, complete, MultipartStageComplete,
+                                       client->features & CI_NET_FEATURE_DELTA);
+        cinet_hub_event_unref(update);
+        g_queue_delete_link(&client->events, link);
+        if (next == NULL)
+            return merged;
+        cinet_hub_event_unref(next->data);
+        next->data = merged;
+        return cinet_hub_event_ref(event);
+    }
+
+    return NULL;
+}
+
+/* Queue an event for a client, applying its policy if the queue is full.
+ *
+ * @client: The client.
+ * @event:  The event.
+ * @force:  Queue the event even if the queue is full.
+ *
+ * @return: FALSE if the client was removed.
+ */
+static gboolean cinet_hub_client_push(CINetHubClient *client, CINetHubEvent *event, gboolean force)
+{
+    CINetHub *hub = client->reactor->hub;
+    CINetHubEvent *queued;
+    GList *link;
+
+    if (client->closing)
+        return TRUE;
+
+    if (client->policy == CINET_HUB_POLICY_COALESCE && event->stage == MultipartStageUpdate) {
+        /* Merge into the last stage queued unless it is the Complete one. */
+        for (link = client->events.tail; link; link = link->prev) {
+            queued = link->data;
+            if (!cinet_hub_event_same_ring(event, queued))
+                continue;
+            if (queued->stage == MultipartStageComplete)
+                break;
+            link->data = cinet_hub_event_merge(queued, event, queued->stage,
+                                               client->features & CI_NET_FEATURE_DELTA);
+            cinet_hub_event_unref(queued);
+            cinet_hub_count(hub, 0, 0, 1, 0);
+            return TRUE;
+        }
+    }
+
+    if (!force && client->events.length >= client->max_queue) {
+        if (client->policy != CINET_HUB_POLICY_COALESCE ||
+                (event = cinet_hub_client_fold(client, event)) == NULL) {
+            cinet_hub_count(hub, 0, 0, 0, 1);
+            cinet_hub_client_remove(client);
+            return FALSE;
+        }
+        cinet_hub_count(hub, 0, 0, 1, 0);
+    }
+    else
+        cinet_hub_event_ref(event);
+
+    g_queue_push_tail(&client->events, event);
+    cinet_hub_client_feed(client);
+
+    return TRUE;
+}
+
+static void cinet_hub_client_message(CINetConnection *conn, CINetMsg *msg, gpointer userdata)
+{
+    CINetHubClient *client = userdata;
+    CINetHub *hub = client->reactor->hub;
+    CINetHubEvent *event;
+
+    if (client->closing)
+        return;
+
+    if (msg->msgtype == CI_NET_MSG_LEAVE) {
+        /* Nothing is sent to a client leaving, but what the connection
+         * holds already is still written. */
+        while ((event = g_queue_pop_head(&client->events)) != NULL)
+            cinet_hub_event_unref(event);
+        client->closing = TRUE;
+        cinet_connection_shutdown(client->conn);
+        return;
+    }
+
+    if (msg->msgtype == CI_NET_MSG_VERSION) {
+        client->features = ((CINetMsgVersion*)msg)->features & (guint32)g_atomic_int_get(&hub->features);
+        client->flags = cinet_msg_flags_for_features(client->features);
+        cinet_connection_set_flags(client->conn, client->flags);
+    }
+
+    if (hub->callbacks.message)
+        hub->callbacks.message(hub, client, msg, hub->userdata);
+}
+
+static void cinet_hub_client_backpressure(CINetConnection *conn, gboolean congested, gpointer userdata)
+{
+    if (!congested)
+        cinet_hub_client_feed(userdata);
+}
+
+static void cinet_hub_client_closed(CINetConnection *conn, const GError *error, gpointer userdata)
+{
+    cinet_hub_client_remove(userdata);
+}
+
+static const CINetConnectionCallbacks cinet_hub_client_callbacks = {
+    cinet_hub_client_message,
+    cinet_hub_client_backpressure,
+    cinet_hub_client_closed
+};
+
+static void cinet_hub_job_free(gpointer data)
+{
+    CINetHubJob *job = data;
+
+    if (job->event)
+        cinet_hub_event_unref(job->event);
+    if (job->stream)
+        g_object_unref(job->stream);
+    g_free(job);
+}
+
+/* Run @func with a new job in the thread of @reactor. */
+static void cinet_hub_invoke(CINetHubReactor *reactor, GSourceFunc func, CINetHubEvent *event, GIOStream *stream)
+{
+    CINetHubJob *job = g_malloc0(sizeof(CINetHubJob));
+
+    job->reactor = reactor;
+    job->event = event ? cinet_hub_event_ref(event) : NULL;
+    job->stream = stream ? g_object_ref(stream) : NULL;
+    g_main_context_invoke_full(reactor->context, G_PRIORITY_DEFAULT, func, job, cinet_hub_job_free);
+}
+
+static gboolean cinet_hub_add_job(gpointer data)
+{
+    CINetHubJob *job = data;
+    CINetHubReactor *reactor = job->reactor;
+    CINetHubClient *client = g_malloc0(sizeof(CINetHubClient));
+
+    client->reactor = reactor;
+    client->policy = (CINetHubPolicy)g_atomic_int_get(&reactor->hub->policy);
+    client->max_queue = (guint)g_atomic_int_get(&reactor->hub->max_queue);
+    client->conn = cinet_connection_new(job->stream, reactor->context, &cinet_hub_client_callbacks, client);
+    cinet_connection_set_high_water(client->conn, CINET_HUB_HIGH_WATER);
+    g_queue_init(&client->events);
+
+    g_queue_push_tail(&reactor->clients, client);
+    client->link = reactor->clients.tail;
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean cinet_hub_broadcast_job(gpointer data)
+{
+    CINetHubJob *job = data;
+    GList *link, *next;
+
+    /* Clients may be removed while pushing. */
+    for (link = job->reactor->clients.head; link; link = next) {
+        next = link->next;
+        cinet_hub_client_push(link->data, job->event, FALSE);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean cinet_hub_shutdown_job(gpointer data)
+{
+    CINetHubJob *job = data;
+    CINetHubClient *client;
+    GList *link;
+
+    for (link = job->reactor->clients.head; link; link = link->next) {
+        client = link->data;
+        /* The shutdown is always delivered after the pending events. */
+        cinet_hub_client_push(client, job->event, TRUE);
+        client->closing = TRUE;
+        cinet_hub_client_feed(client);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean cinet_hub_stop_job(gpointer data)
+{
+    CINetHubJob *job = data;
+
+    while (!g_queue_is_empty(&job->reactor->clients))
+        cinet_hub_client_remove(g_queue_peek_head(&job->reactor->clients));
+    g_main_loop_quit(job->reactor->loop);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gpointer cinet_hub_reactor_run(gpointer data)
+{
+    CINetHubReactor *reactor = data;
+
+    g_main_context_push_thread_default(reactor->context);
+    g_main_loop_run(reactor->loop);
+    g_main_context_pop_thread_default(reactor->context);
+
+    return NULL;
+}
+
+CINetHub *cinet_hub_new(guint n_threads, const CINetHubCallbacks *callbacks, gpointer userdata)
+{
+    CINetHub *hub = g_malloc0(sizeof(CINetHub));
+    CINetHubReactor *reactor;
+    guint i;
+
+    if (n_threads == 0)
+        n_threads = g_get_num_processors();
+
+    if (callbacks)
+        hub->callbacks = *callbacks;
+    hub->userdata = userdata;
+    hub->policy = CINET_HUB_POLICY_DISCONNECT;
+    hub->max_queue = CINET_HUB_DEFAULT_MAX_QUEUE;
+    g_mutex_init(&hub->lock);
+
+    hub->n_reactors = n_threads;
+    hub->reactors = g_malloc0(n_threads * sizeof(CINetHubReactor));
+    for (i = 0; i < n_threads; ++i) {
+        reactor = &hub->reactors[i];
+        reactor->hub = hub;
+        reactor->context = g_main_context_new();
+        reactor->loop = g_main_loop_new(reactor->context, FALSE);
+        g_queue_init(&reactor->clients);
+        reactor->thread = g_thread_new("cinet-hub", cinet_hub_reactor_run, reactor);
+    }
+
+    return hub;
+}
+
+void cinet_hub_free(CINetHub *hub)
+{
+    guint i;
+
+    if (!hub)
+        return;
+
+    g_atomic_int_set(&hub->shutdown, 1);
+
+    for (i = 0; i < hub->n_reactors; ++i)
+        cinet_hub_invoke(&hub->reactors[i], cinet_hub_stop_job, NULL, NULL);
+
+    for (i = 0; i < hub->n_reactors; ++i) {
+        g_thread_join(hub->reactors[i].thread);
+        g_main_loop_unref(hub->reactors[i].loop);
+        g_main_context_unref(hub->reactors[i].context);
+    }
+
+    g_mutex_clear(&hub->lock);
+    g_free(hub->reactors);
+    g_free(hub);
+}
+
+void cinet_hub_set_features(CINetHub *hub, guint32 features)
+{
+    if (hub)
+        g_atomic_int_set(&hub->features, (gint)(features & CINET_FEATURES_SUPPORTED));
+}
+
+void cinet_hub_set_policy(CINetHub *hub, CINetHubPolicy policy, guint max_queue)
+{
+    if (!hub)
+        return;
+
+    g_atomic_int_set(&hub->policy, policy);
+    g_atomic_int_set(&hub->max_queue, max_queue ? (gint)MIN(max_queue, G_MAXINT) : CINET_HUB_DEFAULT_MAX_QUEUE);
+}
+
+gint cinet_hub_add_stream(CINetHub *hub, GIOStream *stream)
+{
+    CINetHubReactor *reactor;
+    GInputStream *input;
+    GOutputStream *output;
+    guint i;
+
+    if (!hub || !stream || g_atomic_int_get(&hub->shutdown))
+        return -1;
+
+    /* Checked here, so that the connection cannot fail in the reactor. */
+    input = g_io_stream_get_input_stream(stream);
+    output = g_io_stream_get_output_stream(stream);
+    if (!G_IS_POLLABLE_INPUT_STREAM(input) || !G_IS_POLLABLE_OUTPUT_STREAM(output) ||
+            !g_pollable_input_stream_can_poll(G_POLLABLE_INPUT_STREAM(input)) ||
+            !g_pollable_output_stream_can_poll(G_POLLABLE_OUTPUT_STREAM(output)))
+        return -1;
+
+    reactor = &hub->reactors[0];
+    for (i = 1; i < hub->n_reactors; ++i) {
+        if (g_atomic_int_get(&hub->reactors[i].n_clients) < g_atomic_int_get(&reactor->n_clients))
+            reactor = &hub->reactors[i];
+    }
+    g_atomic_int_inc(&reactor->n_clients);
+
+    cinet_hub_invoke(reactor, cinet_hub_add_job, NULL, stream);
+
+    return 0;
+}
+
+gint cinet_hub_broadcast(CINetHub *hub, CINetMsg *msg)
+{
+    CINetHubEvent *event;
+    guint i;
+
+    if (!hub || !msg || g_atomic_int_get(&hub->shutdown))
+        return -1;
+
+    event = cinet_hub_event_new(msg);
+    for (i = 0; i < hub->n_reactors; ++i)
+        cinet_hub_invoke(&hub->reactors[i], cinet_hub_broadcast_job, event, NULL);
+    cinet_hub_event_unref(event);
+
+    cinet_hub_count(hub, 1, 0, 0, 0);
+
+    return 0;
+}
+
+void cinet_hub_shutdown(CINetHub *hub)
+{
+    CINetHubEvent *event;
+    CINetMsg *msg;
+    guint i;
+
+    if (!hub || !g_atomic_int_compare_and_exchange(&hub->shutdown, 0, 1))
+        return;
+
+    msg = cinet_msg_alloc(CI_NET_MSG_SHUTDOWN);
+    event = cinet_hub_event_new(msg);
+    cinet_msg_unref(msg);
+
+    for (i = 0; i < hub->n_reactors; ++i)
+        cinet_hub_invoke(&hub->reactors[i], cinet_hub_shutdown_job, event, NULL);
+    cinet_hub_event_unref(event);
+}
+
+void cinet_hub_get_stats(CINetHub *hub, CINetHubStats *stats)
+{
+    guint i;
+
+    if (!hub || !stats)
+        return;
+
+    g_mutex_lock(&hub->lock);
+    *stats = hub->stats;
+    g_mutex_unlock(&hub->lock);
+
+    stats->clients = 0;
+    for (i = 0; i < hub->n_reactors; ++i)
+        stats->clients += g_atomic_int_get(&hub->reactors[i].n_clients);
+}
+
+gint cinet_hub_client_send(CINetHubClient *client, CINetMsg *msg)
+{
+    if (!client || client->closing)
+        return -1;
+
+    return cinet_connection_send(client->conn, msg);
+}
+
+void cinet_hub_client_set_data(CINetHubClient *client, gpointer data)
+{
+    if (client)
+        client->data = data;
+}
+
+gpointer cinet_hub_client_get_data(CINetHubClient *client)
+{
+    return client ? client->data : NULL;
+}
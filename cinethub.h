@@ -0,0 +1,147 @@
+#ifndef __CINET_HUB_H__
+#define __CINET_HUB_H__
+
+#include <cinetconnection.h>
+
+/* A hub distributing events like @CI_NET_MSG_EVENT_RING and
+ * @CI_NET_MSG_EVENT_CALL to many clients. Clients are spread across several
+ * reactor threads, each running its own @GMainContext. Every event is encoded
+ * once per payload encoding and shared by all clients using it. Each client
+ * has a bounded queue of events not yet passed to its connection, a client
+ * whose queue is full is handled according to a @CINetHubPolicy. */
+typedef struct _CINetHub CINetHub;
+
+/* A client of a hub. Only valid in the reactor thread of the client until
+ * the removed callback returns. */
+typedef struct _CINetHubClient CINetHubClient;
+
+/* Default maximum number of events queued per client. */
+#define CINET_HUB_DEFAULT_MAX_QUEUE    256
+
+/* How to treat clients which cannot keep up with the events. */
+typedef enum {
+    CINET_HUB_POLICY_DISCONNECT = 0,  /* Close the connection once the queue is full. */
+    CINET_HUB_POLICY_COALESCE         /* Merge an Update stage of a RING into the stage queued last. Members
+                                         of the older stage are kept only for clients announcing
+                                         @CI_NET_FEATURE_DELTA, otherwise the newer stage replaces it. If the queue is
+                                         full, the oldest Update followed by the Complete stage is merged
+                                         into it. The client is only closed if there is nothing to merge. */
+} CINetHubPolicy;
+
+/* Counters of a hub. */
+typedef struct {
+    guint clients;                    /* Clients currently connected. */
+    guint64 events;                   /* Events broadcast. */
+    guint64 frames;                   /* Frames passed to connections. */
+    guint64 coalesced;                /* Events replaced or dropped by @CINET_HUB_POLICY_COALESCE. */
+    guint64 dropped;                  /* Clients closed because their queue was full. */
+} CINetHubStats;
+
+/* Callbacks of a hub. Each of them may be NULL. They are called in the
+ * reactor thread of the client. */
+typedef struct {
+    /* A message other than @CI_NET_MSG_LEAVE was received from a client.
+     * Replies can be sent with @cinet_hub_client_send(). The message is freed
+     * after the call, use @cinet_msg_ref() to keep it. */
+    void (*message)(CINetHub *hub, CINetHubClient *client, CINetMsg *msg, gpointer userdata);
+
+    /* A client is removed, because it left, was closed or the hub is freed. */
+    void (*removed)(CINetHub *hub, CINetHubClient *client, gpointer userdata);
+} CINetHubCallbacks;
+
+/* Create a hub and start its reactor threads.
+ *
+ * @n_threads: Number of reactor threads, 0 for the number of processors.
+ * @callbacks: The callbacks. They are copied.
+ * @userdata:  Data passed to the callbacks.
+ *
+ * @return:    The new hub. Free with @cinet_hub_free().
+ */
+CINetHub *cinet_hub_new(guint n_threads, const CINetHubCallbacks *callbacks, gpointer userdata);
+
+/* Stop all reactor threads, close all clients and free the hub. Must not be
+ * called from a reactor thread.
+ *
+ * @hub: The hub.
+ */
+void cinet_hub_free(CINetHub *hub);
+
+/* Set the features announced to the clients. Events are encoded for each
+ * client using the features announced by both sides in @CI_NET_MSG_VERSION.
+ * The default is 0, i.e. plain JSON.
+ *
+ * @hub:      The hub.
+ * @features: A combination of @CINetFeatures.
+ */
+void cinet_hub_set_features(CINetHub *hub, guint32 features);
+
+/* Set how to treat slow clients. Only affects clients added afterwards.
+ *
+ * @hub:       The hub.
+ * @policy:    The policy.
+ * @max_queue: Maximum number of events queued per client. 0 for
+ *             @CINET_HUB_DEFAULT_MAX_QUEUE.
+ */
+void cinet_hub_set_policy(CINetHub *hub, CINetHubPolicy policy, guint max_queue);
+
+/* Add a client, e.g. a connection accepted by a @GSocketService. It is
+ * assigned to the reactor with the fewest clients.
+ *
+ * @hub:    The hub.
+ * @stream: The stream to the client. The hub takes a reference.
+ *
+ * @return: 0 on success, -1 if the stream is not pollable or the hub is shut down.
+ */
+gint cinet_hub_add_stream(CINetHub *hub, GIOStream *stream);
+
+/* Send an event to all clients. The event is queued in the reactor threads
+ * and this function returns immediately.
+ *
+ * @hub:    The hub.
+ * @msg:    The event. The hub takes a reference, the message must not be
+ *          changed afterwards.
+ *
+ * @return: 0 on success, -1 if the hub is shut down.
+ */
+gint cinet_hub_broadcast(CINetHub *hub, CINetMsg *msg);
+
+/* Send @CI_NET_MSG_SHUTDOWN to all clients and close their connections once
+ * everything queued is written. No clients can be added afterwards.
+ *
+ * @hub: The hub.
+ */
+void cinet_hub_shutdown(CINetHub *hub);
+
+/* Get the counters of the hub.
+ *
+ * @hub:   The hub.
+ * @stats: Return location for the counters.
+ */
+void cinet_hub_get_stats(CINetHub *hub, CINetHubStats *stats);
+
+/* Send a message to one client, e.g. a reply. Only call from the reactor
+ * thread of the client. The message is not queued behind pending events.
+ *
+ * @client: The client.
+ * @msg:    The message.
+ *
+ * @return: 0 on success, -1 otherwise.
+ */
+gint cinet_hub_client_send(CINetHubClient *client, CINetMsg *msg);
+
+/* Attach application data to a client.
+ *
+ * @client: The client.
+ * @data:   The data.
+ */
+void cinet_hub_client_set_data(CINetHubClient *client, gpointer data);
+
+/* Get the data attached with @cinet_hub_client_set_data().
+ *
+ * @client: The client.
+ *
+ * @return: The data or NULL.
+ */
+gpointer cinet_hub_client_get_data(CINetHubClient *client);
+
+#endif
@@ -24,10 +24,65 @@ typedef enum {
     CI_NET_MSG_INVALID = 32767        /* invalid message type */
 } CINetMsgType;
 
+/* Members of the messages. These identify a member for the setters
+ * without looking up its name. */
+typedef enum {
+    CI_NET_FIELD_UNKNOWN = 0,         /* Not a member of any message. */
+    CI_NET_FIELD_GUID,                /* guid, all messages */
+    CI_NET_FIELD_MAJOR,               /* CINetMsgVersion */
+    CI_NET_FIELD_MINOR,
+    CI_NET_FIELD_PATCH,
+    CI_NET_FIELD_HUMAN_READABLE,
+    CI_NET_FIELD_FEATURES,
+    CI_NET_FIELD_STAGE,               /* CINetMsgMultipart */
+    CI_NET_FIELD_PART,
+    CI_NET_FIELD_MSGID,
+    CI_NET_FIELD_ID,                  /* CICallInfo, same order as the members */
+    CI_NET_FIELD_COMPLETENUMBER,
+    CI_NET_FIELD_AREACODE,
+    CI_NET_FIELD_NUMBER,              /* also CICallerInfo */
+    CI_NET_FIELD_DATE,
+    CI_NET_FIELD_TIME,
+    CI_NET_FIELD_MSN,
+    CI_NET_FIELD_ALIAS,
+    CI_NET_FIELD_AREA,
+    CI_NET_FIELD_NAME,                /* also CICallerInfo */
+    CI_NET_FIELD_COUNT,               /* DB messages */
+    CI_NET_FIELD_USER,
+    CI_NET_FIELD_OFFSET,
+    CI_NET_FIELD_CALLS,               /* Array of calls, only in the payload. */
+    CI_NET_FIELD_CALL,                /* Append a CICallInfo to a call list. */
+    CI_NET_FIELD_FILTER,
+    CI_NET_FIELD_CALLERS,             /* Array of callers, only in the payload. */
+    CI_NET_FIELD_CALLER               /* Append a CICallerInfo to a caller list. */
+} CINetMsgField;
+
+/* Flags describing the encoding of the payload. These are sent in the upper
+ * 16 bits of the type field of the header and may only be used if the peer
+ * announced the corresponding feature. */
+typedef enum {
+    CI_NET_MSG_FLAG_BINARY = (1<<0),  /* Payload uses the binary encoding instead of JSON. */
+    CI_NET_MSG_FLAG_COLUMNS = (1<<1), /* Lists in a binary payload may be sent as columns. */
+    CI_NET_MSG_FLAG_COMPRESSED = (1<<2), /* Payload is compressed with zlib. */
+    CI_NET_MSG_FLAG_CHECKSUM = (1<<3) /* Payload ends with a CRC32C of the frame. */
+} CINetMsgFlags;
+
+/* Optional features announced in the version message. */
+typedef enum {
+    CI_NET_FEATURE_BINARY = (1<<0),   /* Peer can read binary payloads. */
+    CI_NET_FEATURE_COLUMNS = (1<<1),  /* Peer can read columnar lists in binary payloads. */
+    CI_NET_FEATURE_PARTS = (1<<2),    /* Peer can reassemble call lists sent in parts. */
+    CI_NET_FEATURE_COMPRESSION = (1<<3), /* Peer can read compressed payloads. */
+    CI_NET_FEATURE_CHECKSUM = (1<<4), /* Peer can check frames with a CRC32C. */
+    CI_NET_FEATURE_DELTA = (1<<5)     /* Peer merges Update stages carrying only changed members. */
+} CINetFeatures;
+
 /* Message header */
 typedef struct {
     CINetMsgType msgtype;             /* Type of the message. */
     guint32 msglen;                   /* Size of message payload. */
+    guint32 flags;                    /* Encoding of the payload, set by @cinet_msg_read_header().
+                                         [type: CINetMsgFlags] */
 } CINetMsgHeader;
 
 /* Base class for all messages. Not used directly. */
@@ -35,6 +90,7 @@ typedef struct {
     CINetMsgType msgtype;             /* Type of the message */
     guint32 guid;                     /* Application-specific identifier. This is intended to be
                                          returned in answers which may be useful for queries. */
+    gpointer priv;                    /* Private to the library, set by @cinet_msg_alloc(). */
 } CINetMsg;
 
 /* Version of the protocol. Should be at least 3.0.0. */
@@ -44,8 +100,25 @@ typedef struct {
     gint minor;                       /* Minor version number */
     gint patch;                       /* Patch version number */
     gchar *human_readable;            /* Version string to print. */
+    guint32 features;                 /* Optional features supported. [type: CINetFeatures] */
 } CINetMsgVersion;
 
+/* Schema of the messages. For each type the members following the guid are
+ * listed in the order they are sent as
+ *     F(type, member, name, field id, kind, option, flag)
+ * kind:   INT, UINT, STRING, MSGID (gchar[16]), CALL_INFO, CALLER_INFO (embedded),
+ *         CALL_LIST, CALLER_LIST (GList of the structures)
+ * option: NONE, OMIT (not sent in JSON if 0 or NULL, an empty MSGID is not sent at all),
+ *         EMPTY (NULL is sent as "" in JSON)
+ * flag:   Bit in @CINetMsgCallFields for members of @CICallInfo.
+ * The field numbers of the binary encoding follow from this order. */
+#define CI_NET_MSG_VERSION_SCHEMA(F) \
+    F(CINetMsgVersion, major, "major", CI_NET_FIELD_MAJOR, INT, NONE, 0) \
+    F(CINetMsgVersion, minor, "minor", CI_NET_FIELD_MINOR, INT, NONE, 0) \
+    F(CINetMsgVersion, patch, "patch", CI_NET_FIELD_PATCH, INT, NONE, 0) \
+    F(CINetMsgVersion, human_readable, "human_readable", CI_NET_FIELD_HUMAN_READABLE, STRING, EMPTY, 0) \
+    F(CINetMsgVersion, features, "features", CI_NET_FIELD_FEATURES, UINT, OMIT, 0)
+
 /* Stages for multipart messages.*/
 typedef enum {
     MultipartStageInit = 0,
@@ -59,7 +132,7 @@ typedef enum {
 typedef struct {
     CINetMsg parent;                  /* Derived from CINetMsg. */
     CINetMsgMultipartStage stage;     /* Indicates the stage this particular message belongs to. */
-    gint part;                        /* Consequtively numbered part of the message. Currently not used. */
+    gint part;                        /* Consequtively numbered part of the message, starting at 0. */
     gchar msgid[16];                  /* Application defined id of the message. Should be the same for all stages
                                          and unique for this message. */
 } CINetMsgMultipart;
@@ -79,24 +152,49 @@ typedef struct {
     guint32 fields;                   /* Fields set. */
 } CICallInfo;
 
+#define CI_CALL_INFO_SCHEMA(F) \
+    F(CICallInfo, id, "id", CI_NET_FIELD_ID, INT, NONE, 0) \
+    F(CICallInfo, completenumber, "completenumber", CI_NET_FIELD_COMPLETENUMBER, STRING, OMIT, CIF_COMPLETENUMBER) \
+    F(CICallInfo, areacode, "areacode", CI_NET_FIELD_AREACODE, STRING, OMIT, CIF_AREACODE) \
+    F(CICallInfo, number, "number", CI_NET_FIELD_NUMBER, STRING, OMIT, CIF_NUMBER) \
+    F(CICallInfo, date, "date", CI_NET_FIELD_DATE, STRING, OMIT, CIF_DATE) \
+    F(CICallInfo, time, "time", CI_NET_FIELD_TIME, STRING, OMIT, CIF_TIME) \
+    F(CICallInfo, msn, "msn", CI_NET_FIELD_MSN, STRING, OMIT, CIF_MSN) \
+    F(CICallInfo, alias, "alias", CI_NET_FIELD_ALIAS, STRING, OMIT, CIF_ALIAS) \
+    F(CICallInfo, area, "area", CI_NET_FIELD_AREA, STRING, OMIT, CIF_AREA) \
+    F(CICallInfo, name, "name", CI_NET_FIELD_NAME, STRING, OMIT, CIF_NAME)
+
 /* Detailed information about a caller. */
 typedef struct {
     gchar *number;                    /* The number of the caller including the area code. */
     gchar *name;                      /* The name of the caller. */
 } CICallerInfo;
 
+#define CI_CALLER_INFO_SCHEMA(F) \
+    F(CICallerInfo, number, "number", CI_NET_FIELD_NUMBER, STRING, OMIT, 0) \
+    F(CICallerInfo, name, "name", CI_NET_FIELD_NAME, STRING, OMIT, 0)
+
 /* RING message. Someone calls. */
 typedef struct {
     CINetMsgMultipart parent;         /* This is a multipart message. */
     CICallInfo callinfo;              /* Information about the call, embedded in the message. */
 } CINetMsgEventRing;
 
+#define CI_NET_MSG_EVENT_RING_SCHEMA(F) \
+    F(CINetMsgEventRing, parent.stage, "stage", CI_NET_FIELD_STAGE, INT, NONE, 0) \
+    F(CINetMsgEventRing, parent.part, "part", CI_NET_FIELD_PART, INT, NONE, 0) \
+    F(CINetMsgEventRing, parent.msgid, "msgid", CI_NET_FIELD_MSGID, MSGID, NONE, 0) \
+    F(CINetMsgEventRing, callinfo, NULL, CI_NET_FIELD_UNKNOWN, CALL_INFO, NONE, 0)
+
 /* CALL message. Outgoing call. */
 typedef struct {
     CINetMsg parent;                  /* Derived from CINetMsg. */
     CICallInfo callinfo;              /* Information about the call, embedded in the message. */
 } CINetMsgEventCall;
 
+#define CI_NET_MSG_EVENT_CALL_SCHEMA(F) \
+    F(CINetMsgEventCall, callinfo, NULL, CI_NET_FIELD_UNKNOWN, CALL_INFO, NONE, 0)
+
 /* Flags used in CICallInfo indicating the fields that are valid. */
 typedef enum {
     CIF_COMPLETENUMBER = (1<<0),
@@ -124,15 +222,31 @@ typedef struct {
     gint count;                        /* Number of entries in the database. */
 } CINetMsgDbNumCalls;
 
-/* Get a list of calls from the database. */
+#define CI_NET_MSG_DB_NUM_CALLS_SCHEMA(F) \
+    F(CINetMsgDbNumCalls, count, "count", CI_NET_FIELD_COUNT, INT, NONE, 0)
+
+/* Get a list of calls from the database. Large lists may be sent in parts,
+ * then @msgid is set and @stage and @part are used like in @CINetMsgMultipart. */
 typedef struct {
     CINetMsg parent;                   /* Derived from CINetMsg. */
     gint user;                         /* The user id for custom entries. */
     gint offset;                       /* Offset for the query. */
     gint count;                        /* Number of entries queried. */
     GList *calls;                      /* List of Calls. [element-type: CICallInfo] */
+    CINetMsgMultipartStage stage;      /* Stage of this part if sent in parts. */
+    gint part;                         /* Number of this part, starting at 0. */
+    gchar msgid[16];                   /* Id of the list if sent in parts, empty otherwise. */
 } CINetMsgDbCallList;
 
+#define CI_NET_MSG_DB_CALL_LIST_SCHEMA(F) \
+    F(CINetMsgDbCallList, user, "user", CI_NET_FIELD_USER, INT, NONE, 0) \
+    F(CINetMsgDbCallList, offset, "offset", CI_NET_FIELD_OFFSET, INT, NONE, 0) \
+    F(CINetMsgDbCallList, count, "count", CI_NET_FIELD_COUNT, INT, NONE, 0) \
+    F(CINetMsgDbCallList, calls, "calls", CI_NET_FIELD_CALLS, CALL_LIST, NONE, 0) \
+    F(CINetMsgDbCallList, stage, "stage", CI_NET_FIELD_STAGE, INT, OMIT, 0) \
+    F(CINetMsgDbCallList, part, "part", CI_NET_FIELD_PART, INT, OMIT, 0) \
+    F(CINetMsgDbCallList, msgid, "msgid", CI_NET_FIELD_MSGID, MSGID, OMIT, 0)
+
 /* Get information about a caller. */
 typedef struct {
     CINetMsg parent;                   /* Derived from CINetMsg. */
@@ -140,6 +254,10 @@ typedef struct {
     CICallerInfo caller;               /* Information about the caller, embedded in the message. */
 } CINetMsgDbGetCaller;
 
+#define CI_NET_MSG_DB_GET_CALLER_SCHEMA(F) \
+    F(CINetMsgDbGetCaller, user, "user", CI_NET_FIELD_USER, INT, NONE, 0) \
+    F(CINetMsgDbGetCaller, caller, NULL, CI_NET_FIELD_UNKNOWN, CALLER_INFO, NONE, 0)
+
 /* Add or update a caller in the database. */
 typedef struct {
     CINetMsg parent;                   /* Derived from CINetMsg. */
@@ -147,6 +265,10 @@ typedef struct {
     CICallerInfo caller;               /* Information about the caller, embedded in the message. */
 } CINetMsgDbAddCaller;
 
+#define CI_NET_MSG_DB_ADD_CALLER_SCHEMA(F) \
+    F(CINetMsgDbAddCaller, user, "user", CI_NET_FIELD_USER, INT, NONE, 0) \
+    F(CINetMsgDbAddCaller, caller, NULL, CI_NET_FIELD_UNKNOWN, CALLER_INFO, NONE, 0)
+
 /* Delete a caller from the database. */
 typedef struct {
     CINetMsg parent;                   /* Derived from CINetMsg. */
@@ -154,6 +276,10 @@ typedef struct {
     CICallerInfo caller;               /* Information about the caller, embedded in the message. */
 } CINetMsgDbDelCaller;
 
+#define CI_NET_MSG_DB_DEL_CALLER_SCHEMA(F) \
+    F(CINetMsgDbDelCaller, user, "user", CI_NET_FIELD_USER, INT, NONE, 0) \
+    F(CINetMsgDbDelCaller, caller, NULL, CI_NET_FIELD_UNKNOWN, CALLER_INFO, NONE, 0)
+
 /* Get a list of all callers. */
 typedef struct {
     CINetMsg parent;                   /* Derived from CINetMsg. */
@@ -162,4 +288,9 @@ typedef struct {
     GList *callers;                    /* List of all callers matching the filter. [element-type: CICallerInfo] */
 } CINetMsgDbGetCallerList;
 
+#define CI_NET_MSG_DB_GET_CALLER_LIST_SCHEMA(F) \
+    F(CINetMsgDbGetCallerList, user, "user", CI_NET_FIELD_USER, INT, NONE, 0) \
+    F(CINetMsgDbGetCallerList, filter, "filter", CI_NET_FIELD_FILTER, STRING, NONE, 0) \
+    F(CINetMsgDbGetCallerList, callers, "callers", CI_NET_FIELD_CALLERS, CALLER_LIST, NONE, 0)
+
 #endif
@@ -0,0 +1,395 @@
+#include "cinetrequest.h"
+#include <string.h>
+
+struct _CINetRequestTracker {
+    CINetConnection *conn;
+    GHashTable *requests;             /* guid -> CINetRequest */
+    CINetMsgAssembler *assembler;     /* Replies sent in parts. */
+    guint32 next_guid;
+    GHashTable *callers;              /* "user:number" -> CINetCachedCaller, NULL if not caching. */
+    GQueue caller_lru;                /* Cached callers, most recently used first. */
+    guint max_callers;
+    gint64 negative_ttl;              /* In microseconds. */
+};
+
+typedef struct {
+    CINetRequestTracker *tracker;
+    guint32 guid;
+    CINetMsgType msgtype;
+    GTask *task;
+    GSource *timeout;
+    GSource *cancel;
+    gchar *caller_key;                /* Cache the reply under this key. */
+    gchar msgid[16];                  /* Id of a reply sent in parts, empty if none was received. */
+} CINetRequest;
+
+/* The reply to a @CI_NET_MSG_DB_GET_CALLER. */
+typedef struct {
+    gchar *key;
+    CICallerInfo caller;
+    gint64 expires;                   /* Monotonic time, 0 if the caller is known. */
+    GList *link;                      /* Link in the LRU list. */
+} CINetCachedCaller;
+
+static void cinet_cached_caller_free(CINetCachedCaller *entry)
+{
+    g_free(entry->key);
+    cinet_caller_info_free(&entry->caller);
+    g_free(entry);
+}
+
+static void cinet_request_free(CINetRequest *request)
+{
+    if (request->timeout) {
+        g_source_destroy(request->timeout);
+        g_source_unref(request->timeout);
+    }
+    if (request->cancel) {
+        g_source_destroy(request->cancel);
+        g_source_unref(request->cancel);
+    }
+    g_object_unref(request->task);
+    g_free(request->caller_key);
+    g_free(request);
+}
+
+/* Remove a request and return its result.
+ *
+ * @request: The request.
+ * @reply:   The reply, the task takes ownership. NULL if @error is set.
+ * @error:   The error, the task takes ownership.
+ */
+static void cinet_request_finish(CINetRequest *request, CINetMsg *reply, GError *error)
+{
+    GTask *task = g_object_ref(request->task);
+
+    /* Do not keep the parts received so far if the request failed. */
+    if (request->msgid[0])
+        cinet_msg_assembler_remove(request->tracker->assembler, request->msgid);
+    g_hash_table_remove(request->tracker->requests, GUINT_TO_POINTER(request->guid));
+
+    if (reply)
+        g_task_return_pointer(task, reply, (GDestroyNotify)cinet_msg_unref);
+    else
+        g_task_return_error(task, error);
+    g_object_unref(task);
+}
+
+static gboolean cinet_request_timeout(gpointer userdata)
+{
+    CINetRequest *request = g_task_get_task_data(userdata);
+
+    cinet_request_finish(request, NULL,
+                         g_error_new_literal(G_IO_ERROR, G_IO_ERROR_TIMED_OUT, "No reply in time"));
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean cinet_request_cancelled(GCancellable *cancellable, gpointer userdata)
+{
+    CINetRequest *request = g_task_get_task_data(userdata);
+
+    cinet_request_finish(request, NULL,
+                         g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CANCELLED, "Request cancelled"));
+
+    return G_SOURCE_REMOVE;
+}
+
+CINetRequestTracker *cinet_request_tracker_new(CINetConnection *conn)
+{
+    CINetRequestTracker *tracker;
+
+    if (!conn)
+        return NULL;
+
+    tracker = g_malloc0(sizeof(CINetRequestTracker));
+    tracker->conn = cinet_connection_ref(conn);
+    tracker->requests = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                              NULL, (GDestroyNotify)cinet_request_free);
+    tracker->assembler = cinet_msg_assembler_new(CINET_REQUEST_DEFAULT_MAX_ROWS);
+    tracker->next_guid = 1;
+
+    return tracker;
+}
+
+void cinet_request_tracker_free(CINetRequestTracker *tracker)
+{
+    if (!tracker)
+        return;
+
+    cinet_request_tracker_fail_all(tracker, NULL);
+
+    g_hash_table_destroy(tracker->requests);
+    cinet_request_tracker_set_caller_cache(tracker, 0, 0);
+    cinet_msg_assembler_free(tracker->assembler);
+    cinet_connection_unref(tracker->conn);
+    g_free(tracker);
+}
+
+void cinet_request_tracker_fail_all(CINetRequestTracker *tracker, const GError *error)
+{
+    GList *requests, *link;
+
+    if (!tracker)
+        return;
+
+    /* Callbacks may send new requests, only fail those pending now. */
+    requests = g_hash_table_get_values(tracker->requests);
+    for (link = requests; link; link = link->next) {
+        cinet_request_finish(link->data, NULL,
+                             error ? g_error_copy(error) :
+                             g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CLOSED, "Connection closed"));
+    }
+    g_list_free(requests);
+}
+
+void cinet_request_tracker_set_max_rows(CINetRequestTracker *tracker, guint max_rows)
+{
+    if (!tracker)
+        return;
+
+    cinet_msg_assembler_set_max_rows(tracker->assembler, max_rows);
+}
+
+void cinet_request_tracker_set_caller_cache(CINetRequestTracker *tracker, guint max_entries, guint negative_ttl)
+{
+    if (!tracker)
+        return;
+
+    if (tracker->callers) {
+        g_queue_clear(&tracker->caller_lru);
+        g_hash_table_destroy(tracker->callers);
+        tracker->callers = NULL;
+    }
+
+    if (max_entries == 0)
+        return;
+
+    tracker->callers = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                             (GDestroyNotify)cinet_cached_caller_free);
+    g_queue_init(&tracker->caller_lru);
+    tracker->max_callers = max_entries;
+    tracker->negative_ttl = (gint64)(negative_ttl ? negative_ttl : CINET_CALLER_CACHE_DEFAULT_TTL) * G_USEC_PER_SEC;
+}
+
+/* Get the key of a caller in the cache.
+ *
+ * @msg:    A @CI_NET_MSG_DB_GET_CALLER, @CI_NET_MSG_DB_ADD_CALLER or
+ *          @CI_NET_MSG_DB_DEL_CALLER, these share their layout.
+ *
+ * @return: The key or NULL if the message has no number. Free with @g_free().
+ */
+static gchar *cinet_request_caller_key(CINetMsg *msg)
+{
+    CINetMsgDbGetCaller *query = (CINetMsgDbGetCaller*)msg;
+
+    if (query->caller.number == NULL || query->caller.number[0] == '\0')
+        return NULL;
+
+    return g_strdup_printf("%d:%s", query->user, query->caller.number);
+}
+
+static void cinet_request_tracker_remove_caller(CINetRequestTracker *tracker, CINetCachedCaller *entry)
+{
+    g_queue_delete_link(&tracker->caller_lru, entry->link);
+    g_hash_table_remove(tracker->callers, entry->key);
+}
+
+/* Look up a caller. Entries found move to the front, expired ones are removed.
+ *
+ * @return: The entry or NULL.
+ */
+static CINetCachedCaller *cinet_request_tracker_lookup_caller(CINetRequestTracker *tracker, const gchar *key)
+{
+    CINetCachedCaller *entry;
+
+    if ((entry = g_hash_table_lookup(tracker->callers, key)) == NULL)
+        return NULL;
+
+    if (entry->expires && entry->expires <= g_get_monotonic_time()) {
+        cinet_request_tracker_remove_caller(tracker, entry);
+        return NULL;
+    }
+
+    g_queue_unlink(&tracker->caller_lru, entry->link);
+    g_queue_push_head_link(&tracker->caller_lru, entry->link);
+
+    return entry;
+}
+
+/* Remember the reply to a @CI_NET_MSG_DB_GET_CALLER, dropping the least
+ * recently used entry if the cache is full. */
+static void cinet_request_tracker_cache_caller(CINetRequestTracker *tracker, const gchar *key, CINetMsg *reply)
+{
+    CINetMsgDbGetCaller *result = (CINetMsgDbGetCaller*)reply;
+    CINetCachedCaller *entry;
+
+    if ((entry = g_hash_table_lookup(tracker->callers, key)) != NULL)
+        cinet_request_tracker_remove_caller(tracker, entry);
+    else if (g_hash_table_size(tracker->callers) >= tracker->max_callers)
+        cinet_request_tracker_remove_caller(tracker, g_queue_peek_tail(&tracker->caller_lru));
+
+    entry = g_malloc0(sizeof(CINetCachedCaller));
+    entry->key = g_strdup(key);
+    cinet_caller_info_copy(&entry->caller, &result->caller);
+    if (entry->caller.name == NULL || entry->caller.name[0] == '\0')
+        entry->expires = g_get_monotonic_time() + tracker->negative_ttl;
+
+    g_queue_push_head(&tracker->caller_lru, entry);
+    entry->link = tracker->caller_lru.head;
+    g_hash_table_insert(tracker->callers, entry->key, entry);
+}
+
+/* Drop a caller changed by a request and keep lookups already sent from
+ * caching the old state. */
+static void cinet_request_tracker_invalidate_caller(CINetRequestTracker *tracker, const gchar *key)
+{
+    CINetCachedCaller *entry;
+    CINetRequest *request;
+    GHashTableIter iter;
+
+    if ((entry = g_hash_table_lookup(tracker->callers, key)) != NULL)
+        cinet_request_tracker_remove_caller(tracker, entry);
+
+    g_hash_table_iter_init(&iter, tracker->requests);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer*)&request)) {
+        if (request->caller_key && strcmp(request->caller_key, key) == 0) {
+            g_free(request->caller_key);
+            request->caller_key = NULL;
+        }
+    }
+}
+
+/* Answer a @CI_NET_MSG_DB_GET_CALLER from the cache.
+ *
+ * @return: The reply or NULL if the caller is not cached.
+ */
+static CINetMsg *cinet_request_tracker_find_caller(CINetRequestTracker *tracker, CINetMsg *msg, const gchar *key)
+{
+    CINetCachedCaller *entry;
+    CINetMsgDbGetCaller *reply;
+
+    if ((entry = cinet_request_tracker_lookup_caller(tracker, key)) == NULL)
+        return NULL;
+
+    reply = (CINetMsgDbGetCaller*)cinet_msg_alloc(CI_NET_MSG_DB_GET_CALLER);
+    reply->user = ((CINetMsgDbGetCaller*)msg)->user;
+    cinet_caller_info_copy(&reply->caller, &entry->caller);
+
+    return (CINetMsg*)reply;
+}
+
+/* Get the next guid not in use. 0 is never used, it means no guid. */
+static guint32 cinet_request_tracker_next_guid(CINetRequestTracker *tracker)
+{
+    guint32 guid;
+
+    do {
+        guid = tracker->next_guid++;
+    } while (guid == 0 || g_hash_table_contains(tracker->requests, GUINT_TO_POINTER(guid)));
+
+    return guid;
+}
+
+void cinet_request_tracker_send_async(CINetRequestTracker *tracker, CINetMsg *msg, guint timeout,
+                                      GCancellable *cancellable, GAsyncReadyCallback callback, gpointer userdata)
+{
+    CINetRequest *request;
+    CINetMsg *reply;
+    gchar *caller_key = NULL;
+    GTask *task;
+
+    task = g_task_new(NULL, cancellable, callback, userdata);
+    g_task_set_source_tag(task, cinet_request_tracker_send_async);
+
+    if (!tracker || !msg) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "No request");
+        g_object_unref(task);
+        return;
+    }
+
+    if (tracker->callers && (msg->msgtype == CI_NET_MSG_DB_GET_CALLER ||
+                             msg->msgtype == CI_NET_MSG_DB_ADD_CALLER ||
+                             msg->msgtype == CI_NET_MSG_DB_DEL_CALLER))
+        caller_key = cinet_request_caller_key(msg);
+
+    if (caller_key && msg->msgtype == CI_NET_MSG_DB_GET_CALLER &&
+            (reply = cinet_request_tracker_find_caller(tracker, msg, caller_key)) != NULL) {
+        g_free(caller_key);
+        g_task_return_pointer(task, reply, (GDestroyNotify)cinet_msg_unref);
+        g_object_unref(task);
+        return;
+    }
+
+    /* Invalidate before sending, a lookup following the change must not be
+     * answered from the cache. */
+    if (caller_key && msg->msgtype != CI_NET_MSG_DB_GET_CALLER) {
+        cinet_request_tracker_invalidate_caller(tracker, caller_key);
+        g_free(caller_key);
+        caller_key = NULL;
+    }
+
+    msg->guid = cinet_request_tracker_next_guid(tracker);
+    if (cinet_connection_send(tracker->conn, msg) != 0) {
+        g_free(caller_key);
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_CLOSED, "Cannot send request");
+        g_object_unref(task);
+        return;
+    }
+
+    request = g_malloc0(sizeof(CINetRequest));
+    request->tracker = tracker;
+    request->guid = msg->guid;
+    request->msgtype = msg->msgtype;
+    request->task = task;
+    request->caller_key = caller_key;
+    g_task_set_task_data(task, request, NULL);
+
+    if (timeout) {
+        request->timeout = g_timeout_source_new(timeout);
+        g_task_attach_source(task, request->timeout, cinet_request_timeout);
+    }
+    if (cancellable) {
+        request->cancel = g_cancellable_source_new(cancellable);
+        g_task_attach_source(task, request->cancel, (GSourceFunc)cinet_request_cancelled);
+    }
+
+    g_hash_table_insert(tracker->requests, GUINT_TO_POINTER(request->guid), request);
+}
+
+CINetMsg *cinet_request_tracker_send_finish(CINetRequestTracker *tracker, GAsyncResult *result, GError **error)
+{
+    if (!g_task_is_valid(result, NULL))
+        return NULL;
+
+    return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+gboolean cinet_request_tracker_dispatch(CINetRequestTracker *tracker, CINetMsg *msg)
+{
+    CINetRequest *request;
+    CINetMsg *reply;
+
+    if (!tracker || !msg || msg->guid == 0)
+        return FALSE;
+
+    request = g_hash_table_lookup(tracker->requests, GUINT_TO_POINTER(msg->guid));
+    if (request == NULL || request->msgtype != msg->msgtype)
+        return FALSE;
+
+    if (msg->msgtype == CI_NET_MSG_DB_CALL_LIST && ((CINetMsgDbCallList*)msg)->msgid[0])
+        memcpy(request->msgid, ((CINetMsgDbCallList*)msg)->msgid, sizeof(request->msgid));
+
+    if ((reply = cinet_msg_assembler_add(tracker->assembler, cinet_msg_ref(msg))) != NULL) {
+        if (request->caller_key && tracker->callers)
+            cinet_request_tracker_cache_caller(tracker, request->caller_key, reply);
+        cinet_request_finish(request, reply, NULL);
+    }
+
+    return TRUE;
+}
+
+guint cinet_request_tracker_get_pending(CINetRequestTracker *tracker)
+{
+    return tracker ? g_hash_table_size(tracker->requests) : 0;
+}
@@ -0,0 +1,108 @@
+#ifndef __CINET_REQUEST_H__
+#define __CINET_REQUEST_H__
+
+#include <cinetconnection.h>
+
+/* Tracks requests sent over a connection and matches the replies by their
+ * guid, so that many requests can be outstanding at once. Replies to
+ * @CI_NET_MSG_DB_CALL_LIST sent in parts are reassembled first. A tracker
+ * must only be used from the thread running the context of its connection. */
+typedef struct _CINetRequestTracker CINetRequestTracker;
+
+/* Default maximum number of calls of a reply sent in parts. */
+#define CINET_REQUEST_DEFAULT_MAX_ROWS 100000
+
+/* Default number of seconds a caller not found is cached. */
+#define CINET_CALLER_CACHE_DEFAULT_TTL 60
+
+/* Create a tracker for requests sent over @conn. Pass all messages received
+ * on the connection to @cinet_request_tracker_dispatch().
+ *
+ * @conn:   The connection. The tracker takes a reference.
+ *
+ * @return: The new tracker. Free with @cinet_request_tracker_free().
+ */
+CINetRequestTracker *cinet_request_tracker_new(CINetConnection *conn);
+
+/* Free a tracker. Pending requests fail with @G_IO_ERROR_CLOSED.
+ *
+ * @tracker: The tracker.
+ */
+void cinet_request_tracker_free(CINetRequestTracker *tracker);
+
+/* Fail all pending requests, e.g. when the connection is closed.
+ *
+ * @tracker: The tracker.
+ * @error:   The error to return. NULL for @G_IO_ERROR_CLOSED.
+ */
+void cinet_request_tracker_fail_all(CINetRequestTracker *tracker, const GError *error);
+
+/* Limit the number of calls of a @CI_NET_MSG_DB_CALL_LIST reply sent in
+ * parts. Larger replies are dropped and the request fails by its timeout.
+ * Defaults to @CINET_REQUEST_DEFAULT_MAX_ROWS.
+ *
+ * @tracker:  The tracker.
+ * @max_rows: Maximum number of calls. 0 for no limit.
+ */
+void cinet_request_tracker_set_max_rows(CINetRequestTracker *tracker, guint max_rows);
+
+/* Cache the replies to @CI_NET_MSG_DB_GET_CALLER by user and number, so that
+ * repeated lookups, e.g. for every RING, are answered without asking the peer.
+ * Callers not found are cached for @negative_ttl seconds, known ones until
+ * they are evicted. A @CI_NET_MSG_DB_ADD_CALLER or @CI_NET_MSG_DB_DEL_CALLER
+ * sent through the tracker removes the caller from the cache. Changes made by
+ * other clients are not noticed. Disabled by default.
+ *
+ * @tracker:      The tracker.
+ * @max_entries:  Maximum number of callers cached, the least recently used
+ *                one is dropped first. 0 disables and clears the cache.
+ * @negative_ttl: Seconds to cache a caller not found. 0 for
+ *                @CINET_CALLER_CACHE_DEFAULT_TTL.
+ */
+void cinet_request_tracker_set_caller_cache(CINetRequestTracker *tracker, guint max_entries, guint negative_ttl);
+
+/* Send a request and wait for the reply without blocking. The reply is the
+ * next message of the same type carrying the guid assigned to the request.
+ *
+ * @tracker:    The tracker.
+ * @msg:        The request. Its guid is overwritten. It is not needed after this call.
+ *              A @CI_NET_MSG_DB_GET_CALLER may be answered from the cache.
+ * @timeout:    Time to wait for the reply in milliseconds, 0 to wait forever.
+ * @cancellable: A @GCancellable or NULL.
+ * @callback:   Called in the thread-default context of the caller once the
+ *              reply arrived or the request failed.
+ * @userdata:   Data passed to @callback.
+ */
+void cinet_request_tracker_send_async(CINetRequestTracker *tracker, CINetMsg *msg, guint timeout,
+                                      GCancellable *cancellable, GAsyncReadyCallback callback, gpointer userdata);
+
+/* Get the reply of a request.
+ *
+ * @tracker: The tracker.
+ * @result:  The result passed to the callback.
+ * @error:   Return location for an error, @G_IO_ERROR_TIMED_OUT if there was
+ *           no reply in time.
+ *
+ * @return:  The reply or NULL on error. Free with @cinet_msg_free().
+ */
+CINetMsg *cinet_request_tracker_send_finish(CINetRequestTracker *tracker, GAsyncResult *result, GError **error);
+
+/* Pass a received message to the tracker.
+ *
+ * @tracker: The tracker.
+ * @msg:     The message. The tracker takes a reference if it needs it.
+ *
+ * @return:  TRUE if the message was a reply or a part of one and should not
+ *           be handled otherwise, FALSE if it is no reply.
+ */
+gboolean cinet_request_tracker_dispatch(CINetRequestTracker *tracker, CINetMsg *msg);
+
+/* Get the number of requests waiting for a reply.
+ *
+ * @tracker: The tracker.
+ *
+ * @return:  Number of pending requests.
+ */
+guint cinet_request_tracker_get_pending(CINetRequestTracker *tracker);
+
+#endif
@@ -0,0 +1,408 @@
+#include <cinethub.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+/* Time to wait for the reactors, in milliseconds. */
+#define TEST_TIMEOUT 5000
+
+/* The far end of a connection added to the hub. */
+typedef struct {
+    gint fd;
+    CINetMsgReader *reader;
+} TestClient;
+
+/* Counts the callbacks of the hub. */
+typedef struct {
+    gint versions;
+    gint removed;
+} TestHubData;
+
+static void test_hub_message(CINetHub *hub, CINetHubClient *client, CINetMsg *msg, gpointer userdata)
+{
+    TestHubData *data = userdata;
+
+    /* A LEAVE is handled by the hub. */
+    g_assert_cmpint(msg->msgtype, ==, CI_NET_MSG_VERSION);
+    g_atomic_int_inc(&data->versions);
+}
+
+static void test_hub_removed(CINetHub *hub, CINetHubClient *client, gpointer userdata)
+{
+    g_atomic_int_inc(&((TestHubData*)userdata)->removed);
+}
+
+static const CINetHubCallbacks test_hub_callbacks = {
+    test_hub_message,
+    test_hub_removed
+};
+
+/* Wait until @value reaches @expected. */
+static void test_wait_int(gint *value, gint expected)
+{
+    gint ms;
+
+    for (ms = 0; g_atomic_int_get(value) != expected && ms < TEST_TIMEOUT; ++ms)
+        g_usleep(1000);
+    g_assert_cmpint(g_atomic_int_get(value), ==, expected);
+}
+
+/* Wait until @n_clients are connected to @hub and return its counters. */
+static void test_wait_clients(CINetHub *hub, guint n_clients, CINetHubStats *stats)
+{
+    gint ms;
+
+    for (ms = 0; ms < TEST_TIMEOUT; ++ms) {
+        cinet_hub_get_stats(hub, stats);
+        if (stats->clients == n_clients)
+            break;
+        g_usleep(1000);
+    }
+    g_assert_cmpuint(stats->clients, ==, n_clients);
+}
+
+static void test_client_send(TestClient *client, CINetMsg *msg)
+{
+    gchar *buffer;
+    gsize len;
+
+    g_assert_cmpint(cinet_msg_write_msg(&buffer, &len, msg), ==, 0);
+    g_assert_cmpint(write(client->fd, buffer, len), ==, (gssize)len);
+    g_free(buffer);
+}
+
+/* Connect a new client to @hub over a socket pair and announce @features.
+ *
+ * @rcvbuf: Size of the receive buffer of the client, 0 for the default.
+ */
+static TestClient *test_client_new(CINetHub *hub, guint32 features, gint rcvbuf)
+{
+    TestClient *client = g_malloc0(sizeof(TestClient));
+    GSocketConnection *conn;
+    GSocket *socket;
+    CINetMsg *msg;
+    gint fds[2];
+
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+    if (rcvbuf) {
+        setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &rcvbuf, sizeof(rcvbuf));
+        setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+
+    socket = g_socket_new_from_fd(fds[0], NULL);
+    g_assert_nonnull(socket);
+    conn = g_socket_connection_factory_create_connection(socket);
+    g_assert_cmpint(cinet_hub_add_stream(hub, G_IO_STREAM(conn)), ==, 0);
+    g_object_unref(conn);
+    g_object_unref(socket);
+
+    client->fd = fds[1];
+    client->reader = cinet_msg_reader_new(0);
+
+    msg = cinet_message_new(CI_NET_MSG_VERSION, "features", features, NULL, NULL);
+    test_client_send(client, msg);
+    cinet_msg_free(msg);
+
+    return client;
+}
+
+static void test_client_free(TestClient *client)
+{
+    close(client->fd);
+    cinet_msg_reader_free(client->reader);
+    g_free(client);
+}
+
+/* Receive the next message, failing if none arrives in time.
+ *
+ * @return: The message or NULL if the hub closed the connection.
+ */
+static CINetMsg *test_client_next(TestClient *client)
+{
+    struct pollfd pfd = { client->fd, POLLIN, 0 };
+    CINetMsg *msg;
+    gchar *buffer;
+    gsize len;
+    gssize n;
+
+    while (!cinet_msg_reader_next_msg(client->reader, &msg)) {
+        g_assert_cmpint(poll(&pfd, 1, TEST_TIMEOUT), ==, 1);
+        buffer = cinet_msg_reader_get_buffer(client->reader, &len);
+        if ((n = read(client->fd, buffer, len)) <= 0)
+            return NULL;
+        cinet_msg_reader_commit(client->reader, (gsize)n);
+    }
+
+    return msg;
+}
+
+/* Receive a call and check its id.
+ *
+ * @return: FALSE if the hub closed the connection instead.
+ */
+static gboolean test_client_expect_call(TestClient *client, gint id)
+{
+    CINetMsg *msg = test_client_next(client);
+
+    if (msg == NULL)
+        return FALSE;
+
+    g_assert_cmpint(msg->msgtype, ==, CI_NET_MSG_EVENT_CALL);
+    g_assert_cmpint(((CINetMsgEventCall*)msg)->callinfo.id, ==, id);
+    cinet_msg_free(msg);
+
+    return TRUE;
+}
+
+static void test_broadcast_call(CINetHub *hub, gint id, const gchar *name)
+{
+    CINetMsg *msg = cinet_message_new(CI_NET_MSG_EVENT_CALL, "name", name, NULL, NULL);
+
+    ((CINetMsgEventCall*)msg)->callinfo.id = id;
+    g_assert_cmpint(cinet_hub_broadcast(hub, msg), ==, 0);
+    cinet_msg_unref(msg);
+}
+
+static void test_broadcast_ring(CINetHub *hub, CINetMsgMultipartStage stage, const gchar *key, const gchar *value)
+{
+    CINetMsg *msg = cinet_message_new(CI_NET_MSG_EVENT_RING, "stage", stage, "msgid", "ring",
+                                      key, value, NULL, NULL);
+
+    g_assert_cmpint(cinet_hub_broadcast(hub, msg), ==, 0);
+    cinet_msg_unref(msg);
+}
+
+/* A name of @len characters to make calls large. */
+static gchar *test_large_name(gsize len)
+{
+    gchar *name = g_malloc(len + 1);
+
+    memset(name, 'x', len);
+    name[len] = '\0';
+
+    return name;
+}
+
+/* Clients spread across several reactors, some of them using the binary
+ * encoding, all receive every event in order. */
+static void test_broadcast(void)
+{
+    TestHubData data = { 0, 0 };
+    CINetHub *hub = cinet_hub_new(3, &test_hub_callbacks, &data);
+    TestClient *clients[6];
+    CINetHubStats stats;
+    guint i;
+    gint id;
+
+    cinet_hub_set_features(hub, CI_NET_FEATURE_BINARY | CI_NET_FEATURE_COLUMNS);
+    for (i = 0; i < G_N_ELEMENTS(clients); ++i)
+        clients[i] = test_client_new(hub, i % 2 ? CI_NET_FEATURE_BINARY : 0, 0);
+    test_wait_int(&data.versions, G_N_ELEMENTS(clients));
+
+    for (id = 0; id < 100; ++id)
+        test_broadcast_call(hub, id, "Caller");
+
+    for (i = 0; i < G_N_ELEMENTS(clients); ++i) {
+        for (id = 0; id < 100; ++id)
+            g_assert_true(test_client_expect_call(clients[i], id));
+    }
+
+    test_wait_clients(hub, G_N_ELEMENTS(clients), &stats);
+    g_assert_cmpuint(stats.events, ==, 100);
+    g_assert_cmpuint(stats.frames, ==, 100 * G_N_ELEMENTS(clients));
+    g_assert_cmpuint(stats.dropped, ==, 0);
+
+    cinet_hub_free(hub);
+    g_assert_cmpint(data.removed, ==, G_N_ELEMENTS(clients));
+    for (i = 0; i < G_N_ELEMENTS(clients); ++i) {
+        g_assert_null(test_client_next(clients[i]));
+        test_client_free(clients[i]);
+    }
+}
+
+/* With @CINET_HUB_POLICY_DISCONNECT a client not reading is closed once its
+ * queue is full, the others are not affected. */
+static void test_slow_disconnect(void)
+{
+    TestHubData data = { 0, 0 };
+    CINetHub *hub = cinet_hub_new(2, &test_hub_callbacks, &data);
+    TestClient *fast, *slow;
+    CINetHubStats stats;
+    gchar *name = test_large_name(1000);
+    gint id;
+
+    cinet_hub_set_policy(hub, CINET_HUB_POLICY_DISCONNECT, 16);
+    fast = test_client_new(hub, 0, 0);
+    slow = test_client_new(hub, 0, 4096);
+    test_wait_int(&data.versions, 2);
+
+    for (id = 0; id < 200; ++id) {
+        test_broadcast_call(hub, id, name);
+        g_assert_true(test_client_expect_call(fast, id));
+    }
+
+    test_wait_int(&data.removed, 1);
+    test_wait_clients(hub, 1, &stats);
+    g_assert_cmpuint(stats.dropped, ==, 1);
+
+    /* The slow client gets what was written before it was closed, without gaps. */
+    for (id = 0; test_client_expect_call(slow, id); ++id)
+        ;
+    g_assert_cmpint(id, >, 0);
+    g_assert_cmpint(id, <, 200);
+
+    cinet_hub_free(hub);
+    test_client_free(fast);
+    test_client_free(slow);
+    g_free(name);
+}
+
+/* With @CINET_HUB_POLICY_COALESCE the Updates of a RING queued for a slow
+ * client are merged, the client keeps up with the final state. */
+static void test_slow_coalesce(void)
+{
+    TestHubData data = { 0, 0 };
+    CINetHub *hub = cinet_hub_new(2, &test_hub_callbacks, &data);
+    CINetRingTracker *tracker = cinet_ring_tracker_new(0);
+    CINetMsgEventRing *ring = NULL;
+    TestClient *client;
+    CINetHubStats stats;
+    CINetMsg *msg;
+    gchar *name = test_large_name(20000);
+    gchar value[16];
+    gint id, rings = 0;
+
+    cinet_hub_set_features(hub, CI_NET_FEATURE_DELTA);
+    cinet_hub_set_policy(hub, CINET_HUB_POLICY_COALESCE, 64);
+    cinet_ring_tracker_set_features(tracker, CI_NET_FEATURE_DELTA);
+    client = test_client_new(hub, CI_NET_FEATURE_DELTA, 4096);
+    test_wait_int(&data.versions, 1);
+
+    /* Calls larger than the socket buffer fill the connection, so that the
+     * RING is queued. */
+    for (id = 0; id < 40; ++id)
+        test_broadcast_call(hub, id, name);
+    test_broadcast_ring(hub, MultipartStageInit, "name", "Ring");
+    for (id = 0; id < 50; ++id) {
+        g_snprintf(value, sizeof(value), "v%d", id);
+        test_broadcast_ring(hub, MultipartStageUpdate, id % 2 ? "area" : "alias", value);
+    }
+    test_broadcast_ring(hub, MultipartStageComplete, "date", "today");
+
+    for (id = 0; id < 40; ++id)
+        g_assert_true(test_client_expect_call(client, id));
+    while (ring == NULL && (msg = test_client_next(client)) != NULL) {
+        g_assert_true(cinet_ring_tracker_add(tracker, msg));
+        cinet_msg_free(msg);
+        ++rings;
+        while ((msg = cinet_ring_tracker_pop(tracker)) != NULL) {
+            if (((CINetMsgMultipart*)msg)->stage == MultipartStageComplete)
+                ring = (CINetMsgEventRing*)msg;
+            else
+                cinet_msg_free(msg);
+        }
+    }
+
+    g_assert_nonnull(ring);
+    g_assert_cmpstr(ring->callinfo.name, ==, "Ring");
+    g_assert_cmpstr(ring->callinfo.alias, ==, "v48");
+    g_assert_cmpstr(ring->callinfo.area, ==, "v49");
+    g_assert_cmpstr(ring->callinfo.date, ==, "today");
+
+    /* Each merge saves one stage. */
+    cinet_hub_get_stats(hub, &stats);
+    g_assert_cmpuint(stats.dropped, ==, 0);
+    g_assert_cmpuint(stats.coalesced, >, 0);
+    g_assert_cmpuint(rings + stats.coalesced, ==, 52);
+
+    cinet_msg_free((CINetMsg*)ring);
+    cinet_ring_tracker_free(tracker);
+    cinet_hub_free(hub);
+    test_client_free(client);
+    g_free(name);
+}
+
+/* @cinet_hub_shutdown() sends SHUTDOWN after all pending events, then closes
+ * the clients. */
+static void test_shutdown(void)
+{
+    TestHubData data = { 0, 0 };
+    CINetHub *hub = cinet_hub_new(2, &test_hub_callbacks, &data);
+    TestClient *clients[4];
+    CINetMsg *msg;
+    guint i;
+    gint id;
+
+    for (i = 0; i < G_N_ELEMENTS(clients); ++i)
+        clients[i] = test_client_new(hub, 0, 0);
+    test_wait_int(&data.versions, G_N_ELEMENTS(clients));
+
+    for (id = 0; id < 50; ++id)
+        test_broadcast_call(hub, id, "Caller");
+    cinet_hub_shutdown(hub);
+
+    msg = cinet_message_new(CI_NET_MSG_EVENT_CALL, "name", "Late", NULL, NULL);
+    g_assert_cmpint(cinet_hub_broadcast(hub, msg), ==, -1);
+    cinet_msg_unref(msg);
+
+    for (i = 0; i < G_N_ELEMENTS(clients); ++i) {
+        for (id = 0; id < 50; ++id)
+            g_assert_true(test_client_expect_call(clients[i], id));
+        msg = test_client_next(clients[i]);
+        g_assert_nonnull(msg);
+        g_assert_cmpint(msg->msgtype, ==, CI_NET_MSG_SHUTDOWN);
+        cinet_msg_free(msg);
+        g_assert_null(test_client_next(clients[i]));
+    }
+    test_wait_int(&data.removed, G_N_ELEMENTS(clients));
+
+    cinet_hub_free(hub);
+    for (i = 0; i < G_N_ELEMENTS(clients); ++i)
+        test_client_free(clients[i]);
+}
+
+/* A client sending LEAVE is closed and gets no further events. */
+static void test_leave(void)
+{
+    TestHubData data = { 0, 0 };
+    CINetHub *hub = cinet_hub_new(1, &test_hub_callbacks, &data);
+    TestClient *leaving, *staying;
+    CINetHubStats stats;
+    CINetMsg *msg;
+
+    leaving = test_client_new(hub, 0, 0);
+    staying = test_client_new(hub, 0, 0);
+    test_wait_int(&data.versions, 2);
+
+    test_broadcast_call(hub, 0, "Caller");
+    g_assert_true(test_client_expect_call(leaving, 0));
+    g_assert_true(test_client_expect_call(staying, 0));
+
+    msg = cinet_msg_alloc(CI_NET_MSG_LEAVE);
+    test_client_send(leaving, msg);
+    cinet_msg_free(msg);
+    g_assert_null(test_client_next(leaving));
+    test_wait_int(&data.removed, 1);
+    test_wait_clients(hub, 1, &stats);
+
+    test_broadcast_call(hub, 1, "Caller");
+    g_assert_true(test_client_expect_call(staying, 1));
+
+    cinet_hub_free(hub);
+    test_client_free(leaving);
+    test_client_free(staying);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/hub/broadcast", test_broadcast);
+    g_test_add_func("/hub/slow/disconnect", test_slow_disconnect);
+    g_test_add_func("/hub/slow/coalesce", test_slow_coalesce);
+    g_test_add_func("/hub/shutdown", test_shutdown);
+    g_test_add_func("/hub/leave", test_leave);
+
+    return g_test_run();
+}
@@ -0,0 +1,746 @@
+#include <cinet.h>
+#include <string.h>
+
+/* Compare the members of two structures described by a schema of
+ * cinetmsgs.h. @a and @b have to be in scope. */
+#define TEST_CHECK_INT(type, member) \
+    g_assert_cmpint(((type*)a)->member, ==, ((type*)b)->member)
+#define TEST_CHECK_UINT(type, member) \
+    g_assert_cmpuint(((type*)a)->member, ==, ((type*)b)->member)
+#define TEST_CHECK_STRING(type, member) \
+    g_assert_cmpstr(((type*)a)->member, ==, ((type*)b)->member)
+#define TEST_CHECK_MSGID(type, member) \
+    g_assert_cmpstr(((type*)a)->member, ==, ((type*)b)->member)
+#define TEST_CHECK_CALL_INFO(type, member) \
+    test_check_call_info(&((type*)a)->member, &((type*)b)->member)
+#define TEST_CHECK_CALLER_INFO(type, member) \
+    test_check_caller_info(&((type*)a)->member, &((type*)b)->member)
+#define TEST_CHECK_CALL_LIST(type, member) \
+    test_check_list(((type*)a)->member, ((type*)b)->member, (TestCheckFunc)test_check_call_info)
+#define TEST_CHECK_CALLER_LIST(type, member) \
+    test_check_list(((type*)a)->member, ((type*)b)->member, (TestCheckFunc)test_check_caller_info)
+
+#define TEST_CHECK_FIELD(type, member, name, field, kind, option, flag) \
+    TEST_CHECK_##kind(type, member);
+
+typedef void (*TestCheckFunc)(gconstpointer a, gconstpointer b);
+
+static void test_check_call_info(const CICallInfo *a, const CICallInfo *b)
+{
+    CI_CALL_INFO_SCHEMA(TEST_CHECK_FIELD)
+}
+
+static void test_check_caller_info(const CICallerInfo *a, const CICallerInfo *b)
+{
+    CI_CALLER_INFO_SCHEMA(TEST_CHECK_FIELD)
+}
+
+static void test_check_list(GList *a, GList *b, TestCheckFunc check)
+{
+    g_assert_cmpuint(g_list_length(a), ==, g_list_length(b));
+
+    for (; a != NULL && b != NULL; a = a->next, b = b->next)
+        check(a->data, b->data);
+}
+
+/* Check that two messages have the same type, guid and members. */
+static void test_check_msg(CINetMsg *a, CINetMsg *b)
+{
+    g_assert_nonnull(a);
+    g_assert_nonnull(b);
+    g_assert_cmpint(a->msgtype, ==, b->msgtype);
+    g_assert_cmpuint(a->guid, ==, b->guid);
+
+    switch (a->msgtype) {
+        case CI_NET_MSG_VERSION:
+            CI_NET_MSG_VERSION_SCHEMA(TEST_CHECK_FIELD)
+            break;
+        case CI_NET_MSG_EVENT_RING:
+            CI_NET_MSG_EVENT_RING_SCHEMA(TEST_CHECK_FIELD)
+            break;
+        case CI_NET_MSG_EVENT_CALL:
+            CI_NET_MSG_EVENT_CALL_SCHEMA(TEST_CHECK_FIELD)
+            break;
+        case CI_NET_MSG_DB_NUM_CALLS:
+            CI_NET_MSG_DB_NUM_CALLS_SCHEMA(TEST_CHECK_FIELD)
+            break;
+        case CI_NET_MSG_DB_CALL_LIST:
+            CI_NET_MSG_DB_CALL_LIST_SCHEMA(TEST_CHECK_FIELD)
+            break;
+        case CI_NET_MSG_DB_GET_CALLER:
+            CI_NET_MSG_DB_GET_CALLER_SCHEMA(TEST_CHECK_FIELD)
+            break;
+        case CI_NET_MSG_DB_ADD_CALLER:
+            CI_NET_MSG_DB_ADD_CALLER_SCHEMA(TEST_CHECK_FIELD)
+            break;
+        case CI_NET_MSG_DB_DEL_CALLER:
+            CI_NET_MSG_DB_DEL_CALLER_SCHEMA(TEST_CHECK_FIELD)
+            break;
+        case CI_NET_MSG_DB_GET_CALLER_LIST:
+            CI_NET_MSG_DB_GET_CALLER_LIST_SCHEMA(TEST_CHECK_FIELD)
+            break;
+        default:
+            break;
+    }
+}
+
+/* Set all members of a call, @id makes them differ between calls. */
+static void test_fill_call_info(CICallInfo *info, gint id)
+{
+    gchar *number = g_strdup_printf("%d", 1000 + id);
+
+    cinet_call_info_set_field(info, CI_NET_FIELD_ID, GINT_TO_POINTER(id));
+    cinet_call_info_set_field(info, CI_NET_FIELD_COMPLETENUMBER, "030123456");
+    cinet_call_info_set_field(info, CI_NET_FIELD_AREACODE, "030");
+    cinet_call_info_set_field(info, CI_NET_FIELD_NUMBER, number);
+    cinet_call_info_set_field(info, CI_NET_FIELD_DATE, "17.10.2026");
+    cinet_call_info_set_field(info, CI_NET_FIELD_TIME, "12:34");
+    cinet_call_info_set_field(info, CI_NET_FIELD_MSN, "987654");
+    cinet_call_info_set_field(info, CI_NET_FIELD_ALIAS, "Office");
+    cinet_call_info_set_field(info, CI_NET_FIELD_AREA, "Berlin");
+    cinet_call_info_set_field(info, CI_NET_FIELD_NAME, "M\xc3\xbcller \"Q\"\t\\ /");
+
+    g_free(number);
+}
+
+static void test_fill_caller_info(CICallerInfo *info, gint id)
+{
+    gchar *number = g_strdup_printf("0301234%d", id);
+
+    cinet_caller_info_set_field(info, CI_NET_FIELD_NUMBER, number);
+    cinet_caller_info_set_field(info, CI_NET_FIELD_NAME, "Caller \"\xe2\x82\xac\"\n");
+
+    g_free(number);
+}
+
+/* Create a message of @msgtype with all members set. */
+static CINetMsg *test_sample_msg(CINetMsgType msgtype)
+{
+    CINetMsg *msg = cinet_msg_alloc(msgtype);
+    CINetMsgListBuilder builder;
+    gint i;
+
+    switch (msgtype) {
+        case CI_NET_MSG_EVENT_CONNECT:
+        case CI_NET_MSG_EVENT_DISCONNECT:
+        case CI_NET_MSG_LEAVE:
+        case CI_NET_MSG_SHUTDOWN:
+            /* Messages without members are sent as {} in JSON, even without the guid. */
+            return msg;
+        default:
+            msg->guid = 0x8000 + msgtype;
+            break;
+    }
+
+    switch (msgtype) {
+        case CI_NET_MSG_VERSION:
+            cinet_message_set_int(msg, CI_NET_FIELD_MAJOR, 3);
+            cinet_message_set_int(msg, CI_NET_FIELD_MINOR, 1);
+            cinet_message_set_int(msg, CI_NET_FIELD_PATCH, 2);
+            cinet_message_set_string(msg, CI_NET_FIELD_HUMAN_READABLE, "3.1.2 (test)");
+            cinet_message_set_int(msg, CI_NET_FIELD_FEATURES, CINET_FEATURES_SUPPORTED);
+            break;
+        case CI_NET_MSG_EVENT_RING:
+            cinet_message_set_int(msg, CI_NET_FIELD_STAGE, MultipartStageUpdate);
+            cinet_message_set_int(msg, CI_NET_FIELD_PART, 2);
+            cinet_message_set_string(msg, CI_NET_FIELD_MSGID, "ring-1");
+            test_fill_call_info(&((CINetMsgEventRing*)msg)->callinfo, 42);
+            break;
+        case CI_NET_MSG_EVENT_CALL:
+            test_fill_call_info(&((CINetMsgEventCall*)msg)->callinfo, -7);
+            break;
+        case CI_NET_MSG_DB_NUM_CALLS:
+            cinet_message_set_int(msg, CI_NET_FIELD_COUNT, 123456);
+            break;
+        case CI_NET_MSG_DB_CALL_LIST:
+            cinet_message_set_int(msg, CI_NET_FIELD_USER, -1);
+            cinet_message_set_int(msg, CI_NET_FIELD_OFFSET, 10);
+            cinet_message_set_int(msg, CI_NET_FIELD_COUNT, 20);
+            cinet_msg_list_builder_init(&builder, msg);
+            for (i = 0; i < 20; ++i)
+                test_fill_call_info(cinet_msg_list_builder_add_call(&builder), 500 - i);
+            cinet_msg_list_builder_finish(&builder);
+            break;
+        case CI_NET_MSG_DB_GET_CALLER:
+        case CI_NET_MSG_DB_ADD_CALLER:
+        case CI_NET_MSG_DB_DEL_CALLER:
+            /* These share their layout. */
+            cinet_message_set_int(msg, CI_NET_FIELD_USER, 5);
+            test_fill_caller_info(&((CINetMsgDbGetCaller*)msg)->caller, msgtype);
+            break;
+        case CI_NET_MSG_DB_GET_CALLER_LIST:
+            cinet_message_set_int(msg, CI_NET_FIELD_USER, 2);
+            cinet_message_set_string(msg, CI_NET_FIELD_FILTER, "M\xc3\xbc");
+            for (i = 0; i < 5; ++i)
+                test_fill_caller_info(cinet_msg_db_get_caller_list_append(msg), i);
+            break;
+        default:
+            break;
+    }
+
+    return msg;
+}
+
+/* Write @msg with @flags, read it back with @read_flags and compare. */
+static void test_roundtrip_msg(CINetMsg *msg, guint32 flags, guint32 read_flags)
+{
+    CINetMsgHeader header;
+    CINetMsg *result = NULL;
+    gchar *buffer = NULL;
+    gsize len = 0;
+
+    g_assert_cmpint(cinet_msg_write_msg_full(&buffer, &len, msg, flags), ==, 0);
+    g_assert_cmpint(cinet_msg_read_header(&header, buffer, len), ==, CINET_HEADER_LENGTH);
+    g_assert_cmpint(header.msgtype, ==, msg->msgtype);
+    g_assert_cmpuint(header.msglen + CINET_HEADER_LENGTH, ==, len);
+
+    g_assert_cmpint(cinet_msg_read_msg_full(&result, buffer, len, read_flags), ==, 0);
+    test_check_msg(msg, result);
+
+    cinet_msg_free(result);
+    g_free(buffer);
+}
+
+static void test_roundtrip(guint32 flags)
+{
+    CINetMsg *msg;
+    guint t;
+
+    for (t = 0; t < CI_NET_MSG_COUNT; ++t) {
+        msg = test_sample_msg(t);
+        test_roundtrip_msg(msg, flags, 0);
+        test_roundtrip_msg(msg, flags, CINET_READ_ARENA);
+        test_roundtrip_msg(msg, flags, CINET_READ_VIEW);
+        cinet_msg_free(msg);
+    }
+}
+
+static void test_roundtrip_json(void)
+{
+    test_roundtrip(0);
+}
+
+static void test_roundtrip_binary(void)
+{
+    test_roundtrip(CI_NET_MSG_FLAG_BINARY);
+}
+
+static void test_roundtrip_columns(void)
+{
+    test_roundtrip(CI_NET_MSG_FLAG_BINARY | CI_NET_MSG_FLAG_COLUMNS);
+}
+
+/* Columnar lists with members missing in some rows, strings repeated and
+ * unique, ids going up and down, and an empty string. */
+static void test_columns_sparse(void)
+{
+    CINetMsg *calls = cinet_msg_alloc(CI_NET_MSG_DB_CALL_LIST);
+    CINetMsg *callers = cinet_msg_alloc(CI_NET_MSG_DB_GET_CALLER_LIST);
+    CICallInfo *info;
+    CICallerInfo *caller;
+    gchar *unique;
+    gint i;
+
+    for (i = 0; i < 300; ++i) {
+        info = cinet_msg_db_call_list_append(calls);
+        info->id = i % 7 == 0 ? -i : 1000 - 3 * i;
+        unique = g_strdup_printf("0301234%d", i);
+        cinet_call_info_set_field(info, CI_NET_FIELD_COMPLETENUMBER, unique);
+        if (i % 2)
+            cinet_call_info_set_field(info, CI_NET_FIELD_AREA, i % 4 == 1 ? "Berlin" : "Hamburg");
+        if (i % 3)
+            cinet_call_info_set_field(info, CI_NET_FIELD_NAME, i % 5 ? "Caller" : "");
+        g_free(unique);
+
+        caller = cinet_msg_db_get_caller_list_append(callers);
+        if (i % 4)
+            cinet_caller_info_set_field(caller, CI_NET_FIELD_NUMBER, i % 8 == 1 ? "030" : "040");
+        if (i % 5)
+            cinet_caller_info_set_field(caller, CI_NET_FIELD_NAME, "Caller");
+    }
+
+    test_roundtrip_msg(calls, CI_NET_MSG_FLAG_BINARY | CI_NET_MSG_FLAG_COLUMNS, 0);
+    test_roundtrip_msg(calls, CI_NET_MSG_FLAG_BINARY | CI_NET_MSG_FLAG_COLUMNS, CINET_READ_VIEW);
+    test_roundtrip_msg(callers, CI_NET_MSG_FLAG_BINARY | CI_NET_MSG_FLAG_COLUMNS, 0);
+    test_roundtrip_msg(callers, CI_NET_MSG_FLAG_BINARY | CI_NET_MSG_FLAG_COLUMNS, CINET_READ_VIEW);
+
+    cinet_msg_free(callers);
+    cinet_msg_free(calls);
+}
+
+/* Repeated strings go into the dictionary, so the columns are smaller. */
+static void test_columns_size(void)
+{
+    CINetMsg *msg = test_sample_msg(CI_NET_MSG_DB_CALL_LIST);
+
+    g_assert_cmpint(cinet_msg_get_size(msg, CI_NET_MSG_FLAG_BINARY | CI_NET_MSG_FLAG_COLUMNS), <,
+                    cinet_msg_get_size(msg, CI_NET_MSG_FLAG_BINARY));
+
+    cinet_msg_free(msg);
+}
+
+/* Write @msg with @flags, read it back and check that it is written the
+ * same way again. */
+static void test_rewrite_msg(CINetMsg *msg, guint32 flags)
+{
+    CINetMsg *result = NULL;
+    gchar *buffer = NULL, *again = NULL;
+    gsize len = 0, again_len = 0;
+
+    g_assert_cmpint(cinet_msg_write_msg_full(&buffer, &len, msg, flags), ==, 0);
+    g_assert_cmpint(cinet_msg_read_msg(&result, buffer, len), ==, 0);
+    g_assert_cmpint(cinet_msg_write_msg_full(&again, &again_len, result, flags), ==, 0);
+    g_assert_cmpuint(len, ==, again_len);
+    g_assert_true(memcmp(buffer, again, len) == 0);
+
+    cinet_msg_free(result);
+    g_free(again);
+    g_free(buffer);
+}
+
+/* Empty messages leave out the optional members. JSON sends some NULL strings
+ * as "", so only the encoding is compared. */
+static void test_roundtrip_empty(void)
+{
+    CINetMsg *msg;
+    guint t;
+
+    for (t = 0; t < CI_NET_MSG_COUNT; ++t) {
+        msg = cinet_msg_alloc(t);
+        test_rewrite_msg(msg, 0);
+        test_rewrite_msg(msg, CI_NET_MSG_FLAG_BINARY);
+        test_rewrite_msg(msg, CI_NET_MSG_FLAG_BINARY | CI_NET_MSG_FLAG_COLUMNS);
+        cinet_msg_free(msg);
+    }
+}
+
+/* A message read with @CINET_READ_VIEW keeps its values after the buffer is gone. */
+static void test_materialize(void)
+{
+    CINetMsg *msg = test_sample_msg(CI_NET_MSG_DB_CALL_LIST);
+    CINetMsg *view = NULL, *copy;
+    gchar *buffer = NULL;
+    gsize len = 0;
+
+    g_assert_cmpint(cinet_msg_write_msg_full(&buffer, &len, msg, CI_NET_MSG_FLAG_BINARY), ==, 0);
+    g_assert_cmpint(cinet_msg_read_msg_full(&view, buffer, len, CINET_READ_VIEW), ==, 0);
+
+    copy = cinet_msg_materialize(view);
+    cinet_msg_free(view);
+    memset(buffer, 0, len);
+    g_free(buffer);
+
+    test_check_msg(msg, copy);
+    cinet_msg_free(copy);
+    cinet_msg_free(msg);
+}
+
+/* The setters of a message decoded into an arena replace its strings without
+ * freeing those of the arena, and free those they set before. */
+static void test_arena_setters(void)
+{
+    static const guint32 read_flags[] = { CINET_READ_ARENA, CINET_READ_VIEW };
+    CINetMsg *msg = test_sample_msg(CI_NET_MSG_EVENT_RING);
+    CINetMsg *result;
+    gchar *buffer = NULL, *copy;
+    gsize len = 0;
+    guint i;
+
+    g_assert_cmpint(cinet_msg_write_msg_full(&buffer, &len, msg, CI_NET_MSG_FLAG_BINARY), ==, 0);
+
+    for (i = 0; i < G_N_ELEMENTS(read_flags); ++i) {
+        copy = g_malloc(len);
+        memcpy(copy, buffer, len);
+        result = NULL;
+        g_assert_cmpint(cinet_msg_read_msg_full(&result, copy, len, read_flags[i]), ==, 0);
+        cinet_message_set_string(result, CI_NET_FIELD_NAME, "First");
+        cinet_message_set_string(result, CI_NET_FIELD_NAME, "Second");
+        cinet_message_set_string(result, CI_NET_FIELD_AREA, NULL);
+        g_assert_cmpstr(((CINetMsgEventRing*)result)->callinfo.name, ==, "Second");
+        g_assert_null(((CINetMsgEventRing*)result)->callinfo.area);
+        g_assert_cmpstr(((CINetMsgEventRing*)result)->callinfo.msn, ==, "987654");
+        cinet_msg_free(result);
+        g_free(copy);
+    }
+
+    g_free(buffer);
+    cinet_msg_free(msg);
+}
+
+/* Entries of a builder follow those already in the list, also if the list
+ * changed in between. */
+static void test_list_builder(void)
+{
+    CINetMsg *msg = cinet_msg_alloc(CI_NET_MSG_DB_CALL_LIST);
+    CINetMsgDbCallList *list = (CINetMsgDbCallList*)msg;
+    CINetMsgListBuilder builder;
+    CICallInfo *info;
+    GList *link;
+    gint i;
+
+    cinet_msg_list_builder_init(&builder, msg);
+    g_assert_null(cinet_msg_list_builder_add_caller(&builder));
+    for (i = 2; i < 1000; ++i)
+        cinet_msg_list_builder_add_call(&builder)->id = i;
+
+    cinet_msg_db_call_list_append(msg)->id = 0;
+    cinet_msg_db_call_list_append(msg)->id = 1;
+    info = cinet_msg_db_call_list_append(msg);
+    list->calls = g_list_remove(list->calls, info);
+    cinet_call_info_free_full(info);
+    cinet_msg_list_builder_finish(&builder);
+
+    /* The builder can be used again. */
+    cinet_msg_list_builder_add_call(&builder)->id = 1000;
+    cinet_msg_list_builder_finish(&builder);
+    cinet_msg_list_builder_finish(&builder);
+
+    g_assert_cmpuint(cinet_msg_db_call_list_get_length(msg), ==, 1001);
+    for (link = list->calls, i = 0; link != NULL; link = link->next, ++i)
+        g_assert_cmpint(((CICallInfo*)link->data)->id, ==, i);
+
+    cinet_msg_free(msg);
+}
+
+/* Setters refuse to change a message with more than one reference. */
+static void test_shared(void)
+{
+    CINetMsg *msg = test_sample_msg(CI_NET_MSG_DB_CALL_LIST);
+    CINetMsgListBuilder builder;
+
+    cinet_msg_ref(msg);
+
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*cinet_msg_is_shared*");
+    cinet_message_set_int(msg, CI_NET_FIELD_USER, 9);
+    g_test_assert_expected_messages();
+    g_assert_cmpint(((CINetMsgDbCallList*)msg)->user, ==, -1);
+
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*cinet_msg_is_shared*");
+    g_assert_null(cinet_msg_db_call_list_append(msg));
+    g_test_assert_expected_messages();
+
+    cinet_msg_list_builder_init(&builder, msg);
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_CRITICAL, "*cinet_msg_is_shared*");
+    g_assert_null(cinet_msg_list_builder_add_call(&builder));
+    g_test_assert_expected_messages();
+    g_assert_cmpuint(cinet_msg_db_call_list_get_length(msg), ==, 20);
+
+    cinet_msg_unref(msg);
+    cinet_message_set_int(msg, CI_NET_FIELD_USER, 9);
+    g_assert_cmpint(((CINetMsgDbCallList*)msg)->user, ==, 9);
+    g_assert_nonnull(cinet_msg_db_call_list_append(msg));
+
+    cinet_msg_free(msg);
+}
+
+/* The same message must be encoded the same way by all writers. */
+static void test_writers(void)
+{
+    CINetMsg *msg = test_sample_msg(CI_NET_MSG_EVENT_RING);
+    GString *str = g_string_new(NULL);
+    GBytes *bytes;
+    gchar *buffer = NULL, *data;
+    gsize len = 0;
+    gssize size;
+
+    g_assert_cmpint(cinet_msg_write_msg_full(&buffer, &len, msg, CI_NET_MSG_FLAG_BINARY), ==, 0);
+
+    size = cinet_msg_get_size(msg, CI_NET_MSG_FLAG_BINARY);
+    g_assert_cmpint(size, ==, (gssize)len);
+
+    data = g_malloc(len);
+    g_assert_cmpint(cinet_msg_write_msg_to_buffer(data, len, msg, CI_NET_MSG_FLAG_BINARY), ==, (gssize)len);
+    g_assert_true(memcmp(data, buffer, len) == 0);
+    g_assert_cmpint(cinet_msg_write_msg_to_buffer(data, len - 1, msg, CI_NET_MSG_FLAG_BINARY), ==, -1);
+    g_free(data);
+
+    g_assert_cmpint(cinet_msg_append_msg(str, msg, CI_NET_MSG_FLAG_BINARY), ==, (gssize)len);
+    g_assert_cmpuint(str->len, ==, len);
+    g_assert_true(memcmp(str->str, buffer, len) == 0);
+
+    bytes = cinet_msg_write_bytes(msg, CI_NET_MSG_FLAG_BINARY);
+    g_assert_cmpuint(g_bytes_get_size(bytes), ==, len);
+    g_assert_true(memcmp(g_bytes_get_data(bytes, NULL), buffer, len) == 0);
+
+    g_bytes_unref(bytes);
+    g_string_free(str, TRUE);
+    g_free(buffer);
+    cinet_msg_free(msg);
+}
+
+/* Writing the vectors of a batch in pieces of any size, ending in the middle
+ * of headers and payloads, gives the frames as written one by one. */
+static void test_batch_consume(void)
+{
+    static const gsize steps[] = { 1, CINET_HEADER_LENGTH - 1, 3, CINET_HEADER_LENGTH + 5, 2, 1000, 7 };
+    CINetMsgBatch *batch = cinet_msg_batch_new();
+    GString *expected = g_string_new(NULL);
+    GString *written = g_string_new(NULL);
+    CINetIOVector vectors[3];
+    CINetMsg *msg;
+    GBytes *bytes;
+    gchar *buffer = NULL;
+    gsize len = 0, step, size, done;
+    guint round, i, n, k;
+
+    msg = test_sample_msg(CI_NET_MSG_EVENT_RING);
+    g_assert_cmpint(cinet_msg_write_msg(&buffer, &len, msg), ==, 0);
+    bytes = cinet_msg_write_bytes(msg, CI_NET_MSG_FLAG_BINARY);
+
+    /* The batch starts over once everything is written. */
+    for (round = 0; round < 2; ++round) {
+        g_string_truncate(expected, 0);
+        g_string_truncate(written, 0);
+
+        g_assert_cmpint(cinet_msg_batch_add_msg(batch, msg, 0), ==, 0);
+        g_assert_cmpint(cinet_msg_append_msg(expected, msg, 0), >, 0);
+        g_assert_cmpint(cinet_msg_batch_add_bytes(batch, bytes), ==, 0);
+        g_string_append_len(expected, g_bytes_get_data(bytes, NULL), g_bytes_get_size(bytes));
+        g_assert_cmpint(cinet_msg_batch_add_payload(batch, CI_NET_MSG_EVENT_RING, 0,
+                                                    buffer + CINET_HEADER_LENGTH, len - CINET_HEADER_LENGTH), ==, 0);
+        g_string_append_len(expected, buffer, len);
+        for (i = 0; i < 5; ++i) {
+            g_assert_cmpint(cinet_msg_batch_add_msg(batch, msg, CI_NET_MSG_FLAG_BINARY), ==, 0);
+            g_assert_cmpint(cinet_msg_append_msg(expected, msg, CI_NET_MSG_FLAG_BINARY), >, 0);
+        }
+
+        /* Write at most one step from at most three vectors at a time, like
+         * a short @writev(). */
+        for (k = 0; cinet_msg_batch_get_pending(batch) > 0; ++k) {
+            g_assert_cmpuint(cinet_msg_batch_get_pending(batch), ==, expected->len - written->len);
+            n = cinet_msg_batch_get_vectors(batch, vectors, G_N_ELEMENTS(vectors));
+            g_assert_cmpuint(n, >, 0);
+
+            step = steps[(k + round) % G_N_ELEMENTS(steps)];
+            for (i = 0, done = 0; i < n && done < step; ++i) {
+                size = MIN(vectors[i].size, step - done);
+                g_string_append_len(written, vectors[i].buffer, size);
+                done += size;
+            }
+            cinet_msg_batch_consume(batch, done);
+        }
+
+        g_assert_cmpuint(cinet_msg_batch_get_vectors(batch, vectors, G_N_ELEMENTS(vectors)), ==, 0);
+        g_assert_cmpuint(written->len, ==, expected->len);
+        g_assert_true(memcmp(written->str, expected->str, expected->len) == 0);
+    }
+
+    g_bytes_unref(bytes);
+    g_string_free(expected, TRUE);
+    g_string_free(written, TRUE);
+    g_free(buffer);
+    cinet_msg_free(msg);
+    cinet_msg_batch_free(batch);
+}
+
+/* Messages not allocated by the library can be set, written and freed, even
+ * with garbage where the library keeps its data. */
+static void test_foreign(void)
+{
+    struct {
+        gchar garbage[64];
+        CINetMsgEventRing msg;
+    } block;
+    CINetMsg *msg = (CINetMsg*)&block.msg, *heap, *result = NULL;
+    gchar *buffer = NULL;
+    gsize len = 0;
+
+    memset(&block, 0xa5, sizeof(block));
+    memset(&block.msg, 0, sizeof(block.msg));
+    memset(&msg->priv, 0xa5, sizeof(msg->priv));
+    msg->msgtype = CI_NET_MSG_EVENT_RING;
+
+    cinet_message_set_value(msg, "guid", GUINT_TO_POINTER(7));
+    cinet_message_set_value(msg, "name", "Foreign");
+    cinet_message_set_value(msg, "name", "Stack");
+    g_assert_cmpstr(block.msg.callinfo.name, ==, "Stack");
+    g_assert_cmpint(cinet_msg_write_msg(&buffer, &len, msg), ==, 0);
+    g_assert_cmpint(cinet_msg_read_msg(&result, buffer, len), ==, 0);
+    test_check_msg(msg, result);
+    g_free(block.msg.callinfo.name);
+
+    heap = g_malloc0(sizeof(CINetMsgEventRing));
+    heap->msgtype = CI_NET_MSG_EVENT_RING;
+    cinet_message_set_value(heap, "name", "Heap");
+    g_assert_cmpstr(((CINetMsgEventRing*)heap)->callinfo.name, ==, "Heap");
+    cinet_msg_free(heap);
+
+    cinet_msg_free(result);
+    g_free(buffer);
+}
+
+/* Writing to a buffer of the caller gives the same frame as writing a new
+ * message. Strings are only borrowed, list entries are taken over. */
+static void test_new_for_buffer(void)
+{
+    gchar name[] = "M\xc3\xbcller";
+    gchar *buffer = NULL, data[512];
+    gsize len = 0;
+    gssize size;
+
+    g_assert_cmpint(cinet_message_new_for_data(&buffer, &len, CI_NET_MSG_EVENT_RING,
+                                               "msgid", "ring-2", "stage", GINT_TO_POINTER(MultipartStageInit),
+                                               "name", name, "number", "0301234", "name", name, NULL, NULL), ==, 0);
+    size = cinet_message_new_for_buffer(data, sizeof(data), 0, CI_NET_MSG_EVENT_RING,
+                                        "msgid", "ring-2", "stage", GINT_TO_POINTER(MultipartStageInit),
+                                        "name", name, "number", "0301234", "name", name, NULL, NULL);
+    g_assert_cmpint(size, ==, (gssize)len);
+    g_assert_true(memcmp(data, buffer, len) == 0);
+    g_assert_cmpstr(name, ==, "M\xc3\xbcller");
+    g_free(buffer);
+
+    size = cinet_message_new_for_buffer(data, sizeof(data), CI_NET_MSG_FLAG_BINARY, CI_NET_MSG_DB_CALL_LIST,
+                                        "user", GINT_TO_POINTER(3), "call", cinet_call_info_new(), NULL, NULL);
+    g_assert_cmpint(size, >, CINET_HEADER_LENGTH);
+    g_assert_cmpint(cinet_message_new_for_buffer(data, 10, 0, CI_NET_MSG_EVENT_RING, "name", name, NULL, NULL),
+                    ==, -1);
+}
+
+/* Number of threads and messages per thread of the pool test. */
+#define TEST_POOL_THREADS 4
+#define TEST_POOL_MSGS 200
+
+/* The messages of one thread in the pool test. */
+typedef struct {
+    CINetMsg *msgs[TEST_POOL_MSGS];
+    gboolean alloc;                   /* Allocate the messages, free them otherwise. */
+} TestPoolSlice;
+
+static CINetMsgType test_pool_type(guint i)
+{
+    return i % 2 ? CI_NET_MSG_EVENT_RING : CI_NET_MSG_DB_CALL_LIST;
+}
+
+/* A message from the pool is as new. */
+static void test_check_pooled(CINetMsg *msg, CINetMsgType msgtype)
+{
+    g_assert_nonnull(msg);
+    g_assert_cmpint(msg->msgtype, ==, msgtype);
+    g_assert_cmpuint(msg->guid, ==, 0);
+    if (msgtype == CI_NET_MSG_EVENT_RING)
+        g_assert_null(((CINetMsgEventRing*)msg)->callinfo.name);
+    else
+        g_assert_null(((CINetMsgDbCallList*)msg)->calls);
+}
+
+static gpointer test_pool_thread(gpointer data)
+{
+    TestPoolSlice *slice = data;
+    CINetMsg *msg;
+    guint i;
+
+    for (i = 0; i < TEST_POOL_MSGS; ++i) {
+        if (!slice->alloc) {
+            cinet_msg_free(slice->msgs[i]);
+            slice->msgs[i] = NULL;
+            continue;
+        }
+
+        /* Reuse a message freed by this thread, then keep one for another. */
+        cinet_msg_free(test_sample_msg(test_pool_type(i)));
+        msg = cinet_msg_alloc(test_pool_type(i));
+        test_check_pooled(msg, test_pool_type(i));
+        cinet_msg_free(msg);
+
+        slice->msgs[i] = test_sample_msg(test_pool_type(i));
+    }
+
+    return NULL;
+}
+
+/* Run @test_pool_thread() on all slices, each thread on its own one. */
+static void test_pool_run(TestPoolSlice *slices, gboolean alloc)
+{
+    GThread *threads[TEST_POOL_THREADS];
+    guint t;
+
+    for (t = 0; t < TEST_POOL_THREADS; ++t) {
+        slices[t].alloc = alloc;
+        threads[t] = g_thread_new("pool", test_pool_thread, &slices[t]);
+    }
+    for (t = 0; t < TEST_POOL_THREADS; ++t)
+        g_thread_join(threads[t]);
+}
+
+/* Messages allocated in one thread and freed in another are reused, and are
+ * freed when the pool is disabled. */
+static void test_pool(void)
+{
+    TestPoolSlice *slices = g_new0(TestPoolSlice, TEST_POOL_THREADS);
+    TestPoolSlice swap;
+    CINetMsg *msg;
+    guint round, i;
+
+    cinet_msg_pool_set_max(TEST_POOL_MSGS);
+
+    for (round = 0; round < 5; ++round) {
+        test_pool_run(slices, TRUE);
+
+        /* Let each thread free the messages of its neighbour. */
+        swap = slices[0];
+        for (i = 0; i + 1 < TEST_POOL_THREADS; ++i)
+            slices[i] = slices[i + 1];
+        slices[TEST_POOL_THREADS - 1] = swap;
+
+        test_pool_run(slices, FALSE);
+    }
+
+    /* Fill the cache of this thread before disabling the pool. */
+    for (i = 0; i < TEST_POOL_MSGS; ++i)
+        slices[0].msgs[i] = test_sample_msg(test_pool_type(i));
+    for (i = 0; i < TEST_POOL_MSGS; ++i)
+        cinet_msg_free(slices[0].msgs[i]);
+
+    cinet_msg_pool_set_max(0);
+
+    for (i = 0; i < TEST_POOL_MSGS; ++i) {
+        msg = cinet_msg_alloc(test_pool_type(i));
+        test_check_pooled(msg, test_pool_type(i));
+        cinet_msg_free(msg);
+    }
+
+    g_free(slices);
+}
+
+/* Payloads that do not decode must be rejected. */
+static void test_invalid(void)
+{
+    CINetMsg *msg = test_sample_msg(CI_NET_MSG_EVENT_CALL);
+    CINetMsg *result = NULL;
+    gchar *buffer = NULL;
+    gsize len = 0, cut;
+
+    g_assert_cmpint(cinet_msg_write_msg(&buffer, &len, msg), ==, 0);
+    for (cut = 0; cut < len; ++cut) {
+        result = NULL;
+        g_assert_cmpint(cinet_msg_read_msg(&result, buffer, cut), ==, -1);
+        g_assert_null(result);
+    }
+
+    g_free(buffer);
+    cinet_msg_free(msg);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/messages/roundtrip/json", test_roundtrip_json);
+    g_test_add_func("/messages/roundtrip/binary", test_roundtrip_binary);
+    g_test_add_func("/messages/roundtrip/columns", test_roundtrip_columns);
+    g_test_add_func("/messages/roundtrip/empty", test_roundtrip_empty);
+    g_test_add_func("/messages/columns/sparse", test_columns_sparse);
+    g_test_add_func("/messages/columns/size", test_columns_size);
+    g_test_add_func("/messages/materialize", test_materialize);
+    g_test_add_func("/messages/list/builder", test_list_builder);
+    g_test_add_func("/messages/shared", test_shared);
+    g_test_add_func("/messages/arena/setters", test_arena_setters);
+    g_test_add_func("/messages/writers", test_writers);
+    g_test_add_func("/messages/batch/consume", test_batch_consume);
+    g_test_add_func("/messages/new-for-buffer", test_new_for_buffer);
+    g_test_add_func("/messages/foreign", test_foreign);
+    g_test_add_func("/messages/pool", test_pool);
+    g_test_add_func("/messages/invalid", test_invalid);
+
+    return g_test_run();
+}
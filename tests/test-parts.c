@@ -0,0 +1,347 @@
+#include <cinet.h>
+#include <string.h>
+
+/* Produces the calls of a list and collects the frames written. */
+typedef struct {
+    gint next_id;
+    gint n_calls;
+    GPtrArray *frames;                /* GBytes */
+} TestParts;
+
+static gboolean test_parts_next(CICallInfo *info, gpointer userdata)
+{
+    TestParts *parts = userdata;
+    gchar *name;
+
+    if (parts->next_id >= parts->n_calls)
+        return FALSE;
+
+    name = g_strdup_printf("Caller %d", parts->next_id);
+    info->id = parts->next_id++;
+    cinet_call_info_set_field(info, CI_NET_FIELD_NAME, name);
+    g_free(name);
+
+    return TRUE;
+}
+
+static gint test_parts_write(const gchar *data, gsize len, gpointer userdata)
+{
+    TestParts *parts = userdata;
+
+    g_ptr_array_add(parts->frames, g_bytes_new(data, len));
+
+    return 0;
+}
+
+/* Send a list of @n_calls calls in parts of @max_rows.
+ *
+ * @return: The frames. Free with @g_ptr_array_unref().
+ */
+static GPtrArray *test_write_parts(const gchar *msgid, gint n_calls, guint max_rows, guint32 flags)
+{
+    CINetMsg *msg = cinet_msg_alloc(CI_NET_MSG_DB_CALL_LIST);
+    TestParts parts = { 0, n_calls, g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref) };
+
+    msg->guid = 77;
+    cinet_message_set_int(msg, CI_NET_FIELD_COUNT, n_calls);
+    g_assert_cmpint(cinet_msg_db_call_list_write_parts(msg, msgid, max_rows, flags,
+                                                        test_parts_next, test_parts_write, &parts), ==, 0);
+    g_assert_cmpint(parts.next_id, ==, n_calls);
+    cinet_msg_free(msg);
+
+    return parts.frames;
+}
+
+/* Decode @frame from a copy, as views terminate their strings in place.
+ *
+ * @return: The message. With @CINET_READ_VIEW it is only valid until @buffer is freed.
+ */
+static CINetMsg *test_read_frame(GBytes *frame, guint32 read_flags, gchar **buffer)
+{
+    CINetMsg *msg = NULL;
+    gsize len;
+    const gchar *data = g_bytes_get_data(frame, &len);
+
+    *buffer = g_malloc(len);
+    memcpy(*buffer, data, len);
+    g_assert_cmpint(cinet_msg_read_msg_full(&msg, *buffer, len, read_flags), ==, 0);
+
+    return msg;
+}
+
+/* Decode @frame and add it to @assembler, which copies what it keeps of a view.
+ *
+ * @return: The result of @cinet_msg_assembler_add().
+ */
+static CINetMsg *test_add_frame(CINetMsgAssembler *assembler, GBytes *frame, guint32 read_flags)
+{
+    CINetMsg *result;
+    gchar *buffer;
+
+    result = cinet_msg_assembler_add(assembler, test_read_frame(frame, read_flags, &buffer));
+    g_free(buffer);
+
+    return result;
+}
+
+static void test_check_list(CINetMsg *msg, gint n_calls)
+{
+    CINetMsgDbCallList *list = (CINetMsgDbCallList*)msg;
+    CICallInfo *info;
+    gchar *name;
+    GList *link;
+    gint i = 0;
+
+    g_assert_nonnull(msg);
+    g_assert_cmpint(msg->msgtype, ==, CI_NET_MSG_DB_CALL_LIST);
+    g_assert_cmpuint(msg->guid, ==, 77);
+    g_assert_cmpint(list->count, ==, n_calls);
+    g_assert_cmpint(list->stage, ==, MultipartStageComplete);
+    g_assert_cmpuint(cinet_msg_db_call_list_get_length(msg), ==, n_calls);
+
+    for (link = list->calls; link; link = link->next, ++i) {
+        info = link->data;
+        name = g_strdup_printf("Caller %d", i);
+        g_assert_cmpint(info->id, ==, i);
+        g_assert_cmpstr(info->name, ==, name);
+        g_free(name);
+    }
+}
+
+/* Parts are numbered, each holds at most max_rows calls and an empty
+ * Complete part ends the list. */
+static void test_write(void)
+{
+    static const gint n_calls[] = { 0, 1, 9, 10, 11, 100 };
+    CINetMsgDbCallList *part;
+    GPtrArray *frames;
+    gchar *buffer;
+    guint i, k, n_parts;
+    gint rows;
+
+    for (i = 0; i < G_N_ELEMENTS(n_calls); ++i) {
+        frames = test_write_parts("list", n_calls[i], 10, CI_NET_MSG_FLAG_BINARY);
+        n_parts = MAX(1, (n_calls[i] + 9) / 10) + 1;
+        g_assert_cmpuint(frames->len, ==, n_parts);
+
+        for (k = 0, rows = 0; k < frames->len; ++k) {
+            part = (CINetMsgDbCallList*)test_read_frame(g_ptr_array_index(frames, k), 0, &buffer);
+            g_assert_cmpstr(part->msgid, ==, "list");
+            g_assert_cmpint(part->part, ==, k);
+            g_assert_cmpint(part->stage, ==, k == 0 ? MultipartStageInit :
+                                             k + 1 == frames->len ? MultipartStageComplete :
+                                             MultipartStageUpdate);
+            g_assert_cmpuint(cinet_msg_db_call_list_get_length((CINetMsg*)part), <=, 10);
+            rows += cinet_msg_db_call_list_get_length((CINetMsg*)part);
+            if (k + 1 == frames->len)
+                g_assert_null(part->calls);
+            cinet_msg_free((CINetMsg*)part);
+            g_free(buffer);
+        }
+        g_assert_cmpint(rows, ==, n_calls[i]);
+
+        g_ptr_array_unref(frames);
+    }
+}
+
+/* Feed all @frames to @assembler.
+ *
+ * @return: The complete list or NULL.
+ */
+static CINetMsg *test_assemble(CINetMsgAssembler *assembler, GPtrArray *frames, guint32 read_flags)
+{
+    CINetMsg *result = NULL;
+    guint k;
+
+    for (k = 0; k < frames->len; ++k) {
+        g_assert_null(result);
+        result = test_add_frame(assembler, g_ptr_array_index(frames, k), read_flags);
+    }
+
+    return result;
+}
+
+static void test_assemble_modes(void)
+{
+    static const guint32 read_flags[] = { 0, CINET_READ_ARENA, CINET_READ_VIEW };
+    static const guint32 flags[] = { 0, CI_NET_MSG_FLAG_BINARY, CI_NET_MSG_FLAG_BINARY | CI_NET_MSG_FLAG_COLUMNS };
+    CINetMsgAssembler *assembler = cinet_msg_assembler_new(0);
+    CINetMsg *result;
+    GPtrArray *frames;
+    guint i, k;
+
+    for (i = 0; i < G_N_ELEMENTS(flags); ++i) {
+        frames = test_write_parts("list", 95, 10, flags[i]);
+        for (k = 0; k < G_N_ELEMENTS(read_flags); ++k) {
+            result = test_assemble(assembler, frames, read_flags[k]);
+            test_check_list(result, 95);
+            cinet_msg_free(result);
+        }
+        g_ptr_array_unref(frames);
+    }
+
+    cinet_msg_assembler_free(assembler);
+}
+
+/* Messages that are no parts pass through. */
+static void test_assemble_passthrough(void)
+{
+    CINetMsgAssembler *assembler = cinet_msg_assembler_new(0);
+    CINetMsg *msg;
+
+    msg = cinet_msg_alloc(CI_NET_MSG_EVENT_CALL);
+    g_assert_true(cinet_msg_assembler_add(assembler, msg) == msg);
+    cinet_msg_free(msg);
+
+    msg = cinet_msg_alloc(CI_NET_MSG_DB_CALL_LIST);
+    cinet_msg_db_call_list_append(msg);
+    g_assert_true(cinet_msg_assembler_add(assembler, msg) == msg);
+    cinet_msg_free(msg);
+
+    cinet_msg_assembler_free(assembler);
+}
+
+/* Two lists sent at the same time are kept apart by their msgid. */
+static void test_assemble_interleaved(void)
+{
+    CINetMsgAssembler *assembler = cinet_msg_assembler_new(0);
+    GPtrArray *a = test_write_parts("a", 30, 10, CI_NET_MSG_FLAG_BINARY);
+    GPtrArray *b = test_write_parts("b", 12, 5, 0);
+    CINetMsg *result, *done_a = NULL, *done_b = NULL;
+    guint k;
+
+    for (k = 0; k < MAX(a->len, b->len); ++k) {
+        if (k < a->len && (result = test_add_frame(assembler, g_ptr_array_index(a, k), 0)))
+            done_a = result;
+        if (k < b->len && (result = test_add_frame(assembler, g_ptr_array_index(b, k), 0)))
+            done_b = result;
+    }
+
+    test_check_list(done_a, 30);
+    test_check_list(done_b, 12);
+
+    cinet_msg_free(done_a);
+    cinet_msg_free(done_b);
+    g_ptr_array_unref(a);
+    g_ptr_array_unref(b);
+    cinet_msg_assembler_free(assembler);
+}
+
+/* A list with a missing part is dropped, its later parts are ignored. */
+static void test_assemble_missing(void)
+{
+    CINetMsgAssembler *assembler = cinet_msg_assembler_new(0);
+    GPtrArray *frames = test_write_parts("list", 30, 10, CI_NET_MSG_FLAG_BINARY);
+    CINetMsg *result;
+
+    g_ptr_array_remove_index(frames, 2);
+    g_assert_null(test_assemble(assembler, frames, 0));
+
+    /* Parts without an Init are dropped as well. */
+    g_ptr_array_remove_index(frames, 0);
+    g_assert_null(test_assemble(assembler, frames, 0));
+
+    /* A new Init starts over. */
+    g_ptr_array_unref(frames);
+    frames = test_write_parts("list", 30, 10, CI_NET_MSG_FLAG_BINARY);
+    result = test_assemble(assembler, frames, 0);
+    test_check_list(result, 30);
+
+    cinet_msg_free(result);
+    g_ptr_array_unref(frames);
+    cinet_msg_assembler_free(assembler);
+}
+
+/* Parts referenced elsewhere keep their calls, the list gets copies. */
+static void test_assemble_shared(void)
+{
+    CINetMsgAssembler *assembler = cinet_msg_assembler_new(0);
+    GPtrArray *frames = test_write_parts("list", 30, 10, CI_NET_MSG_FLAG_BINARY);
+    GPtrArray *parts = g_ptr_array_new_with_free_func((GDestroyNotify)cinet_msg_unref);
+    CINetMsg *part, *result = NULL;
+    gchar *buffer;
+    guint k;
+
+    for (k = 0; k < frames->len; ++k) {
+        part = test_read_frame(g_ptr_array_index(frames, k), 0, &buffer);
+        g_free(buffer);
+        g_ptr_array_add(parts, cinet_msg_ref(part));
+        g_assert_null(result);
+        result = cinet_msg_assembler_add(assembler, part);
+    }
+
+    test_check_list(result, 30);
+    g_assert_false(result == g_ptr_array_index(parts, 0));
+    for (k = 0; k + 1 < parts->len; ++k)
+        g_assert_cmpuint(cinet_msg_db_call_list_get_length(g_ptr_array_index(parts, k)), ==, 10);
+
+    cinet_msg_free(result);
+    g_ptr_array_unref(parts);
+    g_ptr_array_unref(frames);
+    cinet_msg_assembler_free(assembler);
+}
+
+/* Lists with more than max_rows calls are dropped, also if the Init part
+ * alone is too large. */
+static void test_assemble_max_rows(void)
+{
+    CINetMsgAssembler *assembler = cinet_msg_assembler_new(20);
+    GPtrArray *frames;
+    CINetMsg *result;
+
+    frames = test_write_parts("list", 21, 10, CI_NET_MSG_FLAG_BINARY);
+    g_assert_null(test_assemble(assembler, frames, 0));
+    g_ptr_array_unref(frames);
+
+    frames = test_write_parts("list", 21, 30, CI_NET_MSG_FLAG_BINARY);
+    g_assert_null(test_assemble(assembler, frames, 0));
+    g_ptr_array_unref(frames);
+
+    frames = test_write_parts("list", 20, 30, CI_NET_MSG_FLAG_BINARY);
+    result = test_assemble(assembler, frames, 0);
+    test_check_list(result, 20);
+    cinet_msg_free(result);
+
+    /* The limit can be changed. */
+    cinet_msg_assembler_set_max_rows(assembler, 0);
+    g_ptr_array_unref(frames);
+    frames = test_write_parts("list", 50, 30, CI_NET_MSG_FLAG_BINARY);
+    result = test_assemble(assembler, frames, 0);
+    test_check_list(result, 50);
+    cinet_msg_free(result);
+
+    g_ptr_array_unref(frames);
+    cinet_msg_assembler_free(assembler);
+}
+
+/* A list removed from the assembler is not completed by its later parts. */
+static void test_assemble_remove(void)
+{
+    CINetMsgAssembler *assembler = cinet_msg_assembler_new(0);
+    GPtrArray *frames = test_write_parts("list", 30, 10, CI_NET_MSG_FLAG_BINARY);
+    guint k;
+
+    g_assert_null(test_add_frame(assembler, g_ptr_array_index(frames, 0), 0));
+    cinet_msg_assembler_remove(assembler, "list");
+    for (k = 1; k < frames->len; ++k)
+        g_assert_null(test_add_frame(assembler, g_ptr_array_index(frames, k), 0));
+
+    g_ptr_array_unref(frames);
+    cinet_msg_assembler_free(assembler);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/parts/write", test_write);
+    g_test_add_func("/parts/assemble/modes", test_assemble_modes);
+    g_test_add_func("/parts/assemble/passthrough", test_assemble_passthrough);
+    g_test_add_func("/parts/assemble/interleaved", test_assemble_interleaved);
+    g_test_add_func("/parts/assemble/missing", test_assemble_missing);
+    g_test_add_func("/parts/assemble/shared", test_assemble_shared);
+    g_test_add_func("/parts/assemble/max-rows", test_assemble_max_rows);
+    g_test_add_func("/parts/assemble/remove", test_assemble_remove);
+
+    return g_test_run();
+}
@@ -0,0 +1,374 @@
+#include <cinet.h>
+#include <string.h>
+
+#define TEST_N_MESSAGES 50
+
+/* Append @n calls with ids counting from @first to @stream. */
+static void test_append_calls(GString *stream, gint first, gint n, guint32 flags)
+{
+    CINetMsg *msg;
+    gint i;
+
+    for (i = first; i < first + n; ++i) {
+        msg = cinet_message_new(CI_NET_MSG_EVENT_CALL, "name", "Caller", NULL, NULL);
+        ((CINetMsgEventCall*)msg)->callinfo.id = i;
+        msg->guid = i;
+        g_assert_cmpint(cinet_msg_append_msg(stream, msg, flags), >, 0);
+        cinet_msg_free(msg);
+    }
+}
+
+/* Read all messages from @reader and check that the calls with ids from
+ * @first on follow each other.
+ *
+ * @return: The number of messages read.
+ */
+static gint test_read_calls(CINetMsgReader *reader, gint first)
+{
+    CINetMsg *msg;
+    gint n = 0;
+
+    while (cinet_msg_reader_next_msg(reader, &msg)) {
+        g_assert_cmpint(msg->msgtype, ==, CI_NET_MSG_EVENT_CALL);
+        g_assert_cmpint(((CINetMsgEventCall*)msg)->callinfo.id, ==, first + n);
+        g_assert_cmpstr(((CINetMsgEventCall*)msg)->callinfo.name, ==, "Caller");
+        cinet_msg_free(msg);
+        ++n;
+    }
+
+    return n;
+}
+
+/* Feed @stream in chunks of @chunk bytes. */
+static gint test_feed_chunks(CINetMsgReader *reader, GString *stream, gsize chunk, gint first)
+{
+    gsize pos;
+    gint n = 0;
+
+    for (pos = 0; pos < stream->len; pos += chunk) {
+        cinet_msg_reader_feed(reader, stream->str + pos, MIN(chunk, stream->len - pos));
+        n += test_read_calls(reader, first + n);
+    }
+
+    return n;
+}
+
+static void test_chunks(void)
+{
+    static const gsize chunks[] = { 1, 3, 7, CINET_HEADER_LENGTH, 64, 1000, G_MAXSIZE };
+    GString *stream = g_string_new(NULL);
+    CINetMsgReader *reader;
+    guint i;
+
+    test_append_calls(stream, 0, TEST_N_MESSAGES, 0);
+    test_append_calls(stream, TEST_N_MESSAGES, TEST_N_MESSAGES, CI_NET_MSG_FLAG_BINARY);
+
+    for (i = 0; i < G_N_ELEMENTS(chunks); ++i) {
+        reader = cinet_msg_reader_new(0);
+        g_assert_cmpint(test_feed_chunks(reader, stream, chunks[i], 0), ==, 2 * TEST_N_MESSAGES);
+        g_assert_cmpuint(cinet_msg_reader_get_dropped(reader), ==, 0);
+        cinet_msg_reader_free(reader);
+    }
+
+    g_string_free(stream, TRUE);
+}
+
+/* Receive directly into the buffer of the reader. */
+static void test_get_buffer(void)
+{
+    GString *stream = g_string_new(NULL);
+    CINetMsgReader *reader = cinet_msg_reader_new(0);
+    gchar *buffer;
+    gsize pos, len;
+    gint n = 0;
+
+    test_append_calls(stream, 0, TEST_N_MESSAGES, CI_NET_MSG_FLAG_BINARY);
+
+    for (pos = 0; pos < stream->len; pos += len) {
+        buffer = cinet_msg_reader_get_buffer(reader, &len);
+        g_assert_nonnull(buffer);
+        g_assert_cmpuint(len, >, 0);
+        len = MIN(MIN(len, 5), stream->len - pos);
+        memcpy(buffer, stream->str + pos, len);
+        cinet_msg_reader_commit(reader, len);
+        n += test_read_calls(reader, n);
+    }
+
+    g_assert_cmpint(n, ==, TEST_N_MESSAGES);
+    g_assert_cmpuint(cinet_msg_reader_get_dropped(reader), ==, 0);
+
+    cinet_msg_reader_free(reader);
+    g_string_free(stream, TRUE);
+}
+
+/* Garbage between frames is skipped and counted, the frames around it are read. */
+static void test_resync(void)
+{
+    static const gchar *garbage[] = {
+        "garbage",
+        "ci-m",                       /* Start of a magic string. */
+        "ci-msgXX",                   /* Magic string with a truncated header. */
+        "\0\0\0\0\0",
+    };
+    static const gsize garbage_len[] = { 7, 4, 8, 5 };
+    GString *stream = g_string_new(NULL);
+    CINetMsgReader *reader;
+    gsize dropped = 0;
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(garbage); ++i) {
+        g_string_append_len(stream, garbage[i], garbage_len[i]);
+        dropped += garbage_len[i];
+        test_append_calls(stream, i * 2, 2, i % 2 ? CI_NET_MSG_FLAG_BINARY : 0);
+    }
+
+    for (i = 1; i < 16; i += 7) {
+        reader = cinet_msg_reader_new(0);
+        g_assert_cmpint(test_feed_chunks(reader, stream, i, 0), ==, 2 * G_N_ELEMENTS(garbage));
+        g_assert_cmpuint(cinet_msg_reader_get_dropped(reader), ==, dropped);
+        cinet_msg_reader_free(reader);
+    }
+
+    g_string_free(stream, TRUE);
+}
+
+/* The flags of a header are only written when passed explicitly, stale
+ * values in @CINetMsgHeader.flags do not leak into the type. */
+static void test_header_flags(void)
+{
+    CINetMsgHeader header, result;
+    gchar data[CINET_HEADER_LENGTH];
+
+    memset(&header, 0xff, sizeof(header));
+    header.msgtype = CI_NET_MSG_EVENT_CALL;
+    header.msglen = 42;
+
+    g_assert_cmpint(cinet_msg_write_header(data, sizeof(data), &header), ==, CINET_HEADER_LENGTH);
+    g_assert_cmpint(cinet_msg_read_header(&result, data, sizeof(data)), ==, CINET_HEADER_LENGTH);
+    g_assert_cmpint(result.msgtype, ==, CI_NET_MSG_EVENT_CALL);
+    g_assert_cmpuint(result.msglen, ==, 42);
+    g_assert_cmpuint(result.flags, ==, 0);
+
+    g_assert_cmpint(cinet_msg_write_header_full(data, sizeof(data), &header, CI_NET_MSG_FLAG_BINARY), ==,
+                    CINET_HEADER_LENGTH);
+    g_assert_cmpint(cinet_msg_read_header(&result, data, sizeof(data)), ==, CINET_HEADER_LENGTH);
+    g_assert_cmpint(result.msgtype, ==, CI_NET_MSG_EVENT_CALL);
+    g_assert_cmpuint(result.flags, ==, CI_NET_MSG_FLAG_BINARY);
+}
+
+/* A header announcing a frame larger than the limit means the stream is out
+ * of sync. The reader must not wait for the frame. */
+static void test_oversized(void)
+{
+    GString *stream = g_string_new(NULL);
+    CINetMsgReader *reader = cinet_msg_reader_new(1024);
+    CINetMsgHeader header = { CI_NET_MSG_EVENT_CALL, 1 << 20, 0 };
+    gchar data[CINET_HEADER_LENGTH];
+
+    g_assert_cmpint(cinet_msg_write_header(data, sizeof(data), &header), ==, CINET_HEADER_LENGTH);
+    g_string_append_len(stream, data, sizeof(data));
+    test_append_calls(stream, 0, 3, 0);
+
+    g_assert_cmpint(test_feed_chunks(reader, stream, stream->len, 0), ==, 3);
+    g_assert_cmpuint(cinet_msg_reader_get_dropped(reader), ==, CINET_HEADER_LENGTH);
+
+    cinet_msg_reader_free(reader);
+    g_string_free(stream, TRUE);
+}
+
+/* An intact frame with a payload that does not decode is dropped whole. */
+static void test_undecodable(void)
+{
+    static const gchar payload[] = "{\"guid\": 1, \"name\": ";
+    GString *stream = g_string_new(NULL);
+    CINetMsgReader *reader = cinet_msg_reader_new(0);
+    CINetMsgHeader header = { CI_NET_MSG_EVENT_CALL, sizeof(payload) - 1, 0 };
+    gchar data[CINET_HEADER_LENGTH];
+
+    test_append_calls(stream, 0, 2, 0);
+    g_assert_cmpint(cinet_msg_write_header(data, sizeof(data), &header), ==, CINET_HEADER_LENGTH);
+    g_string_append_len(stream, data, sizeof(data));
+    g_string_append_len(stream, payload, sizeof(payload) - 1);
+    test_append_calls(stream, 2, 2, 0);
+
+    g_assert_cmpint(test_feed_chunks(reader, stream, 3, 0), ==, 4);
+    g_assert_cmpuint(cinet_msg_reader_get_dropped(reader), ==, CINET_HEADER_LENGTH + sizeof(payload) - 1);
+
+    cinet_msg_reader_free(reader);
+    g_string_free(stream, TRUE);
+}
+
+/* Decode more frames than fit in two chunks with several threads. Frames that
+ * cannot be decoded are skipped, the incomplete frame at the end is left. */
+static void test_read_many(void)
+{
+    static const gchar payload[] = "{\"guid\": 1, \"name\": ";
+    static const guint threads[] = { 1, 2, 4 };
+    CINetMsgHeader header = { CI_NET_MSG_EVENT_CALL, sizeof(payload) - 1, 0 };
+    GString *stream = g_string_new(NULL);
+    gchar data[CINET_HEADER_LENGTH];
+    GPtrArray *msgs;
+    CINetMsg *msg;
+    gsize complete;
+    gint n, id;
+    guint i, t;
+
+    g_assert_cmpint(cinet_msg_write_header(data, sizeof(data), &header), ==, CINET_HEADER_LENGTH);
+
+    /* Enough calls for more than three chunks of 32 frames, with an
+     * undecodable frame after every 10 calls. */
+    n = 3 * 32 + 17;
+    for (id = 0; id < n; id += 10) {
+        test_append_calls(stream, id, MIN(10, n - id), 0);
+        g_string_append_len(stream, data, sizeof(data));
+        g_string_append_len(stream, payload, sizeof(payload) - 1);
+    }
+    complete = stream->len;
+    test_append_calls(stream, n, 1, 0);
+    g_string_truncate(stream, stream->len - 5);
+
+    for (t = 0; t < G_N_ELEMENTS(threads); ++t) {
+        msgs = g_ptr_array_new_with_free_func((GDestroyNotify)cinet_msg_free);
+        g_assert_cmpint(cinet_msg_read_many(stream->str, stream->len, 0, threads[t], msgs), ==, (gssize)complete);
+        g_assert_cmpuint(msgs->len, ==, n);
+        for (i = 0; i < msgs->len; ++i) {
+            msg = g_ptr_array_index(msgs, i);
+            g_assert_cmpint(msg->msgtype, ==, CI_NET_MSG_EVENT_CALL);
+            g_assert_cmpint(((CINetMsgEventCall*)msg)->callinfo.id, ==, i);
+            g_assert_cmpstr(((CINetMsgEventCall*)msg)->callinfo.name, ==, "Caller");
+        }
+        g_ptr_array_unref(msgs);
+    }
+
+    g_string_free(stream, TRUE);
+}
+
+/* Bitwise CRC32C as reference for the one of the library. */
+static guint32 test_crc32c(const guchar *data, gsize len)
+{
+    guint32 crc = 0xffffffff;
+    gint k;
+
+    while (len--) {
+        crc ^= *data++;
+        for (k = 0; k < 8; ++k)
+            crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+    }
+
+    return ~crc;
+}
+
+/* The trailer is the CRC32C of header and payload, least significant byte
+ * first. Names of all lengths cover the tails of the word-wise CRC. */
+static void test_checksum_trailer(void)
+{
+    CINetMsgHeader header;
+    CINetMsg *msg, *result;
+    gchar name[40];
+    gchar *buffer;
+    gsize len, i;
+    guint32 crc;
+
+    g_assert_cmpuint(test_crc32c((const guchar*)"123456789", 9), ==, 0xe3069283);
+
+    for (i = 0; i < sizeof(name); ++i) {
+        memset(name, 'a' + i % 26, i);
+        name[i] = '\0';
+        msg = cinet_message_new(CI_NET_MSG_EVENT_CALL, "name", name, NULL, NULL);
+
+        g_assert_cmpint(cinet_msg_write_msg_full(&buffer, &len, msg, CI_NET_MSG_FLAG_CHECKSUM), ==, 0);
+        g_assert_cmpint(cinet_msg_read_header(&header, buffer, len), ==, CINET_HEADER_LENGTH);
+        g_assert_cmpuint(header.flags & CI_NET_MSG_FLAG_CHECKSUM, !=, 0);
+        g_assert_cmpuint(header.msglen + CINET_HEADER_LENGTH, ==, len);
+
+        crc = test_crc32c((const guchar*)buffer, len - CINET_CHECKSUM_LENGTH);
+        g_assert_cmpuint((guchar)buffer[len - 4], ==, crc & 0xff);
+        g_assert_cmpuint((guchar)buffer[len - 3], ==, (crc >> 8) & 0xff);
+        g_assert_cmpuint((guchar)buffer[len - 2], ==, (crc >> 16) & 0xff);
+        g_assert_cmpuint((guchar)buffer[len - 1], ==, crc >> 24);
+
+        g_assert_cmpint(cinet_msg_read_msg(&result, buffer, len), ==, 0);
+        g_assert_cmpstr(((CINetMsgEventCall*)result)->callinfo.name, ==, name);
+
+        cinet_msg_free(result);
+        cinet_msg_free(msg);
+        g_free(buffer);
+    }
+}
+
+/* Any changed byte makes the frame fail. */
+static void test_checksum_corrupt(void)
+{
+    static const guint32 flags[] = {
+        CI_NET_MSG_FLAG_CHECKSUM,
+        CI_NET_MSG_FLAG_CHECKSUM | CI_NET_MSG_FLAG_BINARY,
+        CI_NET_MSG_FLAG_CHECKSUM | CI_NET_MSG_FLAG_COMPRESSED,
+    };
+    CINetMsg *msg, *result;
+    GString *name = g_string_new(NULL);
+    gchar *buffer;
+    gsize len, i;
+    guint f;
+
+    /* Large enough to be compressed. */
+    while (name->len < 2 * CINET_COMPRESS_DEFAULT_THRESHOLD)
+        g_string_append(name, "Caller ");
+    msg = cinet_message_new(CI_NET_MSG_EVENT_CALL, "name", name->str, NULL, NULL);
+
+    for (f = 0; f < G_N_ELEMENTS(flags); ++f) {
+        g_assert_cmpint(cinet_msg_write_msg_full(&buffer, &len, msg, flags[f]), ==, 0);
+        g_assert_cmpint(cinet_msg_read_msg(&result, buffer, len), ==, 0);
+        cinet_msg_free(result);
+
+        for (i = 0; i < len; ++i) {
+            buffer[i] ^= 0x10;
+            result = NULL;
+            g_assert_cmpint(cinet_msg_read_msg(&result, buffer, len), ==, -1);
+            g_assert_null(result);
+            buffer[i] ^= 0x10;
+        }
+        g_free(buffer);
+    }
+
+    cinet_msg_free(msg);
+    g_string_free(name, TRUE);
+}
+
+/* The reader drops a broken frame whole and continues with the next one. */
+static void test_checksum_reader(void)
+{
+    GString *stream = g_string_new(NULL);
+    CINetMsgReader *reader = cinet_msg_reader_new(0);
+    gsize start, broken;
+
+    test_append_calls(stream, 0, 2, CI_NET_MSG_FLAG_CHECKSUM);
+    start = stream->len;
+    test_append_calls(stream, 100, 1, CI_NET_MSG_FLAG_CHECKSUM | CI_NET_MSG_FLAG_BINARY);
+    broken = stream->len - start;
+    stream->str[stream->len - CINET_CHECKSUM_LENGTH - 1] ^= 0x01;
+    test_append_calls(stream, 2, 2, CI_NET_MSG_FLAG_CHECKSUM);
+
+    g_assert_cmpint(test_feed_chunks(reader, stream, 5, 0), ==, 4);
+    g_assert_cmpuint(cinet_msg_reader_get_dropped(reader), ==, broken);
+
+    cinet_msg_reader_free(reader);
+    g_string_free(stream, TRUE);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/reader/chunks", test_chunks);
+    g_test_add_func("/reader/get-buffer", test_get_buffer);
+    g_test_add_func("/reader/resync", test_resync);
+    g_test_add_func("/reader/header/flags", test_header_flags);
+    g_test_add_func("/reader/oversized", test_oversized);
+    g_test_add_func("/reader/undecodable", test_undecodable);
+    g_test_add_func("/reader/read-many", test_read_many);
+    g_test_add_func("/reader/checksum/trailer", test_checksum_trailer);
+    g_test_add_func("/reader/checksum/corrupt", test_checksum_corrupt);
+    g_test_add_func("/reader/checksum/reader", test_checksum_reader);
+
+    return g_test_run();
+}
@@ -0,0 +1,537 @@
+#include <cinetrequest.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* Time to wait for a callback, in milliseconds. */
+#define TEST_TIMEOUT 5000
+
+/* A tracker on one end of a socket pair, the test acts as the peer. */
+typedef struct {
+    gint fd;
+    CINetConnection *conn;
+    CINetRequestTracker *tracker;
+    gint unhandled;                   /* Messages received that were no reply. */
+    gboolean closed;
+} TestPeer;
+
+/* The outcome of a request. */
+typedef struct {
+    CINetRequestTracker *tracker;
+    gboolean done;
+    CINetMsg *reply;
+    GError *error;
+} TestResult;
+
+static void test_peer_message(CINetConnection *conn, CINetMsg *msg, gpointer userdata)
+{
+    TestPeer *peer = userdata;
+
+    if (!cinet_request_tracker_dispatch(peer->tracker, msg))
+        peer->unhandled++;
+}
+
+static void test_peer_closed(CINetConnection *conn, const GError *error, gpointer userdata)
+{
+    TestPeer *peer = userdata;
+
+    peer->closed = TRUE;
+    cinet_request_tracker_fail_all(peer->tracker, NULL);
+}
+
+static const CINetConnectionCallbacks test_peer_callbacks = {
+    test_peer_message,
+    NULL,
+    test_peer_closed
+};
+
+static TestPeer *test_peer_new(void)
+{
+    TestPeer *peer = g_malloc0(sizeof(TestPeer));
+    GSocketConnection *conn;
+    GSocket *socket;
+    gint fds[2];
+
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+
+    socket = g_socket_new_from_fd(fds[0], NULL);
+    g_assert_nonnull(socket);
+    conn = g_socket_connection_factory_create_connection(socket);
+    peer->conn = cinet_connection_new(G_IO_STREAM(conn), NULL, &test_peer_callbacks, peer);
+    g_assert_nonnull(peer->conn);
+    g_object_unref(conn);
+    g_object_unref(socket);
+
+    peer->fd = fds[1];
+    peer->tracker = cinet_request_tracker_new(peer->conn);
+
+    return peer;
+}
+
+static void test_peer_free(TestPeer *peer)
+{
+    cinet_request_tracker_free(peer->tracker);
+    cinet_connection_close(peer->conn);
+    cinet_connection_unref(peer->conn);
+    if (peer->fd >= 0)
+        close(peer->fd);
+    g_free(peer);
+}
+
+static gint test_peer_write(const gchar *data, gsize len, gpointer userdata)
+{
+    TestPeer *peer = userdata;
+
+    g_assert_cmpint(write(peer->fd, data, len), ==, (gssize)len);
+
+    return 0;
+}
+
+/* Send @msg to the tracker and free it. */
+static void test_peer_reply(TestPeer *peer, CINetMsg *msg)
+{
+    gchar *buffer;
+    gsize len;
+
+    g_assert_cmpint(cinet_msg_write_msg(&buffer, &len, msg), ==, 0);
+    test_peer_write(buffer, len, peer);
+    g_free(buffer);
+    cinet_msg_free(msg);
+}
+
+static gboolean test_timed_out(gpointer userdata)
+{
+    *(gboolean*)userdata = TRUE;
+
+    return FALSE;
+}
+
+/* Run the default context until @value reaches @expected. */
+static void test_wait_int(gint *value, gint expected)
+{
+    GSource *guard = g_timeout_source_new(TEST_TIMEOUT);
+    gboolean expired = FALSE;
+
+    g_source_set_callback(guard, test_timed_out, &expired, NULL);
+    g_source_attach(guard, NULL);
+
+    while (*value != expected && !expired)
+        g_main_context_iteration(NULL, TRUE);
+
+    g_source_destroy(guard);
+    g_source_unref(guard);
+    g_assert_cmpint(*value, ==, expected);
+}
+
+static void test_request_done(GObject *source, GAsyncResult *result, gpointer userdata)
+{
+    TestResult *res = userdata;
+
+    g_assert_false(res->done);
+    res->reply = cinet_request_tracker_send_finish(res->tracker, result, &res->error);
+    res->done = TRUE;
+}
+
+static void test_result_clear(TestResult *res)
+{
+    if (res->reply)
+        cinet_msg_free(res->reply);
+    g_clear_error(&res->error);
+    memset(res, 0, sizeof(TestResult));
+}
+
+/* Send @msg as a request and free it.
+ *
+ * @return: The guid assigned to the request.
+ */
+static guint32 test_send_msg(TestPeer *peer, CINetMsg *msg, guint timeout, GCancellable *cancellable,
+                             TestResult *res)
+{
+    guint32 guid;
+
+    res->tracker = peer->tracker;
+    cinet_request_tracker_send_async(peer->tracker, msg, timeout, cancellable, test_request_done, res);
+    guid = msg->guid;
+    cinet_msg_free(msg);
+
+    return guid;
+}
+
+/* Send an empty request of @msgtype.
+ *
+ * @return: The guid assigned to the request.
+ */
+static guint32 test_send(TestPeer *peer, CINetMsgType msgtype, guint timeout, GCancellable *cancellable,
+                         TestResult *res)
+{
+    return test_send_msg(peer, cinet_msg_alloc(msgtype), timeout, cancellable, res);
+}
+
+static CINetMsg *test_num_calls_new(guint32 guid, gint count)
+{
+    CINetMsg *msg = cinet_msg_alloc(CI_NET_MSG_DB_NUM_CALLS);
+
+    msg->guid = guid;
+    cinet_message_set_int(msg, CI_NET_FIELD_COUNT, count);
+
+    return msg;
+}
+
+static void test_assert_num_calls(TestResult *res, guint32 guid, gint count)
+{
+    g_assert_true(res->done);
+    g_assert_no_error(res->error);
+    g_assert_nonnull(res->reply);
+    g_assert_cmpint(res->reply->msgtype, ==, CI_NET_MSG_DB_NUM_CALLS);
+    g_assert_cmpuint(res->reply->guid, ==, guid);
+    g_assert_cmpint(((CINetMsgDbNumCalls*)res->reply)->count, ==, count);
+}
+
+/* Replies arriving in a different order than the requests reach the right one. */
+static void test_request_interleaved(void)
+{
+    TestPeer *peer = test_peer_new();
+    TestResult first = { 0 }, second = { 0 };
+    guint32 guid1, guid2;
+
+    guid1 = test_send(peer, CI_NET_MSG_DB_NUM_CALLS, 0, NULL, &first);
+    guid2 = test_send(peer, CI_NET_MSG_DB_NUM_CALLS, 0, NULL, &second);
+    g_assert_cmpuint(guid1, !=, 0);
+    g_assert_cmpuint(guid2, !=, 0);
+    g_assert_cmpuint(guid1, !=, guid2);
+    g_assert_cmpuint(cinet_request_tracker_get_pending(peer->tracker), ==, 2);
+
+    test_peer_reply(peer, test_num_calls_new(guid2, 2));
+    test_wait_int(&second.done, TRUE);
+    g_assert_false(first.done);
+    test_assert_num_calls(&second, guid2, 2);
+
+    test_peer_reply(peer, test_num_calls_new(guid1, 1));
+    test_wait_int(&first.done, TRUE);
+    test_assert_num_calls(&first, guid1, 1);
+
+    g_assert_cmpuint(cinet_request_tracker_get_pending(peer->tracker), ==, 0);
+    g_assert_cmpint(peer->unhandled, ==, 0);
+
+    test_result_clear(&first);
+    test_result_clear(&second);
+    test_peer_free(peer);
+}
+
+static void test_request_timeout(void)
+{
+    TestPeer *peer = test_peer_new();
+    TestResult res = { 0 };
+    guint32 guid;
+
+    guid = test_send(peer, CI_NET_MSG_DB_NUM_CALLS, 50, NULL, &res);
+    test_wait_int(&res.done, TRUE);
+    g_assert_error(res.error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT);
+    g_assert_null(res.reply);
+    g_assert_cmpuint(cinet_request_tracker_get_pending(peer->tracker), ==, 0);
+
+    /* A late reply is no reply anymore. */
+    test_peer_reply(peer, test_num_calls_new(guid, 1));
+    test_wait_int(&peer->unhandled, 1);
+
+    test_result_clear(&res);
+    test_peer_free(peer);
+}
+
+static void test_request_cancel(void)
+{
+    TestPeer *peer = test_peer_new();
+    GCancellable *cancellable = g_cancellable_new();
+    TestResult res = { 0 };
+
+    test_send(peer, CI_NET_MSG_DB_NUM_CALLS, 0, cancellable, &res);
+    g_assert_cmpuint(cinet_request_tracker_get_pending(peer->tracker), ==, 1);
+
+    g_cancellable_cancel(cancellable);
+    test_wait_int(&res.done, TRUE);
+    g_assert_error(res.error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+    g_assert_null(res.reply);
+    g_assert_cmpuint(cinet_request_tracker_get_pending(peer->tracker), ==, 0);
+
+    test_result_clear(&res);
+    g_object_unref(cancellable);
+    test_peer_free(peer);
+}
+
+/* Closing the connection fails all pending requests. */
+static void test_request_closed(void)
+{
+    TestPeer *peer = test_peer_new();
+    TestResult first = { 0 }, second = { 0 };
+
+    test_send(peer, CI_NET_MSG_DB_NUM_CALLS, 0, NULL, &first);
+    test_send(peer, CI_NET_MSG_DB_CALL_LIST, 0, NULL, &second);
+
+    close(peer->fd);
+    peer->fd = -1;
+    test_wait_int(&first.done, TRUE);
+    test_wait_int(&second.done, TRUE);
+    g_assert_true(peer->closed);
+    g_assert_error(first.error, G_IO_ERROR, G_IO_ERROR_CLOSED);
+    g_assert_error(second.error, G_IO_ERROR, G_IO_ERROR_CLOSED);
+    g_assert_cmpuint(cinet_request_tracker_get_pending(peer->tracker), ==, 0);
+
+    test_result_clear(&first);
+    test_result_clear(&second);
+    test_peer_free(peer);
+}
+
+/* Produces the calls of a list sent in parts. */
+typedef struct {
+    TestPeer *peer;
+    gint next_id;
+    gint n_calls;
+} TestCalls;
+
+static gboolean test_calls_next(CICallInfo *info, gpointer userdata)
+{
+    TestCalls *calls = userdata;
+
+    if (calls->next_id >= calls->n_calls)
+        return FALSE;
+
+    info->id = calls->next_id++;
+    cinet_call_info_set_field(info, CI_NET_FIELD_NAME, "Caller");
+
+    return TRUE;
+}
+
+static gint test_calls_write(const gchar *data, gsize len, gpointer userdata)
+{
+    return test_peer_write(data, len, ((TestCalls*)userdata)->peer);
+}
+
+/* The parts of a @CI_NET_MSG_DB_CALL_LIST reply complete the request once. */
+static void test_request_parts(void)
+{
+    TestPeer *peer = test_peer_new();
+    TestCalls calls = { peer, 0, 25 };
+    TestResult res = { 0 };
+    CINetMsg *msg;
+    GList *tmp;
+    gint id;
+
+    msg = cinet_msg_alloc(CI_NET_MSG_DB_CALL_LIST);
+    msg->guid = test_send(peer, CI_NET_MSG_DB_CALL_LIST, 0, NULL, &res);
+    cinet_message_set_int(msg, CI_NET_FIELD_COUNT, calls.n_calls);
+
+    /* Write the parts in one go, the tracker receives them back to back. */
+    g_assert_cmpint(cinet_msg_db_call_list_write_parts(msg, "list", 10, 0,
+                                                        test_calls_next, test_calls_write, &calls), ==, 0);
+    cinet_msg_free(msg);
+
+    test_wait_int(&res.done, TRUE);
+    g_assert_no_error(res.error);
+    g_assert_nonnull(res.reply);
+    g_assert_cmpint(res.reply->msgtype, ==, CI_NET_MSG_DB_CALL_LIST);
+    g_assert_cmpint(((CINetMsgDbCallList*)res.reply)->stage, ==, MultipartStageComplete);
+    g_assert_cmpuint(cinet_msg_db_call_list_get_length(res.reply), ==, calls.n_calls);
+    for (tmp = ((CINetMsgDbCallList*)res.reply)->calls, id = 0; tmp; tmp = g_list_next(tmp), ++id)
+        g_assert_cmpint(((CICallInfo*)tmp->data)->id, ==, id);
+
+    g_assert_cmpuint(cinet_request_tracker_get_pending(peer->tracker), ==, 0);
+    g_assert_cmpint(peer->unhandled, ==, 0);
+
+    test_result_clear(&res);
+    test_peer_free(peer);
+}
+
+/* A message with the guid of a request but another type is no reply. */
+static void test_request_mismatch(void)
+{
+    TestPeer *peer = test_peer_new();
+    TestResult res = { 0 };
+    CINetMsg *msg;
+    guint32 guid;
+
+    guid = test_send(peer, CI_NET_MSG_DB_NUM_CALLS, 0, NULL, &res);
+
+    msg = cinet_msg_alloc(CI_NET_MSG_DB_CALL_LIST);
+    msg->guid = guid;
+    test_peer_reply(peer, msg);
+    test_wait_int(&peer->unhandled, 1);
+    g_assert_false(res.done);
+    g_assert_cmpuint(cinet_request_tracker_get_pending(peer->tracker), ==, 1);
+
+    test_peer_reply(peer, test_num_calls_new(guid, 3));
+    test_wait_int(&res.done, TRUE);
+    test_assert_num_calls(&res, guid, 3);
+    g_assert_cmpint(peer->unhandled, ==, 1);
+
+    test_result_clear(&res);
+    test_peer_free(peer);
+}
+
+/* Create a @CI_NET_MSG_DB_GET_CALLER, @CI_NET_MSG_DB_ADD_CALLER or
+ * @CI_NET_MSG_DB_DEL_CALLER for a caller of user 1.
+ *
+ * @name: The name of the caller or NULL.
+ */
+static CINetMsg *test_caller_new(CINetMsgType msgtype, guint32 guid, const gchar *number, const gchar *name)
+{
+    CINetMsg *msg = cinet_msg_alloc(msgtype);
+    CICallerInfo *caller = &((CINetMsgDbGetCaller*)msg)->caller;
+
+    msg->guid = guid;
+    cinet_message_set_int(msg, CI_NET_FIELD_USER, 1);
+    cinet_caller_info_set_field(caller, CI_NET_FIELD_NUMBER, (const gpointer)number);
+    if (name)
+        cinet_caller_info_set_field(caller, CI_NET_FIELD_NAME, (const gpointer)name);
+
+    return msg;
+}
+
+/* Look up the caller with @number and check that it is called @name.
+ *
+ * @name:   The name of the caller, the empty string if it is not known.
+ * @cached: Whether the lookup must be answered from the cache. Otherwise the
+ *          peer answers with @name.
+ */
+static void test_lookup(TestPeer *peer, const gchar *number, const gchar *name, gboolean cached)
+{
+    CINetMsgDbGetCaller *reply;
+    TestResult res = { 0 };
+    guint32 guid;
+
+    guid = test_send_msg(peer, test_caller_new(CI_NET_MSG_DB_GET_CALLER, 0, number, NULL), 0, NULL, &res);
+    g_assert_cmpuint(cinet_request_tracker_get_pending(peer->tracker), ==, cached ? 0 : 1);
+    if (!cached)
+        test_peer_reply(peer, test_caller_new(CI_NET_MSG_DB_GET_CALLER, guid, number, name));
+
+    test_wait_int(&res.done, TRUE);
+    g_assert_no_error(res.error);
+    g_assert_nonnull(res.reply);
+    reply = (CINetMsgDbGetCaller*)res.reply;
+    g_assert_cmpint(reply->user, ==, 1);
+    g_assert_cmpstr(reply->caller.number, ==, number);
+    g_assert_cmpstr(reply->caller.name ? reply->caller.name : "", ==, name);
+
+    test_result_clear(&res);
+}
+
+/* Send a @CI_NET_MSG_DB_ADD_CALLER or @CI_NET_MSG_DB_DEL_CALLER and answer it. */
+static void test_change_caller(TestPeer *peer, CINetMsgType msgtype, const gchar *number)
+{
+    TestResult res = { 0 };
+    guint32 guid;
+
+    guid = test_send_msg(peer, test_caller_new(msgtype, 0, number, "Changed"), 0, NULL, &res);
+    test_peer_reply(peer, test_caller_new(msgtype, guid, number, NULL));
+    test_wait_int(&res.done, TRUE);
+    g_assert_no_error(res.error);
+
+    test_result_clear(&res);
+}
+
+/* The least recently used caller is dropped from a full cache. */
+static void test_cache_lru(void)
+{
+    TestPeer *peer = test_peer_new();
+
+    cinet_request_tracker_set_caller_cache(peer->tracker, 2, 0);
+
+    test_lookup(peer, "0301", "Alice", FALSE);
+    test_lookup(peer, "0302", "Bob", FALSE);
+    test_lookup(peer, "0301", "Alice", TRUE);
+
+    /* Bob is dropped, Alice was used more recently. */
+    test_lookup(peer, "0303", "Carol", FALSE);
+    test_lookup(peer, "0301", "Alice", TRUE);
+    test_lookup(peer, "0303", "Carol", TRUE);
+    test_lookup(peer, "0302", "Bob", FALSE);
+
+    /* Now Alice is the least recently used one. */
+    test_lookup(peer, "0302", "Bob", TRUE);
+    test_lookup(peer, "0303", "Carol", TRUE);
+    test_lookup(peer, "0301", "Alice", FALSE);
+
+    /* Disabling the cache clears it. */
+    cinet_request_tracker_set_caller_cache(peer->tracker, 0, 0);
+    test_lookup(peer, "0301", "Alice", FALSE);
+    test_lookup(peer, "0301", "Alice", FALSE);
+
+    test_peer_free(peer);
+}
+
+/* Callers not found are only cached for the negative ttl. */
+static void test_cache_negative(void)
+{
+    TestPeer *peer = test_peer_new();
+
+    cinet_request_tracker_set_caller_cache(peer->tracker, 10, 1);
+
+    test_lookup(peer, "0301", "Alice", FALSE);
+    test_lookup(peer, "0309", "", FALSE);
+    test_lookup(peer, "0309", "", TRUE);
+
+    g_usleep(G_USEC_PER_SEC + 100000);
+
+    test_lookup(peer, "0301", "Alice", TRUE);
+    test_lookup(peer, "0309", "Dave", FALSE);
+    test_lookup(peer, "0309", "Dave", TRUE);
+
+    test_peer_free(peer);
+}
+
+/* Adding or deleting a caller drops it from the cache, and lookups already
+ * sent are not cached. */
+static void test_cache_invalidate(void)
+{
+    TestPeer *peer = test_peer_new();
+    TestResult res = { 0 };
+    guint32 guid;
+
+    cinet_request_tracker_set_caller_cache(peer->tracker, 10, 0);
+
+    test_lookup(peer, "0301", "Alice", FALSE);
+    test_change_caller(peer, CI_NET_MSG_DB_ADD_CALLER, "0301");
+    test_lookup(peer, "0301", "Alicia", FALSE);
+    test_lookup(peer, "0301", "Alicia", TRUE);
+
+    test_lookup(peer, "0302", "Bob", FALSE);
+    test_change_caller(peer, CI_NET_MSG_DB_DEL_CALLER, "0302");
+    test_lookup(peer, "0302", "", FALSE);
+
+    /* The reply to a lookup sent before the caller was added is delivered
+     * but not cached. */
+    guid = test_send_msg(peer, test_caller_new(CI_NET_MSG_DB_GET_CALLER, 0, "0303", NULL), 0, NULL, &res);
+    test_change_caller(peer, CI_NET_MSG_DB_ADD_CALLER, "0303");
+    test_peer_reply(peer, test_caller_new(CI_NET_MSG_DB_GET_CALLER, guid, "0303", ""));
+    test_wait_int(&res.done, TRUE);
+    g_assert_no_error(res.error);
+    test_result_clear(&res);
+    test_lookup(peer, "0303", "Carol", FALSE);
+
+    /* The same for a lookup sent before the caller was deleted. */
+    guid = test_send_msg(peer, test_caller_new(CI_NET_MSG_DB_GET_CALLER, 0, "0304", NULL), 0, NULL, &res);
+    test_change_caller(peer, CI_NET_MSG_DB_DEL_CALLER, "0304");
+    test_peer_reply(peer, test_caller_new(CI_NET_MSG_DB_GET_CALLER, guid, "0304", "Dave"));
+    test_wait_int(&res.done, TRUE);
+    g_assert_no_error(res.error);
+    test_result_clear(&res);
+    test_lookup(peer, "0304", "", FALSE);
+
+    test_peer_free(peer);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/request/interleaved", test_request_interleaved);
+    g_test_add_func("/request/timeout", test_request_timeout);
+    g_test_add_func("/request/cancel", test_request_cancel);
+    g_test_add_func("/request/closed", test_request_closed);
+    g_test_add_func("/request/parts", test_request_parts);
+    g_test_add_func("/request/mismatch", test_request_mismatch);
+    g_test_add_func("/request/cache/lru", test_cache_lru);
+    g_test_add_func("/request/cache/negative", test_cache_negative);
+    g_test_add_func("/request/cache/invalidate", test_cache_invalidate);
+
+    return g_test_run();
+}